@@ -0,0 +1,238 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pch.h"
+
+#include "admin_handler.h"
+
+#include <boost/json.hpp>
+
+#include "app.hpp"
+#include "engine.h"
+
+namespace json = boost::json;
+
+namespace {
+
+constexpr std::string_view kBearer = "Bearer ";
+constexpr std::string_view kContentType = "application/json";
+
+json::object SettingsToJson(const VideoEncoder::Settings& settings) {
+  json::object jo;
+  jo["bitrate"] = settings.bitrate;
+  jo["quality"] = settings.quality;
+  jo["gop"] = settings.gop;
+  jo["preset"] = settings.preset;
+  return jo;
+}
+
+json::array HistogramToJson(const LatencyHistogram& histogram) {
+  json::array ja;
+  for (auto count : histogram.GetCounts()) {
+    ja.emplace_back(count);
+  }
+  return ja;
+}
+
+json::object EngineToJson(Engine& engine) {
+  json::object jo;
+  jo["running"] = engine.IsRunning();
+  if (!engine.IsRunning()) {
+    return jo;
+  }
+  jo["sessions"] = engine.GetAuthorizedCount();
+
+  const auto& latency = engine.GetVideoLatency();
+  json::object latency_jo;
+  latency_jo["convert_start"] = HistogramToJson(latency.convert_start);
+  latency_jo["convert_end"] = HistogramToJson(latency.convert_end);
+  latency_jo["encode_end"] = HistogramToJson(latency.encode_end);
+  latency_jo["enqueue"] = HistogramToJson(latency.enqueue);
+  latency_jo["write"] = HistogramToJson(latency.write);
+  json::object video_jo = SettingsToJson(engine.GetVideoSettings());
+  video_jo["latency"] = std::move(latency_jo);
+  jo["video"] = std::move(video_jo);
+
+  const auto metrics = engine.GetUserServicePool().GetMetrics();
+  json::object user_service_jo;
+  user_service_jo["requests"] = metrics.requests;
+  user_service_jo["connects"] = metrics.connects;
+  user_service_jo["reused"] = metrics.reused;
+  user_service_jo["pipelined"] = metrics.pipelined;
+  user_service_jo["retries"] = metrics.retries;
+  user_service_jo["failures"] = metrics.failures;
+  user_service_jo["connections"] = metrics.connections;
+  user_service_jo["queued"] = metrics.queued;
+  jo["user_service"] = std::move(user_service_jo);
+  return jo;
+}
+
+// Parses the fields present in |body| over |settings|, false if any of them
+// is malformed or out of range.
+bool ParseSettings(const Engine& engine,
+                   std::string_view body,
+                   VideoEncoder::Settings& settings) {
+  json::error_code ec;
+  json::value jv = json::parse(body, ec);
+  if (ec) {
+    return false;
+  }
+  auto jo = jv.if_object();
+  if (nullptr == jo) {
+    return false;
+  }
+
+  if (auto bitrate_jv = jo->if_contains("bitrate"); nullptr != bitrate_jv) {
+    auto bitrate = bitrate_jv->to_number<std::uint64_t>(ec);
+    if (ec || bitrate < VideoEncoder::kMinBitrate) {
+      return false;
+    }
+    settings.bitrate = bitrate;
+  }
+  if (auto quality_jv = jo->if_contains("quality"); nullptr != quality_jv) {
+    auto quality = quality_jv->to_number<std::uint32_t>(ec);
+    if (ec || quality > VideoEncoder::kMaxQuality) {
+      return false;
+    }
+    settings.quality = quality;
+  }
+  if (auto gop_jv = jo->if_contains("gop"); nullptr != gop_jv) {
+    auto gop = gop_jv->to_number<int>(ec);
+    if (ec || gop < VideoEncoder::kMinGop || gop > VideoEncoder::kMaxGop) {
+      return false;
+    }
+    settings.gop = gop;
+  }
+  if (auto preset_jv = jo->if_contains("preset"); nullptr != preset_jv) {
+    auto preset = preset_jv->if_string();
+    if (nullptr == preset ||
+        !engine.IsValidVideoPreset({preset->data(), preset->size()})) {
+      return false;
+    }
+    settings.preset.assign(preset->data(), preset->size());
+  }
+  return true;
+}
+
+}  // namespace
+
+AdminHandler::Response AdminHandler::Handle(const Request& request) {
+  Response response;
+  response.version(request.version());
+  response.keep_alive(false);
+  response.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+
+  const std::string_view target(request.target().data(),
+                                request.target().size());
+  if (token_.empty() || (target != kVideoTarget && target != kMetricsTarget)) {
+    response.result(http::status::not_found);
+  } else if (!IsAuthorized(request)) {
+    APP_WARNING() << "AdminHandler: unauthorized " << request.method_string()
+                  << ' ' << target << '\n';
+    response.result(http::status::unauthorized);
+    response.set(http::field::www_authenticate, "Bearer");
+  } else if (target == kVideoTarget) {
+    HandleVideo(request, response);
+  } else {
+    HandleMetrics(request, response);
+  }
+  response.prepare_payload();
+  return response;
+}
+
+bool AdminHandler::IsAuthorized(const Request& request) const noexcept {
+  auto it = request.find(http::field::authorization);
+  if (request.end() == it) {
+    return false;
+  }
+  std::string_view credentials(it->value().data(), it->value().size());
+  if (!credentials.starts_with(kBearer)) {
+    return false;
+  }
+  credentials.remove_prefix(kBearer.size());
+  if (credentials.size() != token_.size()) {
+    return false;
+  }
+
+  // Constant time, the token is a secret.
+  std::uint8_t difference = 0;
+  for (std::size_t i = 0; i < token_.size(); ++i) {
+    difference |= credentials[i] ^ token_[i];
+  }
+  return 0 == difference;
+}
+
+void AdminHandler::HandleVideo(const Request& request, Response& response) {
+  VideoEncoder::Settings settings = engine_.GetVideoSettings();
+  json::array ignored;
+  switch (request.method()) {
+    case http::verb::get:
+      break;
+    case http::verb::post: {
+      if (!ParseSettings(engine_, request.body(), settings)) {
+        APP_WARNING() << "AdminHandler: bad video settings "
+                      << request.body() << '\n';
+        response.result(http::status::bad_request);
+        return;
+      }
+      // Kept by the encoders at a constant quality, see
+      // VideoEncoder::Reconfigure().
+      const std::uint64_t bitrate = settings.bitrate;
+      engine_.ReconfigureVideo(settings);
+      settings = engine_.GetVideoSettings();
+      if (bitrate != settings.bitrate) {
+        ignored.emplace_back("bitrate");
+      }
+      break;
+    }
+    default:
+      response.result(http::status::method_not_allowed);
+      response.set(http::field::allow, "GET, POST");
+      return;
+  }
+
+  response.result(http::status::ok);
+  response.set(http::field::content_type, kContentType);
+  json::object jo = SettingsToJson(settings);
+  if (!ignored.empty()) {
+    jo["ignored"] = std::move(ignored);
+  }
+  response.body() = json::serialize(jo);
+}
+
+// Latency histograms count in buckets of powers of two microseconds, see
+// LatencyHistogram.
+void AdminHandler::HandleMetrics(const Request& request, Response& response) {
+  if (http::verb::get != request.method()) {
+    response.result(http::status::method_not_allowed);
+    response.set(http::field::allow, "GET");
+    return;
+  }
+
+  json::array instances;
+  for (std::size_t i = 0; i < g_app.GetEngineCount(); ++i) {
+    json::object jo = EngineToJson(g_app.Engine(i));
+    jo["instance"] = i;
+    instances.emplace_back(std::move(jo));
+  }
+  json::object jo;
+  jo["instances"] = std::move(instances);
+
+  response.result(http::status::ok);
+  response.set(http::field::content_type, kContentType);
+  response.body() = json::serialize(jo);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <boost/beast/http.hpp>
+
+#include "net.hpp"
+
+class Engine;
+
+// Serves the plain HTTP requests arriving on the WebSocket listener:
+// * GET /admin/video answers the video encoder settings as JSON;
+// * POST /admin/video changes any of "bitrate", "quality", "gop" and "preset"
+//   in the running encoder, and answers the requested settings;
+// * GET /admin/metrics answers the metrics of every engine of the process.
+// Every request needs "Authorization: Bearer <token>". Without a token the
+// endpoint does not exist.
+class AdminHandler {
+ public:
+  using Request = http::request<http::string_body>;
+  using Response = http::response<http::string_body>;
+
+  static constexpr std::string_view kVideoTarget = "/admin/video";
+  static constexpr std::string_view kMetricsTarget = "/admin/metrics";
+
+  explicit AdminHandler(Engine& engine) noexcept : engine_(engine) {}
+  ~AdminHandler() = default;
+
+  // Empty token disables the endpoint.
+  void SetToken(std::string token) noexcept { token_ = std::move(token); }
+
+  Response Handle(const Request& request);
+
+ private:
+  bool IsAuthorized(const Request& request) const noexcept;
+  void HandleVideo(const Request& request, Response& response);
+  void HandleMetrics(const Request& request, Response& response);
+
+ private:
+  Engine& engine_;
+  std::string token_;
+};
@@ -23,33 +23,109 @@
 
 class App {
  public:
-  bool Initialize() noexcept {
+  bool Initialize(std::size_t instance_count) noexcept {
     auto sec_desc = _T("D:P(A;;GA;;;WD)");
     if (!ConvertStringSecurityDescriptorToSecurityDescriptor(
             sec_desc, SDDL_REVISION_1, &sa_.lpSecurityDescriptor, nullptr)) {
       return false;
     }
     QueryPerformanceFrequency(&frequency_);
+
+    engines_.reserve(instance_count);
+    for (std::size_t i = 0; i < instance_count; ++i) {
+      engines_.emplace_back(std::make_unique<class Engine>(ioc_));
+    }
     return true;
   }
 
   ~App() {
+    // Destroys the handlers left queued, and the sessions they own, while the
+    // packet pools of the engines they return packets to still exist. The
+    // services stay until ioc_ goes, for the I/O objects of the engines.
+    ioc_.shutdown();
     if (nullptr != sa_.lpSecurityDescriptor) {
       LocalFree(sa_.lpSecurityDescriptor);
     }
   }
 
-  class Engine& Engine() noexcept {
-    return engine_;
+  net::io_context& GetIoContext() noexcept { return ioc_; }
+
+  std::size_t GetEngineCount() const noexcept { return engines_.size(); }
+  class Engine& Engine(std::size_t index) noexcept {
+    return *engines_[index];
+  }
+
+  // Run the I/O loop shared by all engines, returns after Stop().
+  void Run(std::size_t thread_count) noexcept {
+    std::vector<std::thread> io_threads;
+    io_threads.reserve(thread_count - 1);
+    for (std::size_t i = 1; i < thread_count; ++i) {
+      io_threads.emplace_back(&App::Loop, this);
+    }
+    Loop();
+    for (auto& t : io_threads) {
+      if (t.joinable()) {
+        t.join();
+      }
+    }
+  }
+
+  void Stop() noexcept {
+    for (auto& engine : engines_) {
+      engine->Stop();
+    }
+    try {
+      ioc_.stop();
+    } catch (std::exception& e) {
+#if _DEBUG
+      BOOST_LOG_SEV(logger_, SeverityLevel::kError) << e.what() << '\n';
+#else
+      boost::ignore_unused(e);
+#endif
+    }
+  }
+
+  void EncoderStop() noexcept {
+    for (auto& engine : engines_) {
+      engine->EncoderStop();
+    }
   }
   LARGE_INTEGER GetFrequency() const noexcept { return frequency_; }
+  std::uint64_t TicksToMicroseconds(std::uint64_t ticks) const noexcept {
+    const std::uint64_t frequency = frequency_.QuadPart;
+    return ticks / frequency * 1'000'000 +
+           ticks % frequency * 1'000'000 / frequency;
+  }
   const SECURITY_ATTRIBUTES* GetSA() const noexcept { return &sa_; }
   SECURITY_ATTRIBUTES* SA() noexcept { return &sa_; }
 
   src::severity_logger<SeverityLevel>& Logger() noexcept { return logger_; }
 
  private:
-  class Engine engine_;
+  void Loop() noexcept {
+    for (;;) {
+      try {
+        ioc_.run();
+        break;
+      } catch (std::exception& e) {
+#if _DEBUG
+        BOOST_LOG_SEV(logger_, SeverityLevel::kError) << e.what() << '\n';
+#else
+        boost::ignore_unused(e);
+#endif
+      }
+    }
+  }
+
+ private:
+  class IoContext : public net::io_context {
+   public:
+    using net::io_context::shutdown;
+  };
+
+  // Before engines_, which hold I/O objects of it.
+  IoContext ioc_;
+  std::vector<std::unique_ptr<class Engine>> engines_;
   LARGE_INTEGER frequency_{};
   SECURITY_ATTRIBUTES sa_{};
   src::severity_logger<SeverityLevel> logger_;
@@ -35,37 +35,34 @@ bool AudioEncoder::Initialize(std::string codec_name,
   codec_name_ = std::move(codec_name);
   bitrate_ = bitrate;
 
-  HANDLE ev = CreateEvent(g_app.SA(), TRUE, FALSE,
-                          object_namer_.Get(kAudioStartedEventName).data());
-  if (nullptr == ev) {
-    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %u\n",
-              GetLastError());
+  auto ec = started_event_.Create(object_namer_.Get(kAudioStartedEventName),
+                                  true, g_app.SA());
+  if (ec) {
+    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %d\n",
+              ec.value());
     return false;
   }
-  started_event_.Attach(ev);
 
-  ev = CreateEvent(g_app.SA(), TRUE, FALSE,
-                   object_namer_.Get(kAudioStoppedEventName).data());
-  if (nullptr == ev) {
-    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %u\n",
-              GetLastError());
+  ec = stop_event_.Create(object_namer_.Get(kAudioStoppedEventName), true,
+                          g_app.SA());
+  if (ec) {
+    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %d\n",
+              ec.value());
     return false;
   }
-  stop_event_.Attach(ev);
 
-  ev = CreateEvent(g_app.SA(), FALSE, FALSE,
-                   object_namer_.Get(kSharedAudioFrameReadyEventName).data());
-  if (nullptr == ev) {
-    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %u\n",
-              GetLastError());
+  ec = shared_frame_ready_event_.Create(
+      object_namer_.Get(kSharedAudioFrameReadyEventName), false, g_app.SA());
+  if (ec) {
+    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %d\n",
+              ec.value());
     return false;
   }
-  shared_frame_ready_event_.Attach(ev);
   return true;
 }
 
 int AudioEncoder::Run() {
-  ResetEvent(stop_event_);
+  stop_event_.Reset();
   thread_ = std::thread(&AudioEncoder::EncodingThread, this);
   if (nullptr == thread_.native_handle()) {
     APP_ERROR() << "Create thread failed with " << GetLastError() << ".\n";
@@ -121,16 +118,16 @@ int AudioEncoder::EncodingThread() {
                            sizeof(PackedAudioFrame) +
                            frame_bytes * kNumberOfSharedFrames;
   // UMU: In Pro version, may get audio from other process.
-  HRESULT hr = shared_frames_.MapSharedMem(
-      shared_mem_size,
-      object_namer_.Get(kSharedAudioFrameFileMappingName).data(), nullptr,
-      g_app.SA());
-  if (FAILED(hr)) {
-    APP_ERROR() << "MapSharedMem() failed with 0x" << std::hex << hr << ".\n";
+  auto ec = shared_frames_.Create(
+      object_namer_.Get(kSharedAudioFrameFileMappingName), shared_mem_size,
+      nullptr, g_app.SA());
+  if (ec) {
+    APP_ERROR() << "Create shared memory failed with " << ec.message()
+                << ".\n";
     error_code = -1;
     return error_code;
   }
-  SharedAudioFrames* saf = shared_frames_;
+  auto saf = shared_frames_.As<SharedAudioFrames>();
   strcpy_s(saf->codec_name, codec_name_.data());
   saf->channels = codec_context_->ch_layout.nb_channels;
   saf->frame_size = codec_context_->frame_size;
@@ -138,7 +135,7 @@ int AudioEncoder::EncodingThread() {
   saf->sample_format = codec_context_->sample_fmt;
   saf->frame0.timestamp = 0;
 
-  SetEvent(started_event_);
+  started_event_.Set();
   error_code = Encode();
   if (error_code < 0) {
     APP_ERROR() << "Encode() failed with " << error_code << ".\n";
@@ -151,11 +148,11 @@ void AudioEncoder::Free(bool wait_thread) {
   FreeHeader();
   sound_capturer_.Stop();
 
-  if (nullptr != started_event_) {
-    ResetEvent(started_event_);
+  if (started_event_) {
+    started_event_.Reset();
   }
-  if (nullptr != stop_event_) {
-    SetEvent(stop_event_);
+  if (stop_event_) {
+    stop_event_.Set();
   }
   if (wait_thread && thread_.joinable()) {
     thread_.join();
@@ -369,17 +366,14 @@ int AudioEncoder::Encode() {
   }
   BOOST_SCOPE_EXIT_ALL(&packet) { av_packet_free(&packet); };
 
-  for (HANDLE events[]{stop_event_, shared_frame_ready_event_};;) {
-    DWORD wait =
-        WaitForMultipleObjects(_countof(events), events, FALSE, INFINITE);
-    if (WAIT_OBJECT_0 == wait) {
+  for (;;) {
+    std::size_t wait = WaitForAny({&stop_event_, &shared_frame_ready_event_});
+    if (0 == wait) {
       ATLTRACE2(atlTraceUtil, 0, "%s: stopping.\n", __func__);
       break;
-    } else if (WAIT_OBJECT_0 + 1 != wait) {
-      int error_code = GetLastError();
-      APP_WARNING() << "Unexpected WaitForMultipleObjects() return " << wait
-                    << ", error code " << error_code << ".\n";
-      return error_code;
+    } else if (1 != wait) {
+      APP_WARNING() << "Unexpected WaitForAny() return " << wait << ".\n";
+      return -1;
     }
 
     for (;;) {
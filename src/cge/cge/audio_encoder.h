@@ -20,13 +20,15 @@
 #include "sound_capturer.h"
 
 #include "regame/shared_mem_info.h"
+#include "regame/shared_mem_transport.h"
 
 class ObjectNamer;
 
 class AudioEncoder : public Encoder {
  public:
-  AudioEncoder(ObjectNamer& object_namer)
-      : Encoder(regame::ServerAction::kAudio), object_namer_(object_namer) {}
+  AudioEncoder(Engine& engine, ObjectNamer& object_namer)
+      : Encoder(engine, regame::ServerAction::kAudio),
+        object_namer_(object_namer) {}
   ~AudioEncoder() = default;
 
   bool Initialize(std::string codec_name, uint64_t bitrate) noexcept;
@@ -46,15 +48,15 @@ class AudioEncoder : public Encoder {
   std::string codec_name_;
   uint64_t bitrate_;
 
-  CHandle started_event_;
-  CHandle stop_event_;
+  regame::SharedEvent started_event_;
+  regame::SharedEvent stop_event_;
   std::thread thread_;
 
   SoundCapturer sound_capturer_{object_namer_};
   AudioInfo source_audio_info_;
 
-  CAtlFileMapping<regame::SharedAudioFrames> shared_frames_;
-  CHandle shared_frame_ready_event_;
+  regame::SharedMemory shared_frames_;
+  regame::SharedEvent shared_frame_ready_event_;
 
   AVStream* stream_ = nullptr;
   AVCodecContext* codec_context_ = nullptr;
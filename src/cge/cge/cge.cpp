@@ -16,6 +16,9 @@
 
 #include "pch.h"
 
+#include <filesystem>
+#include <format>
+
 #include <boost/asio/detail/winsock_init.hpp>
 #include <boost/log/attributes/timer.hpp>
 #include <boost/log/sinks.hpp>
@@ -42,11 +45,13 @@
 // #pragma comment(lib, "avcodecd.lib")
 // #pragma comment(lib, "avformatd.lib")
 // #pragma comment(lib, "swresampled.lib")
+// #pragma comment(lib, "swscaled.lib")
 // #else
 #pragma comment(lib, "avutil.lib")
 #pragma comment(lib, "avcodec.lib")
 #pragma comment(lib, "avformat.lib")
 #pragma comment(lib, "swresample.lib")
+#pragma comment(lib, "swscale.lib")
 // #endif  // DEBUG
 
 #pragma warning(push)
@@ -65,13 +70,25 @@ constexpr uint64_t kDefaultAudioBitrate = 128000;
 constexpr auto kDefaultBindAddress{"::"sv};
 constexpr bool kDefaultDesktopMode = false;
 constexpr bool kDefaultDonotPresent = false;
+constexpr uint32_t kDefaultEncoderIdleFps = 0;
+constexpr uint32_t kDefaultEncoderLinger = 0;  // milliseconds
+constexpr bool kDefaultEncoderPrewarm = false;
 constexpr bool kDefaultGlobalMode = false;
+constexpr size_t kDefaultInstances = 1;
 constexpr uint16_t kDefaultPort = 8080;
 constexpr auto kDefaultUserService{"http://127.0.0.1:8545/"sv};
 constexpr uint64_t kDefaultVideoBitrate = 1'000'000;
 constexpr auto kDefaultVideoCodec{"h264"sv};
 constexpr int kDefaultVideoGop = 180;
+constexpr bool kDefaultVideoFixedSize = false;
+constexpr bool kDefaultVideoIntraRefresh = false;
 constexpr uint32_t kDefaultVideoQuality = 23;
+constexpr uint32_t kDefaultVideoRefreshInterval = 0;  // milliseconds
+constexpr uint32_t kDefaultVideoRoiQpOffset = 6;
+constexpr double kDefaultVideoScale = 1.0;
+constexpr uint32_t kDefaultVideoSlices = 0;
+constexpr uint32_t kDefaultVideoTemporalLayers = 1;
+constexpr uint32_t kDefaultVideoThreads = 1;
 
 constexpr std::array<std::string_view, 3> kValidAudioCodecs{"libopus", "aac",
                                                             "opus"};
@@ -94,23 +111,22 @@ constexpr size_t kDefaultMouseReplayIndex = 0;
 
 constexpr std::array<std::string_view, 3> kValidHardwareEncoders{"amf", "nvenc",
                                                                  "qsv"};
-constexpr std::array<std::string_view, 3> kValidAmfPreset{"speed", "balanced",
-                                                          "quality"};
-constexpr std::array<std::string_view, 10> kValidNvencPreset{
-    // NVENC_HAVE_NEW_PRESETS: slow=p7, medium=p4, fast=p1
-    "p1", "p2", "p3", "p4", "p5", "p6", "p7", "slow", "medium", "fast"};
-constexpr std::array<std::string_view, 7> kValidQsvPreset{
-    "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow"};
-constexpr std::array<std::string_view, 10> kValidPreset{
-    "ultrafast", "superfast", "veryfast", "faster",   "fast",
-    "medium",    "slow",      "slower",   "veryslow", "placebo"};
 
 constexpr uint32_t kMinAudioBitrate = 16'000;
 constexpr uint32_t kMaxAudioBitrate = 256'000;
-constexpr uint32_t kMinVideoBitrate = 100'000;
-constexpr int kMinGop = 1;
-constexpr int kMaxGop = 500;
-constexpr uint32_t kMaxVideoQuality = 51;
+constexpr uint64_t kMinVideoBitrate = VideoEncoder::kMinBitrate;
+constexpr int kMinGop = VideoEncoder::kMinGop;
+constexpr int kMaxGop = VideoEncoder::kMaxGop;
+constexpr uint32_t kMaxVideoQuality = VideoEncoder::kMaxQuality;
+constexpr uint32_t kMaxVideoRoiQpOffset = 25;
+constexpr uint32_t kMinVideoOutputSize = 16;
+constexpr uint32_t kMaxVideoOutputSize = 8192;
+constexpr uint32_t kMaxVideoThreads = 64;
+constexpr uint32_t kMaxEncoderIdleFps = 60;
+constexpr uint32_t kMaxVideoTemporalLayers =
+    OpenH264Encoder::kMaxTemporalLayers;
+constexpr size_t kMaxInstances = 64;
+constexpr size_t kIoThreadsPerInstance = 2;
 
 App g_app;
 
@@ -194,24 +210,41 @@ void InitializeLogger(SeverityLevel severity_level) {
 }  // namespace
 
 int main(int argc, char* argv[]) {
+  std::string admin_token;
   std::string audio_codec;
   uint64_t audio_bitrate = 0;
   std::string bind_address;
   std::vector<uint8_t> disable_keys;
   bool donot_present = false;
+  std::uint32_t encoder_idle_fps = 0;
+  std::uint32_t encoder_linger = 0;
+  bool encoder_prewarm = false;
   GamepadReplay gamepad_replay;
   HardwareEncoder hardware_encoder = HardwareEncoder::None;
   bool is_desktop_mode = false;
   bool is_global_mode = false;
+  size_t instances = 0;
   KeyboardReplay keyboard_replay;
   SeverityLevel log_level = SeverityLevel::kInfo;
+  std::string login_token_key;
   MouseReplay mouse_replay;
   std::uint16_t port = 0;
   std::uint64_t video_bitrate = 0;
   AVCodecID video_codec_id = AV_CODEC_ID_NONE;
+  bool video_fixed_size = false;
   int video_gop = 0;
+  bool video_intra_refresh = false;
+  std::uint32_t video_output_width = 0;
+  std::uint32_t video_output_height = 0;
   std::string video_preset;
   std::uint32_t video_quality = 0;
+  std::string video_record_dir;
+  std::uint32_t video_refresh_interval = 0;
+  std::uint32_t video_roi_qp_offset = 0;
+  double video_scale = 0.0;
+  std::uint32_t video_slices = 0;
+  std::uint32_t video_temporal_layers = 0;
+  std::uint32_t video_threads = 0;
   std::string user_service;
 
   try {
@@ -222,10 +255,14 @@ int main(int argc, char* argv[]) {
     std::string log_level_string;
     std::string mouse_replay_string;
     std::string video_codec;
+    std::string video_output_size;
 
     po::options_description desc("Usage");
     // clang-format off
     desc.add_options()("help,h", "Produce help message")
+      ("admin-token",
+        po::value<std::string>(&admin_token),
+        "Set the bearer token of the admin endpoint, which changes video encoder settings at runtime")
       ("audio-bitrate",
         po::value<uint64_t>(&audio_bitrate)->default_value(kDefaultAudioBitrate),
         "Set audio bitrate")
@@ -245,6 +282,18 @@ int main(int argc, char* argv[]) {
       ("desktop-mode",
         po::value<bool>(&is_desktop_mode)->default_value(kDefaultDesktopMode),
         "Set desktop mode")
+      ("encoder-idle-fps",
+        po::value<uint32_t>(&encoder_idle_fps)->default_value(kDefaultEncoderIdleFps),
+        "Encode at most this many frames per second while no session is "
+        "connected. [0, 60], 0 keeps the full rate")
+      ("encoder-linger",
+        po::value<uint32_t>(&encoder_linger)->default_value(kDefaultEncoderLinger),
+        "Keep the encoders running this many milliseconds after the last "
+        "session leaves, so that the next one does not wait for them to "
+        "start. 0 stops them at once")
+      ("encoder-prewarm",
+        po::value<bool>(&encoder_prewarm)->default_value(kDefaultEncoderPrewarm),
+        "Start the encoders at startup instead of with the first session")
       ("global-mode,g",
         po::value<bool>(&is_global_mode)->default_value(kDefaultGlobalMode),
         "In global mode, will prefix object names with Global\\.")
@@ -256,6 +305,10 @@ int main(int argc, char* argv[]) {
         po::value<std::string>(&hardware_encoder_string),
         std::string("Set video hardware encoder. Select one of ")
         .append(umu::string::ArrayJoin(kValidHardwareEncoders)).data())
+      ("instances",
+        po::value<size_t>(&instances)->default_value(kDefaultInstances),
+        "Set number of games served by this process. Instance i listens on "
+        "port + i and prefixes object names with Regame{i}_ when more than one")
       ("keyboard-replay",
         po::value<std::string>(&keyboard_replay_string)->default_value(kValidKeyboardReplayMethods.at(kDefaultKeyboardReplayIndex).data()),
         std::string("Set keyboard replay method. Select one of ")
@@ -264,6 +317,9 @@ int main(int argc, char* argv[]) {
         po::value<std::string>(&log_level_string)->default_value(kValidSeverityLevel.at(kDefaultSeverityLevelIndex).data()),
         std::string("Set logging severity level. Select one of ")
        .append(umu::string::ArrayJoin(kValidSeverityLevel)).data())
+      ("login-token-key",
+        po::value<std::string>(&login_token_key),
+        "Set the key shared with user service to verify login tokens locally")
       ("mouse-replay",
         po::value<std::string>(&mouse_replay_string)->default_value(kValidMouseReplayMethods.at(kDefaultMouseReplayIndex).data()),
         std::string("Set mouse replay method. Select one of ")
@@ -279,10 +335,22 @@ int main(int argc, char* argv[]) {
         "Set video bitrate")
       ("video-codec",
         po::value<std::string>(&video_codec)->default_value(kDefaultVideoCodec.data()),
-        "Set video codec. Select one of {h264, h265, hevc}, h265 == hevc")
+        "Set video codec. Select one of {h264, h265, hevc, av1}, h265 == hevc")
+      ("video-fixed-size",
+        po::value<bool>(&video_fixed_size)->default_value(kDefaultVideoFixedSize),
+        "Keep the first video dimension and letterbox sources of other sizes "
+        "into it, instead of restarting the video encoder")
       ("video-gop",
         po::value<int>(&video_gop)->default_value(kDefaultVideoGop),
         "Set video gop. [1, 500]")
+      ("video-intra-refresh",
+        po::value<bool>(&video_intra_refresh)->default_value(kDefaultVideoIntraRefresh),
+        "Sweep a column of intra blocks across every gop frames instead of "
+        "sending IDR frames, for x264, x265 and NVENC")
+      ("video-output-size",
+        po::value<std::string>(&video_output_size),
+        "Encode at this size instead of the source size, eg: 1920x1080. "
+        "Sources of another aspect ratio are letterboxed")
       ("video-preset",
         po::value<std::string>(&video_preset),
         std::string("Set preset for video encoder. For AMF, select one of ")
@@ -291,11 +359,41 @@ int main(int argc, char* argv[]) {
        .append(umu::string::ArrayJoin(kValidNvencPreset))
        .append("; For QSV, select one of ")
        .append(umu::string::ArrayJoin(kValidQsvPreset))
+       .append("; For software av1, select one of ")
+       .append(umu::string::ArrayJoin(kValidSvtAv1Preset))
        .append("; otherwise, select one of ")
        .append(umu::string::ArrayJoin(kValidPreset)).data())
       ("video-quality",
         po::value<uint32_t>(&video_quality)->default_value(kDefaultVideoQuality),
-        "Set video quality. [0, 51], lower is better, 0 is lossless.");
+        "Set video quality. [0, 51], lower is better, 0 is lossless.")
+      ("video-record-dir",
+        po::value<std::string>(&video_record_dir),
+        "Record shared YUV frames into raw video files in this directory, "
+        "which frame_replay plays back")
+      ("video-refresh-interval",
+        po::value<uint32_t>(&video_refresh_interval)->default_value(kDefaultVideoRefreshInterval),
+        "Skip encoding unchanged frames, but encode one at least every this "
+        "many milliseconds. 0 encodes every frame")
+      ("video-roi-qp-offset",
+        po::value<uint32_t>(&video_roi_qp_offset)->default_value(kDefaultVideoRoiQpOffset),
+        "Software encoders quantize unchanged tiles coarser and changed tiles "
+        "finer by this QP, which turns on adaptive quantization. [0, 25], 0 "
+        "disables")
+      ("video-scale",
+        po::value<double>(&video_scale)->default_value(kDefaultVideoScale),
+        "Encode at the source size times this. (0, 1]")
+      ("video-slices",
+        po::value<uint32_t>(&video_slices)->default_value(kDefaultVideoSlices),
+        "Set slices per frame of software encoders. [0, 64], 0 lets the "
+        "encoder pick, one per thread")
+      ("video-temporal-layers",
+        po::value<uint32_t>(&video_temporal_layers)->default_value(kDefaultVideoTemporalLayers),
+        "Encode h264 with OpenH264 in temporal layers, so that sessions "
+        "falling behind drop the upper layers. [1, 4], 1 uses libx264")
+      ("video-threads",
+        po::value<uint32_t>(&video_threads)->default_value(kDefaultVideoThreads),
+        "Set threads of software encoders, which encode slices of a frame in "
+        "parallel without adding latency. [0, 64], 0 is one per core");
     // clang-format on
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -386,6 +484,8 @@ int main(int argc, char* argv[]) {
       video_codec_id = AV_CODEC_ID_H264;
     } else if (video_codec == "h265" || video_codec == "hevc") {
       video_codec_id = AV_CODEC_ID_HEVC;
+    } else if (video_codec == "av1") {
+      video_codec_id = AV_CODEC_ID_AV1;
     } else {
       throw std::invalid_argument("unsupported video-codec!");
     }
@@ -431,7 +531,15 @@ int main(int argc, char* argv[]) {
         }
         break;
       default:
-        if (video_preset.empty()) {
+        if (AV_CODEC_ID_AV1 == video_codec_id) {
+          if (video_preset.empty()) {
+            video_preset = "12";
+          } else if (kValidSvtAv1Preset.cend() ==
+                     std::find(kValidSvtAv1Preset.cbegin(),
+                               kValidSvtAv1Preset.cend(), video_preset)) {
+            throw std::invalid_argument("unsupported av1 video-preset!");
+          }
+        } else if (video_preset.empty()) {
           video_preset = "ultrafast";
         } else if (kValidPreset.cend() == std::find(kValidPreset.cbegin(),
                                                     kValidPreset.cend(),
@@ -441,29 +549,101 @@ int main(int argc, char* argv[]) {
         break;
     }
 
+    if (encoder_idle_fps > kMaxEncoderIdleFps) {
+      throw std::out_of_range("encoder-idle-fps out of range!");
+    }
     if (video_quality > kMaxVideoQuality) {
       throw std::out_of_range("video-quality out of range!");
     }
+    if (video_roi_qp_offset > kMaxVideoRoiQpOffset) {
+      throw std::out_of_range("video-roi-qp-offset out of range!");
+    }
+    if (!video_output_size.empty()) {
+      std::vector<std::string> arr;
+      boost::algorithm::split(arr, video_output_size, boost::is_any_of("x"));
+      if (2 != arr.size()) {
+        throw std::invalid_argument("video-output-size must be WIDTHxHEIGHT!");
+      }
+      video_output_width = std::stoul(arr[0]);
+      video_output_height = std::stoul(arr[1]);
+      if (video_output_width < kMinVideoOutputSize ||
+          video_output_width > kMaxVideoOutputSize ||
+          video_output_height < kMinVideoOutputSize ||
+          video_output_height > kMaxVideoOutputSize) {
+        throw std::out_of_range("video-output-size out of range!");
+      }
+      if (0 != (video_output_width & 1) || 0 != (video_output_height & 1)) {
+        throw std::invalid_argument("video-output-size must be even!");
+      }
+      if (!vm["video-scale"].defaulted()) {
+        throw std::invalid_argument(
+            "video-output-size and video-scale are exclusive!");
+      }
+    }
+    if (video_scale <= 0.0 || video_scale > 1.0) {
+      throw std::out_of_range("video-scale out of range!");
+    }
+    if (video_slices > kMaxVideoThreads) {
+      throw std::out_of_range("video-slices out of range!");
+    }
+    if (video_threads > kMaxVideoThreads) {
+      throw std::out_of_range("video-threads out of range!");
+    }
+    if (video_temporal_layers < 1 ||
+        video_temporal_layers > kMaxVideoTemporalLayers) {
+      throw std::out_of_range("video-temporal-layers out of range!");
+    }
+    if (1 < video_temporal_layers &&
+        (AV_CODEC_ID_H264 != video_codec_id ||
+         HardwareEncoder::None != hardware_encoder)) {
+      throw std::invalid_argument(
+          "video-temporal-layers requires software h264!");
+    }
+    if (!video_record_dir.empty() &&
+        !std::filesystem::is_directory(video_record_dir)) {
+      throw std::invalid_argument("video-record-dir is not a directory!");
+    }
+
+    if (instances < 1 || instances > kMaxInstances ||
+        port + instances - 1 > std::numeric_limits<uint16_t>::max()) {
+      throw std::out_of_range("instances out of range!");
+    }
 
 #if _DEBUG
-    std::cout << "audio-bitrate: " << audio_bitrate << '\n'
+    std::cout << "admin-token: " << !admin_token.empty() << '\n'
+              << "audio-bitrate: " << audio_bitrate << '\n'
               << "audio-codec: " << audio_codec << '\n'
               << "bind-address: " << bind_address << '\n'
               << "desktop-mode: " << is_desktop_mode << '\n'
               << "disable-keys: " << disable_keys_string << '\n'
               << "donot-present: " << donot_present << '\n'
+              << "encoder-idle-fps: " << encoder_idle_fps << '\n'
+              << "encoder-linger: " << encoder_linger << '\n'
+              << "encoder-prewarm: " << encoder_prewarm << '\n'
               << "gamepad-replay: " << gamepad_replay_string << '\n'
               << "global-mode: " << is_global_mode << '\n'
               << "hardware-encoder: " << hardware_encoder_string << '\n'
+              << "instances: " << instances << '\n'
               << "keyboard-replay: " << keyboard_replay_string << '\n'
               << "log-level: " << log_level_string << '\n'
+              << "login-token-key: " << !login_token_key.empty() << '\n'
               << "mouse-replay: " << mouse_replay_string << '\n'
               << "port: " << port << '\n'
               << "video-bitrate: " << video_bitrate << '\n'
               << "video-codec: " << video_codec << '\n'
+              << "video-fixed-size: " << video_fixed_size << '\n'
               << "video-gop: " << video_gop << '\n'
+              << "video-intra-refresh: " << video_intra_refresh << '\n'
+              << "video-output-size: " << video_output_size << '\n'
               << "video-preset: " << video_preset << '\n'
               << "video-quality: " << video_quality << '\n'
+              << "video-record-dir: " << video_record_dir << '\n'
+              << "video-refresh-interval: " << video_refresh_interval << '\n'
+              << "video-roi-qp-offset: " << video_roi_qp_offset << '\n'
+              << "video-scale: " << video_scale << '\n'
+              << "video-slices: " << video_slices << '\n'
+              << "video-temporal-layers: " << video_temporal_layers << '\n'
+              << "video-threads: " << video_threads << '\n'
               << "user-service: " << user_service << '\n';
 #endif
   } catch (const std::invalid_argument& e) {
@@ -490,26 +670,56 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  if (!g_app.Initialize()) {
+  if (!g_app.Initialize(instances)) {
     APP_ERROR() << "Init Engine failed!\n";
     return EXIT_FAILURE;
   }
 
-  g_app.Engine().GetObjectNamer().SetGlobalMode(is_global_mode);
-  g_app.Engine().DisablePresent(donot_present);
+  for (size_t i = 0; i < instances; ++i) {
+    auto& engine = g_app.Engine(i);
+    auto& object_namer = engine.GetObjectNamer();
+    object_namer.SetGlobalMode(is_global_mode);
+    if (1 < instances) {
+      object_namer.SetPrefix(std::format(L"Regame{}_", i));
+    }
+    engine.DisablePresent(donot_present);
+    engine.GetAdminHandler().SetToken(admin_token);
+    engine.GetLoginCache().SetTokenKey(login_token_key);
+    engine.SetVideoRecordDirectory(video_record_dir);
+    engine.SetVideoRefreshInterval(
+        std::chrono::milliseconds(video_refresh_interval));
+    engine.SetVideoRoiQpOffset(static_cast<int>(video_roi_qp_offset));
+    engine.SetVideoFixedSize(video_fixed_size);
+    engine.SetVideoOutputSize(video_output_width, video_output_height);
+    engine.SetVideoScale(video_scale);
+    engine.SetVideoThreads(static_cast<int>(video_threads));
+    engine.SetVideoSlices(static_cast<int>(video_slices));
+    engine.SetVideoIntraRefresh(video_intra_refresh);
+    engine.SetVideoTemporalLayers(static_cast<int>(video_temporal_layers));
+    engine.SetVideoIdleFrameRate(encoder_idle_fps);
+    engine.SetEncoderLinger(std::chrono::milliseconds(encoder_linger));
+    engine.SetEncoderPrewarm(encoder_prewarm);
+
+    if (!engine.Start(
+            tcp::endpoint(kBindAddress, static_cast<uint16_t>(port + i)),
+            audio_codec, audio_bitrate, disable_keys, gamepad_replay,
+            is_desktop_mode, keyboard_replay, mouse_replay, video_bitrate,
+            video_codec_id, hardware_encoder, video_gop, video_preset,
+            video_quality, user_service)) {
+      g_app.Stop();
+      logging::core::get()->flush();
+      return EXIT_FAILURE;
+    }
+  }
 
-  net::signal_set signals(g_app.Engine().GetIoContext(), SIGINT, SIGTERM,
-                          SIGBREAK);
+  net::signal_set signals(g_app.GetIoContext(), SIGINT, SIGTERM, SIGBREAK);
   signals.async_wait([&](const boost::system::error_code&, int sig) {
     APP_INFO() << "receive signal(" << sig << ").\n";
-    g_app.Engine().Stop();
+    g_app.Stop();
   });
-  g_app.Engine().Run(tcp::endpoint(kBindAddress, port), std::move(audio_codec),
-                     audio_bitrate, disable_keys, gamepad_replay,
-                     is_desktop_mode, keyboard_replay, mouse_replay,
-                     video_bitrate, video_codec_id, hardware_encoder, video_gop,
-                     std::move(video_preset), video_quality, user_service);
-  g_app.Engine().EncoderStop();
+  g_app.Run(std::min<size_t>(kIoThreadsPerInstance * instances,
+                             std::max(std::thread::hardware_concurrency(), 2u)));
+  g_app.EncoderStop();
   logging::core::get()->flush();
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "damage_detector.h"
+
+#include <bit>
+#include <cstring>
+
+#include <intrin.h>
+#include <nmmintrin.h>
+
+namespace {
+
+bool HasCrc32() noexcept {
+  int info[4]{};
+  __cpuid(info, 1);
+  return 0 != (info[2] & (1 << 20));  // SSE4.2
+}
+
+std::uint64_t Load64(const std::uint8_t* data) noexcept {
+  std::uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// The 64-bit crc32 instruction exists on x64 only.
+#if defined(_M_X64) || defined(__x86_64__)
+constexpr std::size_t kCrc32WordSize = 8;
+
+std::uint64_t Crc32Word(std::uint64_t crc, const std::uint8_t* data) noexcept {
+  return _mm_crc32_u64(crc, Load64(data));
+}
+#else
+constexpr std::size_t kCrc32WordSize = 4;
+
+std::uint64_t Crc32Word(std::uint64_t crc, const std::uint8_t* data) noexcept {
+  std::uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return _mm_crc32_u32(static_cast<std::uint32_t>(crc), value);
+}
+#endif
+
+// Four chains, as a crc32 instruction has a latency of three cycles but a
+// throughput of one per cycle.
+struct Crc32Chains {
+  static constexpr std::size_t kStride = kCrc32WordSize * 4;
+  std::uint64_t c[4]{0, 1, 2, 3};
+
+  void Update(const std::uint8_t* data, std::size_t size) noexcept {
+    for (; kStride <= size; data += kStride, size -= kStride) {
+      c[0] = Crc32Word(c[0], data);
+      c[1] = Crc32Word(c[1], data + kCrc32WordSize);
+      c[2] = Crc32Word(c[2], data + kCrc32WordSize * 2);
+      c[3] = Crc32Word(c[3], data + kCrc32WordSize * 3);
+    }
+    for (; kCrc32WordSize <= size;
+         data += kCrc32WordSize, size -= kCrc32WordSize) {
+      c[0] = Crc32Word(c[0], data);
+    }
+    for (; 0 < size; ++data, --size) {
+      c[1] = _mm_crc32_u8(static_cast<std::uint32_t>(c[1]), *data);
+    }
+  }
+
+  std::uint64_t Final() const noexcept {
+    return ((c[0] ^ c[1]) << 32) | (c[2] ^ c[3]);
+  }
+};
+
+// Without SSE4.2.
+struct MultiplyChain {
+  static constexpr std::uint64_t kMultiplier = 0x9E3779B97F4A7C15;
+  std::uint64_t h = 0;
+
+  void Update(const std::uint8_t* data, std::size_t size) noexcept {
+    for (; 8 <= size; data += 8, size -= 8) {
+      h = (std::rotl(h, 23) ^ Load64(data)) * kMultiplier;
+    }
+    for (; 0 < size; ++data, --size) {
+      h = (std::rotl(h, 23) ^ *data) * kMultiplier;
+    }
+  }
+
+  std::uint64_t Final() const noexcept { return h ^ (h >> 29); }
+};
+
+template <typename Chain>
+std::uint64_t HashArea(std::span<const DamageDetector::Plane> planes,
+                       std::uint32_t column,
+                       std::uint32_t row) noexcept {
+  Chain chain;
+  for (const auto& plane : planes) {
+    const std::uint32_t x = column * plane.tile_width;
+    const std::uint32_t y = row * plane.tile_height;
+    if (plane.width <= x || plane.height <= y) {
+      continue;
+    }
+    const std::uint32_t width = std::min(plane.tile_width, plane.width - x);
+    const std::uint32_t height = std::min(plane.tile_height, plane.height - y);
+    const std::uint8_t* data = plane.data + y * plane.stride + x;
+    for (std::uint32_t i = 0; i < height; ++i, data += plane.stride) {
+      chain.Update(data, width);
+    }
+  }
+  return chain.Final();
+}
+
+}  // namespace
+
+DamageDetector::DamageDetector() noexcept : has_crc32_(HasCrc32()) {}
+
+void DamageDetector::Reset(std::uint32_t width, std::uint32_t height) {
+  columns_ = (width + kTileSize - 1) / kTileSize;
+  rows_ = (height + kTileSize - 1) / kTileSize;
+  hashes_.assign(static_cast<std::size_t>(columns_) * rows_, 0);
+  has_hashes_ = false;
+}
+
+std::uint32_t DamageDetector::Update(
+    std::span<const Plane> planes,
+    std::vector<std::uint8_t>& changed_tiles) noexcept {
+  changed_tiles.resize(hashes_.size());
+  std::uint32_t changed = 0;
+  std::size_t i = 0;
+  for (std::uint32_t row = 0; row < rows_; ++row) {
+    for (std::uint32_t column = 0; column < columns_; ++column, ++i) {
+      const std::uint64_t hash = HashTile(planes, column, row);
+      const bool is_changed = !has_hashes_ || hashes_[i] != hash;
+      hashes_[i] = hash;
+      changed_tiles[i] |= is_changed;
+      changed += 0 != changed_tiles[i];
+    }
+  }
+  has_hashes_ = true;
+  return changed;
+}
+
+std::uint64_t DamageDetector::HashTile(std::span<const Plane> planes,
+                                       std::uint32_t column,
+                                       std::uint32_t row) const noexcept {
+  if (has_crc32_) {
+    return HashArea<Crc32Chains>(planes, column, row);
+  }
+  return HashArea<MultiplyChain>(planes, column, row);
+}
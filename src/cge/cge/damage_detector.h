@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+// Finds the tiles of a frame which changed since the previous frame. Only a
+// hash of each tile of the previous frame is kept, as shared frames go back
+// to the capturer as soon as they are encoded.
+//
+// Tiles are kTileSize pixels square, the hash of a tile covers the same area
+// of every plane. Hashes are CRC32C in four independent chains when SSE4.2 is
+// available, so a tile costs little more than reading it once.
+class DamageDetector {
+ public:
+  static constexpr std::uint32_t kTileSize = 64;  // pixels
+
+  struct Plane {
+    const std::uint8_t* data;
+    std::ptrdiff_t stride;
+    std::uint32_t width;        // bytes
+    std::uint32_t height;       // rows
+    std::uint32_t tile_width;   // bytes
+    std::uint32_t tile_height;  // rows
+  };
+
+  DamageDetector() noexcept;
+  ~DamageDetector() = default;
+
+  // width and height of the frame in pixels. Every tile is changed in the
+  // next Update().
+  void Reset(std::uint32_t width, std::uint32_t height);
+
+  // Marks in changed_tiles, columns * rows row by row, the tiles changed since
+  // the previous Update(). Marks already set are kept, so the tiles of frames
+  // never encoded add up. Returns the number of marked tiles.
+  std::uint32_t Update(std::span<const Plane> planes,
+                       std::vector<std::uint8_t>& changed_tiles) noexcept;
+
+  std::uint32_t GetColumns() const noexcept { return columns_; }
+  std::uint32_t GetRows() const noexcept { return rows_; }
+
+ private:
+  std::uint64_t HashTile(std::span<const Plane> planes,
+                         std::uint32_t column,
+                         std::uint32_t row) const noexcept;
+
+ private:
+  const bool has_crc32_;
+  std::uint32_t columns_ = 0;
+  std::uint32_t rows_ = 0;
+  std::vector<std::uint64_t> hashes_;
+  bool has_hashes_ = false;
+};
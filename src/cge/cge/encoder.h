@@ -23,21 +23,33 @@
 constexpr int kH264TimeBase = 90000;
 constexpr size_t kInitialBufferSize = 0x100000;  // 1MB
 
+class Engine;
+
 class Encoder {
  public:
+  Engine& GetEngine() const noexcept { return engine_; }
   AVCodecID GetCodecID() const noexcept { return codec_id_; }
   const std::string& GetHeader() const noexcept { return header_; }
   regame::ServerAction GetServerAction() const noexcept { return action_; }
+  std::size_t GetPacketHeadSize() const noexcept {
+    return regame::ServerAction::kVideo == action_
+               ? sizeof(regame::ServerVideoHead)
+               : sizeof(regame::ServerPacketHead);
+  }
 
   void SaveHeader(std::span<std::uint8_t> buffer) noexcept {
     if (header_.empty()) {
-      header_.resize(sizeof(regame::PackageHead) +
-                     sizeof(regame::ServerPacketHead));
+      const std::size_t head_size = GetPacketHeadSize();
+      header_.resize(sizeof(regame::PackageHead) + head_size);
       auto head = reinterpret_cast<regame::PackageHead*>(header_.data());
-      head->size = htonl(
-          static_cast<int>(sizeof(regame::ServerPacketHead) + buffer.size()));
+      head->size = htonl(static_cast<int>(head_size + buffer.size()));
       auto packet = reinterpret_cast<regame::ServerPacketHead*>(head + 1);
       packet->action = GetServerAction();
+      if (regame::ServerAction::kVideo == packet->action) {
+        reinterpret_cast<regame::ServerVideoHead*>(packet)->extension_size =
+            static_cast<std::uint8_t>(head_size -
+                                      sizeof(regame::ServerPacketHead));
+      }
     } else {
       auto head = reinterpret_cast<regame::PackageHead*>(header_.data());
       head->size = htonl(ntohl(head->size) + static_cast<int>(buffer.size()));
@@ -46,13 +58,15 @@ class Encoder {
   }
 
  protected:
-  Encoder(regame::ServerAction action) : action_(action) {}
+  Encoder(Engine& engine, regame::ServerAction action)
+      : engine_(engine), action_(action) {}
   ~Encoder() = default;
 
   void FreeHeader() noexcept { header_.clear(); }
   void SetCodecID(AVCodecID codec_id) noexcept { codec_id_ = codec_id; }
 
  private:
+  Engine& engine_;
   AVCodecID codec_id_{AV_CODEC_ID_NONE};
   std::string header_;
   regame::ServerAction action_;
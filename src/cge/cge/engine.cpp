@@ -20,25 +20,26 @@
 
 #include "app.hpp"
 
+#include <boost/endian/conversion.hpp>
 #include <boost/url.hpp>
 
 using namespace regame;
 
-void Engine::Run(tcp::endpoint ws_endpoint,
-                 std::string audio_codec,
-                 uint64_t audio_bitrate,
-                 const std::vector<uint8_t>& disable_keys,
-                 GamepadReplay gamepad_replay,
-                 bool is_desktop_mode,
-                 KeyboardReplay keyboard_replay,
-                 MouseReplay mouse_replay,
-                 uint64_t video_bitrate,
-                 AVCodecID video_codec_id,
-                 HardwareEncoder hardware_encoder,
-                 int video_gop,
-                 std::string video_preset,
-                 uint32_t video_quality,
-                 const std::string& user_service) noexcept {
+bool Engine::Start(tcp::endpoint ws_endpoint,
+                   std::string audio_codec,
+                   uint64_t audio_bitrate,
+                   const std::vector<uint8_t>& disable_keys,
+                   GamepadReplay gamepad_replay,
+                   bool is_desktop_mode,
+                   KeyboardReplay keyboard_replay,
+                   MouseReplay mouse_replay,
+                   uint64_t video_bitrate,
+                   AVCodecID video_codec_id,
+                   HardwareEncoder hardware_encoder,
+                   int video_gop,
+                   std::string video_preset,
+                   uint32_t video_quality,
+                   const std::string& user_service) noexcept {
   is_desktop_mode_ = is_desktop_mode;
 
   try {
@@ -48,7 +49,7 @@ void Engine::Run(tcp::endpoint ws_endpoint,
     if (ur.has_error()) {
       APP_ERROR() << "Invalid user service URI: " << ur.error().message()
                   << '\n';
-      return;
+      return false;
     }
     url u(ur.value());
     std::uint16_t port = 0;
@@ -66,7 +67,7 @@ void Engine::Run(tcp::endpoint ws_endpoint,
     }
     if (0 == port) {
       APP_ERROR() << "Invalid user service URI: no port!\n";
-      return;
+      return false;
     }
 
     switch (u.host_type()) {
@@ -92,76 +93,107 @@ void Engine::Run(tcp::endpoint ws_endpoint,
     APP_TRACE() << "User service: " << user_service_endpoint_
                 << user_service_target_ << '\n';
 #endif
+    user_service_pool_ = std::make_shared<UserServicePool>(
+        ioc_, user_service_endpoint_, user_service_target_);
+    keep_alive_batcher_ =
+        std::make_shared<KeepAliveBatcher>(ioc_, user_service_pool_);
 
     if (!audio_encoder_.Initialize(std::move(audio_codec), audio_bitrate)) {
       APP_ERROR() << "Initialize audio encoder failed!\n";
-      return;
+      return false;
     }
 
     if (!video_encoder_.Initialize(video_bitrate, video_codec_id,
                                    hardware_encoder, video_gop,
                                    std::move(video_preset), video_quality)) {
       APP_ERROR() << "Initialize video encoder failed!\n";
-      return;
+      return false;
     }
 
     game_service_ = std::make_shared<GameService>(
-        ioc_, ws_endpoint, gamepad_replay, keyboard_replay, mouse_replay);
+        *this, ioc_, ws_endpoint, disable_keys, gamepad_replay,
+        keyboard_replay, mouse_replay);
     APP_INFO() << "Regame service via WebSocket on " << ws_endpoint << '\n';
-    GameControl::SetDisableKeys(disable_keys);
     game_service_->Run();
+    if (encoder_prewarm_) {
+      std::lock_guard<std::mutex> lock(encoder_mutex_);
+      video_encoder_.SetIdle(true);
+      StartEncoders();
+    }
   } catch (std::exception& e) {
     APP_FATAL() << e.what() << '\n';
-    return;
+    return false;
   }
 
   running_ = true;
-  auto io_thread = std::thread(&Engine::Loop, this);
-  Loop();
-  if (io_thread.joinable()) {
-    io_thread.join();
+  return true;
+}
+
+void Engine::Stop() noexcept {
+  if (!running_) {
+    return;
   }
+  game_service_->Stop(false);
+  keep_alive_batcher_->Stop();
+  user_service_pool_->ReportMetrics();
+  user_service_pool_->Close();
   running_ = false;
 }
 
-void Engine::Loop() noexcept {
-  for (;;) {
-    try {
-      ioc_.run();
-      break;
-    } catch (std::exception& e) {
-#if _DEBUG
-      APP_ERROR() << e.what() << '\n';
-#else
-      boost::ignore_unused(e);
-#endif
-    }
-  }
+void Engine::EncoderRun() {
+  std::lock_guard<std::mutex> lock(encoder_mutex_);
+  linger_timer_.cancel();
+  video_encoder_.SetIdle(false);
+  StartEncoders();
 }
 
-void Engine::Stop() noexcept {
-  if (!running_) {
+void Engine::EncoderIdle() {
+  std::lock_guard<std::mutex> lock(encoder_mutex_);
+  if (0 == encoder_linger_.count()) {
+    StopEncoders();
     return;
   }
-  game_service_->Stop(false);
-  try {
-    ioc_.stop();
-    running_ = false;
-  } catch (std::exception& e) {
-#if _DEBUG
-    APP_ERROR() << e.what() << '\n';
-#else
-    boost::ignore_unused(e);
-#endif
+  if (!encoders_running_) {
+    return;
   }
+
+  APP_INFO() << "Encoders idle, linger " << encoder_linger_.count()
+             << "ms.\n";
+  video_encoder_.SetIdle(true);
+  linger_timer_.expires_after(encoder_linger_);
+  linger_timer_.async_wait([this](const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(encoder_mutex_);
+    // Neither rearmed nor run again after this handler was queued.
+    if (video_encoder_.IsIdle() &&
+        linger_timer_.expiry() <= net::steady_timer::clock_type::now()) {
+      StopEncoders();
+    }
+  });
 }
 
-void Engine::EncoderRun() {
+void Engine::EncoderStop() {
+  std::lock_guard<std::mutex> lock(encoder_mutex_);
+  StopEncoders();
+}
+
+void Engine::StartEncoders() noexcept {
+  if (encoders_running_) {
+    return;
+  }
+  encoders_running_ = true;
   audio_encoder_.Run();
   video_encoder_.Run();
 }
 
-void Engine::EncoderStop() {
+void Engine::StopEncoders() noexcept {
+  linger_timer_.cancel();
+  if (!encoders_running_) {
+    return;
+  }
+  encoders_running_ = false;
   audio_encoder_.Stop();
   video_encoder_.Stop();
 }
@@ -173,20 +205,45 @@ int Engine::OnWriteHeader(void* opaque, uint8_t* data, int size) noexcept {
 }
 
 int Engine::OnWritePacket(void* opaque, uint8_t* data, int size) noexcept {
-  return g_app.Engine().WritePacket(opaque, std::span(data, size));
+  auto ei = static_cast<Encoder*>(opaque);
+  return ei->GetEngine().WritePacket(ei, std::span(data, size));
 }
 
-int Engine::WritePacket(void* opaque, std::span<uint8_t> packet) noexcept {
-  auto ei = static_cast<Encoder*>(opaque);
-  std::string buffer;
-  buffer.resize(sizeof(regame::PackageHead) + sizeof(regame::ServerPacketHead) +
-                packet.size());
+int Engine::WritePacket(Encoder* ei, std::span<uint8_t> packet) noexcept {
+  const std::size_t head_size = ei->GetPacketHeadSize();
+  std::string buffer = packet_pool_.Acquire(sizeof(regame::PackageHead) +
+                                            head_size + packet.size());
   auto package_head = reinterpret_cast<regame::PackageHead*>(buffer.data());
-  package_head->size =
-      htonl(static_cast<int>(sizeof(regame::ServerPacketHead) + packet.size()));
+  package_head->size = htonl(static_cast<int>(head_size + packet.size()));
   auto head = reinterpret_cast<regame::ServerPacketHead*>(package_head + 1);
   head->action = ei->GetServerAction();
-  memcpy(head + 1, packet.data(), packet.size());
+  if (regame::ServerAction::kVideo == head->action) {
+    const auto& frame_info = static_cast<VideoEncoder*>(ei)->GetFrameInfo();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    using boost::endian::native_to_big;
+    auto video_head = reinterpret_cast<regame::ServerVideoHead*>(head);
+    video_head->extension_size =
+        static_cast<std::uint8_t>(head_size - sizeof(regame::ServerPacketHead));
+    video_head->flags = frame_info.is_keyframe ? regame::VideoFlags::kKeyframe
+                                               : regame::VideoFlags{};
+    video_head->temporal_id = frame_info.temporal_id;
+    video_head->frame_id = native_to_big(frame_info.frame_id);
+    video_head->capture_timestamp = native_to_big(
+        g_app.TicksToMicroseconds(frame_info.capture_timestamp));
+    video_head->encode_duration = native_to_big(static_cast<std::uint32_t>(
+        g_app.TicksToMicroseconds(frame_info.encode_duration)));
+    video_head->enqueue_timestamp =
+        native_to_big(g_app.TicksToMicroseconds(now.QuadPart));
+    if (0 != frame_info.capture_timestamp) {
+      video_encoder_.GetLatency().enqueue.Add(
+          g_app.TicksToMicroseconds(now.QuadPart -
+                                    frame_info.capture_timestamp));
+    }
+  }
+  memcpy(reinterpret_cast<std::uint8_t*>(head) + head_size, packet.data(),
+         packet.size());
   game_service_->Send(std::move(buffer));
   return 0;
 }
@@ -224,6 +281,9 @@ void Engine::NotifyRestartVideoEncoder() noexcept {
 }
 
 void Engine::RestartVideoEncoder() noexcept {
+  std::lock_guard<std::mutex> lock(encoder_mutex_);
   video_encoder_.Stop();
-  video_encoder_.Run();
+  if (encoders_running_) {
+    video_encoder_.Run();
+  }
 }
\ No newline at end of file
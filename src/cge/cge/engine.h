@@ -18,14 +18,19 @@
 
 #include "net.hpp"
 
+#include "admin_handler.h"
 #include "audio_encoder.h"
 #include "game_service.h"
+#include "keep_alive_batcher.h"
+#include "login_cache.h"
 #include "object_namer.h"
+#include "packet_pool.h"
+#include "user_service_pool.h"
 #include "video_encoder.h"
 
 class Engine {
  public:
-  Engine() = default;
+  explicit Engine(net::io_context& ioc) noexcept : ioc_(ioc) {}
   ~Engine() = default;
 
   static int OnWriteHeader(void* opaque, uint8_t* data, int size) noexcept;
@@ -33,24 +38,36 @@ class Engine {
 
   net::io_context& GetIoContext() { return ioc_; }
 
-  void Run(tcp::endpoint ws_endpoint,
-           std::string audio_codec,
-           uint64_t audio_bitrate,
-           const std::vector<uint8_t>& disable_keys,
-           GamepadReplay gamepad_replay,
-           bool is_desktop_mode,
-           KeyboardReplay keyboard_replay,
-           MouseReplay mouse_replay,
-           uint64_t video_bitrate,
-           AVCodecID video_codec_id,
-           HardwareEncoder hardware_encoder,
-           int video_gop,
-           std::string video_preset,
-           uint32_t video_quality,
-           const std::string& user_service) noexcept;
+  // Sends an encoded packet to all authorized sessions.
+  int WritePacket(Encoder* encoder, std::span<uint8_t> packet) noexcept;
+
+  // Start serving on the shared io_context, which is run by App.
+  bool Start(tcp::endpoint ws_endpoint,
+             std::string audio_codec,
+             uint64_t audio_bitrate,
+             const std::vector<uint8_t>& disable_keys,
+             GamepadReplay gamepad_replay,
+             bool is_desktop_mode,
+             KeyboardReplay keyboard_replay,
+             MouseReplay mouse_replay,
+             uint64_t video_bitrate,
+             AVCodecID video_codec_id,
+             HardwareEncoder hardware_encoder,
+             int video_gop,
+             std::string video_preset,
+             uint32_t video_quality,
+             const std::string& user_service) noexcept;
   void Stop() noexcept;
+  bool IsRunning() const noexcept { return running_; }
+  std::size_t GetAuthorizedCount() const {
+    return game_service_ ? game_service_->GetAuthorizedCount() : 0;
+  }
 
+  // Sessions start the encoders, and the last one to leave idles them. Idle
+  // encoders keep running for the linger period, so that the next session
+  // only waits for a keyframe, then stop.
   void EncoderRun();
+  void EncoderIdle();
   void EncoderStop();
 
   void DisablePresent(bool donot_present);
@@ -83,6 +100,54 @@ class Engine {
   }
 
   void VideoProduceKeyframe() noexcept { video_encoder_.ProduceKeyframe(); }
+  // Takes effect in the running encoder, see VideoEncoder::Reconfigure().
+  void ReconfigureVideo(VideoEncoder::Settings settings) {
+    video_encoder_.Reconfigure(std::move(settings));
+  }
+  VideoEncoder::Settings GetVideoSettings() const {
+    return video_encoder_.GetSettings();
+  }
+  bool IsValidVideoPreset(std::string_view preset) const noexcept {
+    return video_encoder_.IsValidPreset(preset);
+  }
+  VideoLatency& GetVideoLatency() noexcept {
+    return video_encoder_.GetLatency();
+  }
+  void SetVideoRecordDirectory(std::filesystem::path directory) noexcept {
+    video_encoder_.SetRecordDirectory(std::move(directory));
+  }
+  void SetVideoRefreshInterval(std::chrono::milliseconds interval) noexcept {
+    video_encoder_.SetRefreshInterval(interval);
+  }
+  void SetVideoRoiQpOffset(int qp_offset) noexcept {
+    video_encoder_.SetRoiQpOffset(qp_offset);
+  }
+  void SetVideoFixedSize(bool fixed_size) noexcept {
+    video_encoder_.SetFixedSize(fixed_size);
+  }
+  void SetVideoOutputSize(std::uint32_t width, std::uint32_t height) noexcept {
+    video_encoder_.SetOutputSize(width, height);
+  }
+  void SetVideoScale(double scale) noexcept { video_encoder_.SetScale(scale); }
+  void SetVideoThreads(int threads) noexcept {
+    video_encoder_.SetThreads(threads);
+  }
+  void SetVideoSlices(int slices) noexcept { video_encoder_.SetSlices(slices); }
+  void SetVideoIntraRefresh(bool intra_refresh) noexcept {
+    video_encoder_.SetIntraRefresh(intra_refresh);
+  }
+  void SetVideoTemporalLayers(int temporal_layers) noexcept {
+    video_encoder_.SetTemporalLayers(temporal_layers);
+  }
+  void SetVideoIdleFrameRate(std::uint32_t frame_rate) noexcept {
+    video_encoder_.SetIdleFrameRate(frame_rate);
+  }
+  // Zero stops the encoders as soon as the last session leaves.
+  void SetEncoderLinger(std::chrono::milliseconds linger) noexcept {
+    encoder_linger_ = linger;
+  }
+  // Starts the encoders idle in Start(), instead of with the first session.
+  void SetEncoderPrewarm(bool prewarm) noexcept { encoder_prewarm_ = prewarm; }
   
   const tcp::endpoint& GetUserServiceEndpoint() noexcept {
     return user_service_endpoint_;
@@ -90,32 +155,51 @@ class Engine {
   const std::string& GetUserServiceTarget() noexcept {
     return user_service_target_;
   }
+  UserServicePool& GetUserServicePool() noexcept {
+    return *user_service_pool_;
+  }
+  KeepAliveBatcher& GetKeepAliveBatcher() noexcept {
+    return *keep_alive_batcher_;
+  }
+  AdminHandler& GetAdminHandler() noexcept { return admin_handler_; }
+  LoginCache& GetLoginCache() noexcept { return login_cache_; }
+  PacketPool& GetPacketPool() noexcept { return packet_pool_; }
 
   ObjectNamer& GetObjectNamer() noexcept { return object_namer_; }
 
   const bool IsDesktopMode() const noexcept { return is_desktop_mode_; }
 
  private:
-  int WritePacket(void* opaque, std::span<uint8_t> packet) noexcept;
-
-  void Loop() noexcept;
-
   void RestartVideoEncoder() noexcept;
+  // Called with encoder_mutex_ held.
+  void StartEncoders() noexcept;
+  void StopEncoders() noexcept;
 
  private:
   bool running_ = false;
 
-  net::io_context ioc_{2};
+  net::io_context& ioc_;
   std::shared_ptr<GameService> game_service_;
 
   ObjectNamer object_namer_;
-  AudioEncoder audio_encoder_{object_namer_};
-  VideoEncoder video_encoder_{object_namer_};
+  AudioEncoder audio_encoder_{*this, object_namer_};
+  VideoEncoder video_encoder_{*this, object_namer_};
+
+  std::mutex encoder_mutex_;
+  bool encoders_running_ = false;
+  bool encoder_prewarm_ = false;
+  std::chrono::milliseconds encoder_linger_{0};
+  net::steady_timer linger_timer_{ioc_};
 
   CHandle donot_present_event_;
 
   tcp::endpoint user_service_endpoint_;
   std::string user_service_target_;
+  std::shared_ptr<UserServicePool> user_service_pool_;
+  std::shared_ptr<KeepAliveBatcher> keep_alive_batcher_;
+  AdminHandler admin_handler_{*this};
+  LoginCache login_cache_;
+  PacketPool packet_pool_;
 
   bool is_desktop_mode_{false};
 };
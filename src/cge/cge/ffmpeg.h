@@ -29,8 +29,10 @@ _CRT_BEGIN_C_HEADER
 #include <libavutil/avassert.h>
 #include <libavutil/avstring.h>
 #include <libavutil/frame.h>
+#include <libavutil/hmac.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/sha.h>
 
 #include <libswresample/swresample.h>
 
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "frame_recorder.h"
+
+#include "app.hpp"
+
+#include "regame/shared_mem_transport.h"
+
+using namespace regame;
+
+bool FrameRecorder::Open(const std::filesystem::path& path,
+                         const SharedVideoFrameInfo& frame_info,
+                         std::uint32_t data_size) {
+  Close();
+
+  file_.open(path, std::ios::binary | std::ios::trunc);
+  if (!file_) {
+    APP_ERROR() << "Open " << path.string() << " for recording failed.\n";
+    return false;
+  }
+
+  RawVideoFileHeader header{};
+  std::copy(std::begin(kRawVideoFileMagic), std::end(kRawVideoFileMagic),
+            header.magic);
+  header.version = kRawVideoFileVersion;
+  header.type = frame_info.type;
+  header.width = frame_info.width;
+  header.height = frame_info.height;
+  header.data_size = data_size;
+  header.timestamp_frequency = GetTimestampFrequency();
+  file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!file_) {
+    APP_ERROR() << "Write " << path.string() << " failed.\n";
+    file_.close();
+    return false;
+  }
+
+  path_ = path;
+  data_size_ = data_size;
+  buffers_.assign(kMaxPendingFrames, std::vector<std::uint8_t>(data_size));
+  free_.clear();
+  pending_.clear();
+  for (auto& buffer : buffers_) {
+    free_.emplace_back(&buffer);
+  }
+  stopped_ = false;
+  recorded_frames_ = 0;
+  dropped_frames_ = 0;
+  writer_ = std::thread(&FrameRecorder::WriterThread, this);
+  APP_INFO() << "Recording video to " << path.string() << ".\n";
+  return true;
+}
+
+void FrameRecorder::Close() noexcept {
+  if (!writer_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  pending_cv_.notify_one();
+  writer_.join();
+  file_.close();
+  buffers_.clear();
+  free_.clear();
+  APP_INFO() << "Recorded " << recorded_frames_ << " frames to "
+             << path_.string() << ", dropped " << dropped_frames_ << ".\n";
+}
+
+void FrameRecorder::Write(const PackedVideoYuvFrame* frame) noexcept {
+  std::vector<std::uint8_t>* buffer = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      ++dropped_frames_;
+      return;
+    }
+    buffer = free_.front();
+    free_.pop_front();
+  }
+
+  std::memcpy(buffer->data(), frame, data_size_);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace_back(buffer);
+  }
+  pending_cv_.notify_one();
+}
+
+void FrameRecorder::WriterThread() {
+  for (;;) {
+    std::vector<std::uint8_t>* buffer = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      pending_cv_.wait(lock, [this] { return stopped_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        // Stopped and everything queued is written.
+        return;
+      }
+      buffer = pending_.front();
+      pending_.pop_front();
+    }
+
+    file_.write(reinterpret_cast<const char*>(buffer->data()), data_size_);
+    if (!file_) {
+      APP_ERROR() << "Write " << path_.string()
+                  << " failed, recording stopped.\n";
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Drops whatever comes next.
+      pending_.clear();
+      return;
+    }
+    ++recorded_frames_;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.emplace_back(buffer);
+  }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "regame/raw_video_file.h"
+
+// Copies the shared YUV frames seen by VideoEncoder into a raw video file,
+// see regame/raw_video_file.h, so that the content of a game can be replayed
+// elsewhere with frame_replay.
+//
+// Frames are written by a thread of the recorder. The encoder never waits
+// for the disk: when all kMaxPendingFrames buffers are queued, the frame is
+// not recorded and counted.
+class FrameRecorder {
+ public:
+  static constexpr std::size_t kMaxPendingFrames = 8;
+
+  FrameRecorder() noexcept = default;
+  ~FrameRecorder() noexcept { Close(); }
+
+  bool Open(const std::filesystem::path& path,
+            const regame::SharedVideoFrameInfo& frame_info,
+            std::uint32_t data_size);
+  void Close() noexcept;
+  bool IsOpen() const noexcept { return writer_.joinable(); }
+
+  // data_size bytes.
+  void Write(const regame::PackedVideoYuvFrame* frame) noexcept;
+
+ private:
+  void WriterThread();
+
+ private:
+  std::filesystem::path path_;
+  std::ofstream file_;
+  std::uint32_t data_size_ = 0;
+  std::thread writer_;
+
+  std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::vector<std::vector<std::uint8_t>> buffers_;
+  std::deque<std::vector<std::uint8_t>*> free_;
+  std::deque<std::vector<std::uint8_t>*> pending_;
+  bool stopped_ = false;
+
+  std::uint64_t recorded_frames_ = 0;  // writer only
+  std::uint64_t dropped_frames_ = 0;
+};
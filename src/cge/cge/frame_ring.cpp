@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include <algorithm>
+
+#include "frame_ring.h"
+
+int FrameRing::Initialize(
+    std::size_t size,
+    const std::function<int(AVFrame*&)>& initialize_frame) {
+  assert(slots_.empty());
+  assert(1 < size);
+
+  slots_.resize(size);
+  for (auto& slot : slots_) {
+    int error_code = initialize_frame(slot.frame);
+    if (error_code < 0) {
+      Free();
+      return error_code;
+    }
+    free_.emplace_back(&slot);
+  }
+  stopped_ = false;
+  dropped_frames_ = 0;
+  return 0;
+}
+
+void FrameRing::Free() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.clear();
+  ready_.clear();
+  for (auto& slot : slots_) {
+    av_frame_free(&slot.frame);
+  }
+  slots_.clear();
+}
+
+FrameRing::Slot* FrameRing::Acquire() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Slot* slot = nullptr;
+  if (!free_.empty()) {
+    slot = free_.front();
+    free_.pop_front();
+  } else if (!ready_.empty()) {
+    slot = ready_.front();
+    ready_.pop_front();
+    ++dropped_frames_;
+    // Without a frame after it, the changed tiles stay in the slot for the
+    // frame converted into it.
+    if (!ready_.empty()) {
+      auto& changed_tiles = ready_.front()->changed_tiles;
+      if (changed_tiles.size() == slot->changed_tiles.size()) {
+        for (std::size_t i = 0; i < changed_tiles.size(); ++i) {
+          changed_tiles[i] |= slot->changed_tiles[i];
+        }
+      }
+      std::fill(slot->changed_tiles.begin(), slot->changed_tiles.end(), 0);
+    }
+  }
+  // Only the consumer holds a slot besides the producer, so with at least two
+  // slots there is always one to reuse.
+  assert(nullptr != slot);
+  return slot;
+}
+
+void FrameRing::Push(Slot* slot) noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.emplace_back(slot);
+  }
+  ready_cv_.notify_one();
+}
+
+FrameRing::Slot* FrameRing::Pop() noexcept {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ready_cv_.wait(lock, [this] { return stopped_ || !ready_.empty(); });
+  if (stopped_) {
+    return nullptr;
+  }
+  Slot* slot = ready_.front();
+  ready_.pop_front();
+  return slot;
+}
+
+void FrameRing::Release(Slot* slot) noexcept {
+  std::fill(slot->changed_tiles.begin(), slot->changed_tiles.end(), 0);
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.emplace_back(slot);
+}
+
+void FrameRing::Stop() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  ready_cv_.notify_all();
+}
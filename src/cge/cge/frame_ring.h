@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+#include "ffmpeg.h"
+
+// Frames handed from the conversion stage to the encode stage of
+// VideoEncoder. A slot is free, owned by one stage, or ready to be encoded.
+//
+// The producer never blocks: when no slot is free, the oldest ready frame is
+// dropped and its slot reused, so the encoder always gets the newest frames,
+// as it did when it read the newest shared frame itself. The changed tiles of
+// a dropped frame are added to the frame after it, or to the frame converted
+// into its slot when no other frame is ready.
+class FrameRing {
+ public:
+  struct Slot {
+    AVFrame* frame = nullptr;
+    std::uint64_t capture_timestamp = 0;  // performance counter ticks
+    std::uint64_t convert_start = 0;      // performance counter ticks
+    std::uint64_t convert_end = 0;        // performance counter ticks
+    // Nonzero for the tiles changed since the previous frame encoded, empty
+    // without damage detection, see DamageDetector. Cleared on Release().
+    std::vector<std::uint8_t> changed_tiles;
+  };
+
+  FrameRing() noexcept = default;
+  ~FrameRing() noexcept { Free(); }
+
+  // Calls initialize_frame() to allocate the frame of each slot.
+  int Initialize(std::size_t size,
+                 const std::function<int(AVFrame*&)>& initialize_frame);
+  void Free() noexcept;
+
+  // Producer.
+  Slot* Acquire() noexcept;
+  void Push(Slot* slot) noexcept;
+
+  // Consumer, blocks until a frame is ready, nullptr after Stop().
+  Slot* Pop() noexcept;
+  void Release(Slot* slot) noexcept;
+
+  void Stop() noexcept;
+
+  std::uint64_t GetDroppedFrames() const noexcept { return dropped_frames_; }
+
+ private:
+  std::vector<Slot> slots_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  std::deque<Slot*> free_;
+  std::deque<Slot*> ready_;
+  bool stopped_ = false;
+  std::uint64_t dropped_frames_ = 0;
+};
@@ -26,13 +26,53 @@
 #include "app.hpp"
 #include "game_service.h"
 
-std::array<bool, 256> GameControl::disable_keys_{};
-POINT GameControl::mouse_last_pos_{};
+namespace {
+
+// Size of the single-event struct, 0 if it can't be carried in a batch.
+std::size_t ControlSize(regame::ControlType type) noexcept {
+  using enum regame::ControlType;
+
+  switch (type) {
+    case kKeyboard:
+    case kKeyboardVk:
+      return sizeof(regame::ClientKeyboard);
+    case kMouseMove:
+      return sizeof(regame::ClientMouseMove);
+    case kMouseButton:
+      return sizeof(regame::ClientMouseButton);
+    case kMouseWheel:
+      return sizeof(regame::ClientMouseWheel);
+    case kRelativeMouseMove:
+      return sizeof(regame::ClientRelativeMouseMove);
+    case kRelativeMouseButton:
+      return sizeof(regame::ClientRelativeMouseButton);
+    case kRelativeMouseWheel:
+      return sizeof(regame::ClientRelativeMouseWheel);
+    case kGamepadAxis:
+      return sizeof(regame::ClientGamepadAxis);
+    case kGamepadButton:
+      return sizeof(regame::ClientGamepadButton);
+    case kJoystickAxis:
+      return sizeof(regame::ClientJoystickAxis);
+    case kJoystickBall:
+      return sizeof(regame::ClientJoystickBall);
+    case kJoystickButton:
+      return sizeof(regame::ClientJoystickButton);
+    case kJoystickHat:
+      return sizeof(regame::ClientJoystickHat);
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
 
 void GameControl::Initialize() noexcept {
   gamepad_replay_ = game_service_.GetGamepadReplay();
   keyboard_replay_ = game_service_.GetKeyboardReplay();
   mouse_replay_ = game_service_.GetMouseReplay();
+  cgvhid_.disable_keys_ = &game_service_.GetDisableKeys();
+  send_input_.disable_keys_ = &game_service_.GetDisableKeys();
 
   if (GamepadReplay::kCgvhid == gamepad_replay_) {
     // Not ready
@@ -271,3 +311,94 @@ void GameControl::Replay(const regame::ClientControl* cc,
       break;
   }
 }
+
+void GameControl::ReplayBatch(const regame::ClientControlBatch* ccb,
+                              std::uint32_t size) noexcept {
+  assert(nullptr != ccb);
+  if (size < sizeof(regame::ClientControlBatch)) {
+    DEBUG_PRINT(std::format("Size {} too small for batch\n", size));
+    return;
+  }
+
+  // Rebuild every compact event as a single-event struct, so all replay
+  // methods are shared with Replay().
+  union {
+    regame::ClientControl control;
+    regame::ClientKeyboard keyboard;
+    regame::ClientMouseButton mouse_button;
+    regame::ClientMouseMove mouse_move;
+    regame::ClientMouseWheel mouse_wheel;
+    regame::ClientRelativeMouseMove relative_mouse_move;
+    regame::ClientJoystickAxis joystick_axis;
+    regame::ClientJoystickBall joystick_ball;
+    regame::ClientJoystickButton joystick_button;
+    regame::ClientJoystickHat joystick_hat;
+  } event{};
+  event.control.head = ccb->control.head;
+
+  auto data = reinterpret_cast<const std::uint8_t*>(ccb + 1);
+  std::size_t remain = size - sizeof(regame::ClientControlBatch);
+  std::uint32_t timestamp = ntohl(ccb->control.timestamp);
+  for (std::uint8_t i = 0; i < ccb->count; ++i) {
+    if (remain < 1) {
+      DEBUG_PRINT(std::format("Batch truncated at {}\n", i));
+      return;
+    }
+    const auto type = static_cast<regame::ControlType>(*data);
+    const std::size_t control_size = ControlSize(type);
+    if (0 == control_size) {
+      DEBUG_PRINT(std::format("Unsupported type {} in batch\n", *data));
+      return;
+    }
+    ++data;
+    --remain;
+
+    std::uint32_t delta;
+    std::size_t used = regame::ReadVarint(data, remain, delta);
+    if (0 == used) {
+      DEBUG_PRINT(std::format("Batch truncated at {}\n", i));
+      return;
+    }
+    data += used;
+    remain -= used;
+    timestamp += delta;
+
+    event.control.type = type;
+    event.control.timestamp = htonl(timestamp);
+    if (regame::ControlType::kMouseMove == type ||
+        regame::ControlType::kRelativeMouseMove == type) {
+      std::uint32_t x;
+      std::uint32_t y;
+      std::size_t x_used = regame::ReadVarint(data, remain, x);
+      std::size_t y_used =
+          0 == x_used ? 0
+                      : regame::ReadVarint(data + x_used, remain - x_used, y);
+      if (0 == y_used) {
+        DEBUG_PRINT(std::format("Batch truncated at {}\n", i));
+        return;
+      }
+      data += x_used + y_used;
+      remain -= x_used + y_used;
+      if (regame::ControlType::kMouseMove == type) {
+        event.mouse_move.x = htons(static_cast<std::uint16_t>(x));
+        event.mouse_move.y = htons(static_cast<std::uint16_t>(y));
+      } else {
+        event.relative_mouse_move.x = static_cast<std::int16_t>(
+            htons(static_cast<std::uint16_t>(regame::ZigZagDecode(x))));
+        event.relative_mouse_move.y = static_cast<std::int16_t>(
+            htons(static_cast<std::uint16_t>(regame::ZigZagDecode(y))));
+      }
+    } else {
+      const std::size_t payload_size =
+          control_size - sizeof(regame::ClientControl);
+      if (remain < payload_size) {
+        DEBUG_PRINT(std::format("Batch truncated at {}\n", i));
+        return;
+      }
+      memcpy(&event.control + 1, data, payload_size);
+      data += payload_size;
+      remain -= payload_size;
+    }
+    Replay(&event.control, static_cast<std::uint32_t>(control_size));
+  }
+}
@@ -28,6 +28,8 @@ class GameService;
 
 class GameControl {
  public:
+  using DisableKeys = std::array<bool, 256>;
+
   GameControl(GameService& game_service) noexcept
       : game_service_(game_service) {}
   ~GameControl() {
@@ -39,25 +41,22 @@ class GameControl {
     }
   }
 
-  static void SetDisableKeys(
-      const std::vector<uint8_t>& disable_keys) noexcept {
-    for (auto& key : disable_keys_) {
-      key = false;
-    }
-    for (const auto& e : disable_keys) {
-      disable_keys_[e] = true;
-    }
-  }
-
-  static bool IsDisableKeys(std::uint8_t key) noexcept {
-    return disable_keys_[key];
-  }
-
   void Initialize() noexcept;
   void Replay(const regame::ClientControl* cc, std::uint32_t size) noexcept;
+  void ReplayBatch(const regame::ClientControlBatch* ccb,
+                   std::uint32_t size) noexcept;
 
  private:
-  struct Cgvhid {
+  // The keys of the GameService, which outlives its sessions.
+  struct KeyFilter {
+    bool IsDisableKeys(std::uint8_t key) const noexcept {
+      return nullptr != disable_keys_ && (*disable_keys_)[key];
+    }
+
+    const DisableKeys* disable_keys_ = nullptr;
+  };
+
+  struct Cgvhid : KeyFilter {
     void ReplayKeyboard(const regame::ClientKeyboard& k);
     void ReplayKeyboardVk(const regame::ClientKeyboard& k);
 
@@ -87,7 +86,7 @@ class GameControl {
     WPARAM button_state_{0};
   } message_;
 
-  struct SendInput {
+  struct SendInput : KeyFilter {
     void ReplayKeyboard(const regame::ClientKeyboard& k);
     void ReplayKeyboardVk(const regame::ClientKeyboard& k);
 
@@ -111,9 +110,6 @@ class GameControl {
   } vigem_;
 
  private:
-  static std::array<bool, 256> disable_keys_;
-  static POINT mouse_last_pos_;
-
   GameService& game_service_;
 
   GamepadReplay gamepad_replay_;
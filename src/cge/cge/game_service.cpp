@@ -38,16 +38,23 @@ inline void Fail(beast::error_code ec,
 constexpr size_t kMaxClientCount = 8;
 
 #pragma region "GameService"
-GameService::GameService(net::io_context& ioc,
+GameService::GameService(Engine& engine,
+                         net::io_context& ioc,
                          const tcp::endpoint& endpoint,
+                         const std::vector<uint8_t>& disable_keys,
                          GamepadReplay gamepad_replay,
                          KeyboardReplay keyboard_replay,
                          MouseReplay mouse_replay) noexcept
-    : ioc_(ioc),
+    : engine_(engine),
+      ioc_(ioc),
       acceptor_(ioc),
       gamepad_replay_(gamepad_replay),
       keyboard_replay_(keyboard_replay),
       mouse_replay_(mouse_replay) {
+  for (const auto& key : disable_keys) {
+    disable_keys_[key] = true;
+  }
+
   beast::error_code ec;
 
   acceptor_.open(endpoint.protocol(), ec);
@@ -76,8 +83,11 @@ GameService::GameService(net::io_context& ioc,
 }
 
 void GameService::Accept() {
-  acceptor_.async_accept(ioc_, beast::bind_front_handler(&GameService::OnAccept,
-                                                         shared_from_this()));
+  acceptor_.async_accept(
+      ioc_, BindHandlerMemory(
+                handler_memory_,
+                beast::bind_front_handler(&GameService::OnAccept,
+                                          shared_from_this())));
 }
 
 bool GameService::Join(std::shared_ptr<GameSession> session) noexcept {
@@ -108,7 +118,7 @@ bool GameService::AddAuthorized(std::shared_ptr<GameSession> session) noexcept {
   }
   if (inserted) {
     if (first) {
-      g_app.Engine().EncoderRun();
+      engine_.EncoderRun();
     }
   } else {
     session->Stop(true);
@@ -126,26 +136,27 @@ void GameService::Leave(std::shared_ptr<GameSession> session) noexcept {
     }
   }
   if (last_authorized) {
-    g_app.Engine().EncoderStop();
+    engine_.EncoderIdle();
   }
 }
 
+std::size_t GameService::GetAuthorizedCount() {
+  std::lock_guard<std::mutex> lock(session_mutex_);
+  return authorized_sessions_.size();
+}
+
 size_t GameService::Send(std::string buffer) {
+  // One buffer for all the sessions, back to the pool when the last one has
+  // sent it, or at once without any.
+  SharedPacket packet = engine_.GetPacketPool().Share(std::move(buffer));
   std::lock_guard<std::mutex> lock(session_mutex_);
-  size_t count = authorized_sessions_.size();
-  if (1 == count) {
-    // can move when only one
-    authorized_sessions_.begin()->get()->Write(std::move(buffer));
-  } else {
-    // must copy when > 1
-    for (const auto& session : authorized_sessions_) {
-      session->Write(buffer);
-    }
+  for (const auto& session : authorized_sessions_) {
+    session->Write(packet);
   }
-  return count;
+  return authorized_sessions_.size();
 }
 
-void GameService::OnAccept(beast::error_code ec, tcp::socket socket) {
+void GameService::OnAccept(beast::error_code ec, GameSession::Socket socket) {
   if (ec) {
     return Fail(ec, "Accept", socket.remote_endpoint());
   }
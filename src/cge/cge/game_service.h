@@ -20,10 +20,14 @@
 
 #include "game_session.h"
 
+class Engine;
+
 class GameService : public std::enable_shared_from_this<GameService> {
  public:
-  GameService(net::io_context& ioc,
+  GameService(Engine& engine,
+              net::io_context& ioc,
               const tcp::endpoint& endpoint,
+              const std::vector<uint8_t>& disable_keys,
               GamepadReplay gamepad_replay,
               KeyboardReplay keyboard_replay,
               MouseReplay mouse_replay) noexcept;
@@ -33,6 +37,11 @@ class GameService : public std::enable_shared_from_this<GameService> {
   size_t Send(std::string buffer);
   void CloseAllClients();
 
+  Engine& GetEngine() const noexcept { return engine_; }
+  std::size_t GetAuthorizedCount();
+  const GameControl::DisableKeys& GetDisableKeys() const noexcept {
+    return disable_keys_;
+  }
   GamepadReplay GetGamepadReplay() const noexcept { return gamepad_replay_; }
   KeyboardReplay GetKeyboardReplay() const noexcept { return keyboard_replay_; }
   MouseReplay GetMouseReplay() const noexcept { return mouse_replay_; }
@@ -40,7 +49,7 @@ class GameService : public std::enable_shared_from_this<GameService> {
  private:
   void Accept();
 
-  void OnAccept(beast::error_code ec, tcp::socket socket);
+  void OnAccept(beast::error_code ec, GameSession::Socket socket);
 
   bool Join(std::shared_ptr<GameSession> session) noexcept;
   void Leave(std::shared_ptr<GameSession> session) noexcept;
@@ -50,9 +59,12 @@ class GameService : public std::enable_shared_from_this<GameService> {
   friend class GameSession;
 
  private:
+  Engine& engine_;
   net::io_context& ioc_;
+  HandlerMemory handler_memory_;
   tcp::acceptor acceptor_;
 
+  GameControl::DisableKeys disable_keys_{};
   GamepadReplay gamepad_replay_;
   KeyboardReplay keyboard_replay_;
   MouseReplay mouse_replay_;
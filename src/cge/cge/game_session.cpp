@@ -18,6 +18,10 @@
 
 #include "game_session.h"
 
+#include <format>
+
+#include <boost/endian/conversion.hpp>
+
 #include "app.hpp"
 #include "game_service.h"
 #include "user_manager.h"
@@ -35,10 +39,83 @@ inline void Fail(beast::error_code ec,
               << ec.value() << ", " << ec.message() << '\n';
 }
 
+// A session with more packets than this waiting to be written drops a
+// temporal layer.
+constexpr std::size_t kMaxQueuedPackets = 8;
+
+constexpr std::chrono::seconds kRequestTimeout{30};
+
+// Clients before regame::kMinVideoHeadVersion expect a bare ServerPacketHead.
+void RemoveVideoExtension(std::string& buffer) {
+  if (buffer.size() <
+      sizeof(regame::PackageHead) + sizeof(regame::ServerVideoHead)) {
+    return;
+  }
+  auto package_head = reinterpret_cast<regame::PackageHead*>(buffer.data());
+  const std::size_t extension_size =
+      reinterpret_cast<const regame::ServerVideoHead*>(package_head + 1)
+          ->extension_size;
+  package_head->size =
+      htonl(static_cast<int>(ntohl(package_head->size) - extension_size));
+  buffer.erase(sizeof(regame::PackageHead) + sizeof(regame::ServerPacketHead),
+               extension_size);
+}
+
+// The stream header goes with the first packet of a session.
+SharedPacket Concatenate(PacketPool& packet_pool,
+                         std::string_view header,
+                         std::string_view buffer) {
+  std::string concatenated = packet_pool.Acquire(header.size() + buffer.size());
+  memcpy(concatenated.data(), header.data(), header.size());
+  memcpy(concatenated.data() + header.size(), buffer.data(), buffer.size());
+  return packet_pool.Share(std::move(concatenated));
+}
+
+// Microseconds on the performance counter, 0 for other packets and for the
+// stream header. Valid from regame::kMinVideoHeadVersion.
+std::uint64_t GetCaptureTimestamp(const std::string& buffer) {
+  if (buffer.size() <
+      sizeof(regame::PackageHead) + sizeof(regame::ServerVideoHead)) {
+    return 0;
+  }
+  auto video_head = reinterpret_cast<const regame::ServerVideoHead*>(
+      buffer.data() + sizeof(regame::PackageHead));
+  if (regame::ServerAction::kVideo != video_head->head.action) {
+    return 0;
+  }
+  return boost::endian::big_to_native(video_head->capture_timestamp);
+}
+
 }  // namespace
 
 #pragma region "GameSession"
+// Reads the HTTP request first: WebSocket upgrades are game sessions, and the
+// rest go to the AdminHandler.
 void GameSession::OnRun() {
+  beast::get_lowest_layer(ws_).expires_after(kRequestTimeout);
+  http::async_read(
+      ws_.next_layer(), read_buffer_, request_,
+      BindHandlerMemory(handler_memory_,
+                        beast::bind_front_handler(&GameSession::OnRequest,
+                                                  shared_from_this())));
+}
+
+void GameSession::OnRequest(beast::error_code ec, std::size_t) {
+  if (ec) {
+    return Fail(ec, "request", remote_endpoint_);
+  }
+
+  beast::get_lowest_layer(ws_).expires_never();
+  if (!websocket::is_upgrade(request_)) {
+    response_ = game_service_->GetEngine().GetAdminHandler().Handle(request_);
+    http::async_write(
+        ws_.next_layer(), response_,
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&GameSession::OnAdminWrite,
+                                                    shared_from_this())));
+    return;
+  }
+
   ws_.binary(true);
   ws_.set_option(
       websocket::stream_base::timeout::suggested(beast::role_type::server));
@@ -48,7 +125,17 @@ void GameSession::OnRun() {
       }));
 
   ws_.async_accept(
-      beast::bind_front_handler(&GameSession::OnAccept, shared_from_this()));
+      request_,
+      BindHandlerMemory(handler_memory_,
+                        beast::bind_front_handler(&GameSession::OnAccept,
+                                                  shared_from_this())));
+}
+
+void GameSession::OnAdminWrite(beast::error_code ec, std::size_t) {
+  if (ec) {
+    return Fail(ec, "admin write", remote_endpoint_);
+  }
+  ws_.next_layer().socket().shutdown(tcp::socket::shutdown_send, ec);
 }
 
 void GameSession::Stop(bool restart) {
@@ -61,7 +148,9 @@ void GameSession::Stop(bool restart) {
     if (restart) {
       ws_.async_close(
           websocket::close_reason(websocket::close_code::try_again_later),
-          beast::bind_front_handler(&GameSession::OnStop, shared_from_this()));
+          BindHandlerMemory(handler_memory_,
+                            beast::bind_front_handler(&GameSession::OnStop,
+                                                      shared_from_this())));
     } else {
       game_service_->Leave(shared_from_this());
       ws_.control_callback();
@@ -74,38 +163,67 @@ void GameSession::Stop(bool restart) {
   }
 }
 
-void GameSession::Write(std::string buffer) {
-  if (buffer.empty()) {
+void GameSession::Write(SharedPacket packet) {
+  if (!packet || packet.Get().empty()) {
     return;
   }
+  auto& engine = game_service_->GetEngine();
+  auto& packet_pool = engine.GetPacketPool();
   std::lock_guard<std::mutex> lock(queue_mutex_);
-  const auto server_data = reinterpret_cast<regame::ServerPacketHead*>(
-      buffer.data() + sizeof(regame::PackageHead));
+  const auto server_data = reinterpret_cast<const regame::ServerPacketHead*>(
+      packet.Get().data() + sizeof(regame::PackageHead));
+  const bool legacy = protocol_version_ < regame::kMinVideoHeadVersion;
   switch (server_data->action) {
     case regame::ServerAction::kAudio:
       if (!is_audio_header_sent_) {
         is_audio_header_sent_ = true;
-        buffer = g_app.Engine().GetAudioHeader() + buffer;
+        packet = Concatenate(packet_pool, engine.GetAudioHeader(),
+                             packet.Get());
       }
       break;
     case regame::ServerAction::kVideo:
-      if (!is_video_header_sent_) {
+      if (!AcceptsTemporalLayer(
+              reinterpret_cast<const regame::ServerVideoHead*>(server_data)
+                  ->temporal_id)) {
+        return;
+      }
+      if (legacy) {
+        // A copy of its own, the other sessions may want the extension.
+        std::string buffer = packet_pool.Acquire(packet.Get().size());
+        memcpy(buffer.data(), packet.Get().data(), buffer.size());
+        RemoveVideoExtension(buffer);
+        if (!is_video_header_sent_) {
+          is_video_header_sent_ = true;
+          std::string header = engine.GetVideoHeader();
+          RemoveVideoExtension(header);
+          packet = Concatenate(packet_pool, header, buffer);
+          packet_pool.Release(std::move(buffer));
+        } else {
+          packet = packet_pool.Share(std::move(buffer));
+        }
+      } else if (!is_video_header_sent_) {
         is_video_header_sent_ = true;
-        buffer = g_app.Engine().GetVideoHeader() + buffer;
+        packet = Concatenate(packet_pool, engine.GetVideoHeader(),
+                             packet.Get());
       }
       break;
     default:
       break;
   }
-  write_queue_.emplace(buffer);
+  if (write_queue_.full()) {
+    write_queue_.set_capacity(write_queue_.capacity() * 2);
+  }
+  write_queue_.push_back(std::move(packet));
 
   if (1 < write_queue_.size()) {
     return;
   }
 
   ws_.async_write(
-      net::buffer(write_queue_.front()),
-      beast::bind_front_handler(&GameSession::OnWrite, shared_from_this()));
+      net::buffer(write_queue_.front().Get()),
+      BindHandlerMemory(handler_memory_,
+                        beast::bind_front_handler(&GameSession::OnWrite,
+                                                  shared_from_this())));
 }
 
 void GameSession::OnAccept(beast::error_code ec) {
@@ -130,7 +248,36 @@ void GameSession::OnAccept(beast::error_code ec) {
   Read();
 }
 
+// Sessions falling behind drop the upper temporal layers, which no frame kept
+// references. Layers only come back at base layer frames, from where they
+// decode again.
+bool GameSession::AcceptsTemporalLayer(std::uint8_t temporal_id) noexcept {
+  if (protocol_version_ < regame::kMinTemporalIdVersion) {
+    return true;
+  }
+  top_temporal_id_ = std::max(top_temporal_id_, temporal_id);
+  if (0 != temporal_id) {
+    return temporal_id <= max_temporal_id_;
+  }
+
+  const std::uint8_t current = std::min(max_temporal_id_, top_temporal_id_);
+  if (kMaxQueuedPackets < write_queue_.size() && 0 < current) {
+    max_temporal_id_ = current - 1;
+    APP_DEBUG() << remote_endpoint_ << " drops temporal layers above "
+                << static_cast<int>(max_temporal_id_) << '\n';
+  } else if (write_queue_.empty() && current < top_temporal_id_) {
+    max_temporal_id_ = current + 1;
+  }
+  return true;
+}
+
 void GameSession::OnLogin(bool result) noexcept {
+  if (result && protocol_version_ < regame::kMinAv1Version &&
+      AV_CODEC_ID_AV1 == game_service_->GetEngine().GetVideoCodecID()) {
+    APP_ERROR() << remote_endpoint_ << " can not decode AV1, protocol version "
+                << static_cast<int>(protocol_version_) << '\n';
+    result = false;
+  }
   if (!result) {
     session_state_ = SessionState::kFailed;
     Stop(true);
@@ -146,6 +293,7 @@ void GameSession::OnLogin(bool result) noexcept {
     return;
   }
 
+  auto& engine = game_service_->GetEngine();
   std::string buffer;
   buffer.resize(sizeof(regame::PackageHead) +
                 sizeof(regame::ServerLoginResult));
@@ -153,16 +301,16 @@ void GameSession::OnLogin(bool result) noexcept {
   head->size = htonl(sizeof(regame::ServerLoginResult));
   auto& login_result = *reinterpret_cast<regame::ServerLoginResult*>(head + 1);
   login_result.head.action = regame::ServerAction::kLoginResult;
-  login_result.protocol_version = regame::kProtocolVersion;
+  login_result.protocol_version = protocol_version_;
   login_result.error_code = htonl(0);
-  login_result.audio_codec = htonl(g_app.Engine().GetAudioCodecID());
-  login_result.video_codec = htonl(g_app.Engine().GetVideoCodecID());
+  login_result.audio_codec = htonl(engine.GetAudioCodecID());
+  login_result.video_codec = htonl(engine.GetVideoCodecID());
   std::uint16_t work_modes = 0;
-  if (g_app.Engine().IsDesktopMode()) {
+  if (engine.IsDesktopMode()) {
     work_modes |= regame::WorkMode::kDesktop;
   }
   login_result.work_modes = static_cast<regame::WorkMode>(htons(work_modes));
-  Write(std::move(buffer));
+  Write(engine.GetPacketPool().Share(std::move(buffer)));
 
 #if USER_MANAGER
   APP_INFO() << "Authorized " << user_manager_->GetUsername() << " from "
@@ -170,7 +318,7 @@ void GameSession::OnLogin(bool result) noexcept {
 #endif
   game_control_.Initialize();
 
-  g_app.Engine().VideoProduceKeyframe();
+  engine.VideoProduceKeyframe();
 }
 
 void GameSession::OnKeepAlive(bool result) noexcept {
@@ -186,6 +334,8 @@ void GameSession::OnKeepAlive(bool result) noexcept {
 void GameSession::OnStop(beast::error_code ec) {
   game_service_->Leave(shared_from_this());
   APP_INFO() << "Async closed " << remote_endpoint_ << '\n';
+  DEBUG_PRINT(std::format("Handler memory fallbacks: {}\n",
+                          handler_memory_.GetFallbackCount()));
 }
 
 void GameSession::OnRead(beast::error_code ec, std::size_t bytes_transferred) {
@@ -215,17 +365,30 @@ void GameSession::OnWrite(beast::error_code ec, std::size_t bytes_transferred) {
     return Fail(ec, "write", remote_endpoint_);
   }
 #if _DEBUG
-  if (bytes_transferred != write_queue_.front().size()) {
+  if (bytes_transferred != write_queue_.front().Get().size()) {
     APP_TRACE() << "bytes_transferred: " << bytes_transferred
-                << ", size: " << write_queue_.front().size() << '\n';
+                << ", size: " << write_queue_.front().Get().size() << '\n';
   }
 #endif
+  auto& engine = game_service_->GetEngine();
   std::lock_guard<std::mutex> lock(queue_mutex_);
-  write_queue_.pop();
+  if (protocol_version_ >= regame::kMinVideoHeadVersion) {
+    const std::uint64_t capture_timestamp =
+        GetCaptureTimestamp(write_queue_.front().Get());
+    if (0 != capture_timestamp) {
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      engine.GetVideoLatency().write.Add(
+          g_app.TicksToMicroseconds(now.QuadPart) - capture_timestamp);
+    }
+  }
+  write_queue_.pop_front();
   if (!write_queue_.empty()) {
     ws_.async_write(
-        net::buffer(write_queue_.front()),
-        beast::bind_front_handler(&GameSession::OnWrite, shared_from_this()));
+        net::buffer(write_queue_.front().Get()),
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&GameSession::OnWrite,
+                                                    shared_from_this())));
   }
 }
 
@@ -268,12 +431,29 @@ bool GameSession::ServeClient() {
         if (SessionState::kAuthorized <= session_state_) {
           switch (action) {
             case regame::ClientAction::kPing:
+              if (protocol_version_ >= regame::kMinClockSyncVersion &&
+                  packet_size >= sizeof(regame::ClientPing)) {
+                Pong(*reinterpret_cast<const regame::ClientPing*>(
+                    client_packet));
+              }
               break;
-            case regame::ClientAction::kControl:
-              game_control_.Replay(
-                  reinterpret_cast<const regame::ClientControl*>(client_packet),
-                  packet_size);
+            case regame::ClientAction::kControl: {
+              if (packet_size < sizeof(regame::ClientControl)) {
+                DEBUG_PRINT(std::format("Size {} too small for control\n",
+                                        packet_size));
+                break;
+              }
+              auto cc =
+                  reinterpret_cast<const regame::ClientControl*>(client_packet);
+              if (regame::ControlType::kBatch == cc->type) {
+                game_control_.ReplayBatch(
+                    reinterpret_cast<const regame::ClientControlBatch*>(cc),
+                    packet_size);
+              } else {
+                game_control_.Replay(cc, packet_size);
+              }
               break;
+            }
           }
         } else if (SessionState::kNone == session_state_) {
           if (regame::ClientAction::kLogin == action) {
@@ -291,6 +471,25 @@ bool GameSession::ServeClient() {
   return true;
 }
 
+// Stamped on the clock of the video timestamps, so that the client can map
+// them to its own.
+void GameSession::Pong(const regame::ClientPing& ping) {
+  auto& packet_pool = game_service_->GetEngine().GetPacketPool();
+  std::string buffer = packet_pool.Acquire(sizeof(regame::PackageHead) +
+                                           sizeof(regame::ServerPong));
+  auto head = reinterpret_cast<regame::PackageHead*>(buffer.data());
+  head->size = htonl(sizeof(regame::ServerPong));
+  auto pong = reinterpret_cast<regame::ServerPong*>(head + 1);
+  pong->head.action = regame::ServerAction::kPong;
+  pong->reserved = {};
+  pong->client_timestamp = ping.client_timestamp;
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  pong->server_timestamp =
+      boost::endian::native_to_big(g_app.TicksToMicroseconds(now.QuadPart));
+  Write(packet_pool.Share(std::move(buffer)));
+}
+
 bool GameSession::ServeClientLogin(
     const regame::ClientPacketHead* client_packet,
     std::uint32_t packet_size) {
@@ -309,6 +508,8 @@ bool GameSession::ServeClientLogin(
     return false;
   }
 
+  protocol_version_ = std::min(cl->protocol_version, regame::kProtocolVersion);
+
   UserManager::Verification verification;
   verification.version = static_cast<std::int64_t>(cl->protocol_version);
   verification.username.assign(cl->username, sizeof(cl->username));
@@ -318,11 +519,17 @@ bool GameSession::ServeClientLogin(
   verification.type = static_cast<std::int64_t>(cl->verification_type);
   verification.data.assign(cl->verification_data, cl->verification_size);
 #if USER_MANAGER
-  user_manager_ =
-      std::make_shared<UserManager>(ioc_, std::move(weak_from_this()));
+  auto& engine = game_service_->GetEngine();
+  user_manager_ = std::make_shared<UserManager>(ioc_, engine,
+                                                std::move(weak_from_this()));
   if (user_manager_) {
-    user_manager_->Initialize();
-    user_manager_->Login(verification);
+    // Start streaming at once if the credential is known good, the user
+    // service can still revoke it.
+    const bool authorized = engine.GetLoginCache().Verify(verification);
+    user_manager_->Login(verification, authorized);
+    if (authorized) {
+      NotifyLoginResult(true);
+    }
   }
 #else
   // You should remove this backdoor.
@@ -18,15 +18,27 @@
 
 #include "net.hpp"
 
+#include <boost/circular_buffer.hpp>
+
+#include "admin_handler.h"
 #include "game_control.h"
+#include "handler_memory.hpp"
+#include "packet_pool.h"
 
 class GameService;
 class UserManager;
 
 class GameSession : public std::enable_shared_from_this<GameSession> {
  public:
+  static constexpr std::size_t kInitialQueueCapacity = 32;
+
+  // The executor of the io_context rather than any_io_executor, whose
+  // dispatch of completions allocates, see session_bench.
+  using Socket = net::basic_stream_socket<tcp, net::io_context::executor_type>;
+  using Stream = beast::basic_stream<tcp, net::io_context::executor_type>;
+
   explicit GameSession(net::io_context& ioc,
-                       tcp::socket&& socket,
+                       Socket&& socket,
                        std::shared_ptr<GameService>&& game_service) noexcept
       : ioc_(ioc),
         ws_(std::move(socket)),
@@ -37,30 +49,43 @@ class GameSession : public std::enable_shared_from_this<GameSession> {
   ~GameSession() = default;
 
   void Run() {
-    net::dispatch(ioc_, beast::bind_front_handler(&GameSession::OnRun,
-                                                  shared_from_this()));
+    net::dispatch(ioc_, BindHandlerMemory(
+                            handler_memory_,
+                            beast::bind_front_handler(&GameSession::OnRun,
+                                                      shared_from_this())));
   }
 
   void Stop(bool restart);
 
   void Read() {
-    ws_.async_read(read_buffer_, beast::bind_front_handler(&GameSession::OnRead,
-                                                           shared_from_this()));
+    ws_.async_read(read_buffer_,
+                   BindHandlerMemory(
+                       handler_memory_,
+                       beast::bind_front_handler(&GameSession::OnRead,
+                                                 shared_from_this())));
   }
 
-  void Write(std::string buffer);
+  void Write(SharedPacket packet);
 
   void NotifyLoginResult(bool result) {
-    net::dispatch(ioc_, beast::bind_front_handler(&GameSession::OnLogin,
-                                                  shared_from_this(), result));
+    net::dispatch(ioc_, BindHandlerMemory(
+                            handler_memory_,
+                            beast::bind_front_handler(&GameSession::OnLogin,
+                                                      shared_from_this(),
+                                                      result)));
   }
   void NotifyKeepAliveResult(bool result) {
-    net::dispatch(ioc_, beast::bind_front_handler(&GameSession::OnKeepAlive,
-                                                  shared_from_this(), result));
+    net::dispatch(ioc_, BindHandlerMemory(
+                            handler_memory_,
+                            beast::bind_front_handler(&GameSession::OnKeepAlive,
+                                                      shared_from_this(),
+                                                      result)));
   }
 
  private:
   void OnRun();
+  void OnRequest(beast::error_code ec, std::size_t bytes_transferred);
+  void OnAdminWrite(beast::error_code ec, std::size_t bytes_transferred);
   void OnAccept(beast::error_code ec);
   void OnLogin(bool result) noexcept;
   void OnKeepAlive(bool result) noexcept;
@@ -70,19 +95,29 @@ class GameSession : public std::enable_shared_from_this<GameSession> {
   bool ServeClient();
   bool ServeClientLogin(const regame::ClientPacketHead* client_packet,
                         std::uint32_t packet_size);
+  void Pong(const regame::ClientPing& ping);
+  // Called with queue_mutex_ held.
+  bool AcceptsTemporalLayer(std::uint8_t temporal_id) noexcept;
 
  private:
   net::io_context& ioc_;
+  HandlerMemory handler_memory_;
   std::shared_ptr<GameService> game_service_;
-  websocket::stream<beast::tcp_stream> ws_;
+  websocket::stream<Stream> ws_;
   net::ip::tcp::endpoint remote_endpoint_;
   beast::flat_buffer read_buffer_;
+  AdminHandler::Request request_;
+  AdminHandler::Response response_;
 
   std::mutex queue_mutex_;
-  std::queue<std::string> write_queue_;
+  // Grows only when the session falls far behind.
+  boost::circular_buffer<SharedPacket> write_queue_{kInitialQueueCapacity};
   bool is_audio_header_sent_ = false;
   bool is_video_header_sent_ = false;
   bool is_video_keyframe_sent_ = false;
+  std::uint8_t protocol_version_ = 0;
+  std::uint8_t top_temporal_id_ = 0;  // highest seen
+  std::uint8_t max_temporal_id_ = std::numeric_limits<std::uint8_t>::max();
 
   std::shared_ptr<UserManager> user_manager_;
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "net.hpp"
+
+// A few fixed slots reused by the async operations of one owner (session,
+// service, ...), so that steady-state I/O doesn't touch the heap. Falls back
+// to operator new when all slots are busy or the handler is too big.
+//
+// The owner must outlive every operation using it, which holds when the
+// handler keeps a shared_from_this().
+class HandlerMemory {
+ public:
+  static constexpr std::size_t kSlotCount = 8;
+  static constexpr std::size_t kSlotSize = 1024;
+
+  HandlerMemory() noexcept = default;
+  HandlerMemory(const HandlerMemory&) = delete;
+  HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+  void* Allocate(std::size_t size) {
+    if (size <= kSlotSize) {
+      for (auto& slot : slots_) {
+        if (!slot.in_use.test_and_set(std::memory_order_acquire)) {
+          return slot.storage;
+        }
+      }
+    }
+    fallback_count_.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size);
+  }
+
+  void Deallocate(void* pointer) noexcept {
+    for (auto& slot : slots_) {
+      if (pointer == slot.storage) {
+        slot.in_use.clear(std::memory_order_release);
+        return;
+      }
+    }
+    ::operator delete(pointer);
+  }
+
+  // Heap allocations made because no slot was available, should stay 0.
+  std::size_t GetFallbackCount() const noexcept {
+    return fallback_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    alignas(std::max_align_t) std::byte storage[kSlotSize];
+    std::atomic_flag in_use;
+  };
+  std::array<Slot, kSlotCount> slots_{};
+  std::atomic<std::size_t> fallback_count_{0};
+};
+
+template <typename T>
+class HandlerAllocator {
+ public:
+  using value_type = T;
+
+  explicit HandlerAllocator(HandlerMemory& memory) noexcept
+      : memory_(&memory) {}
+
+  template <typename U>
+  HandlerAllocator(const HandlerAllocator<U>& other) noexcept
+      : memory_(other.memory_) {}
+
+  T* allocate(std::size_t n) const {
+    return static_cast<T*>(memory_->Allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T* p, std::size_t /*n*/) const noexcept {
+    memory_->Deallocate(p);
+  }
+
+  template <typename U>
+  bool operator==(const HandlerAllocator<U>& other) const noexcept {
+    return memory_ == other.memory_;
+  }
+
+ private:
+  template <typename>
+  friend class HandlerAllocator;
+
+  HandlerMemory* memory_;
+};
+
+template <typename Handler>
+inline auto BindHandlerMemory(HandlerMemory& memory, Handler&& handler) {
+  return net::bind_allocator(HandlerAllocator<void>(memory),
+                             std::forward<Handler>(handler));
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "keep_alive_batcher.h"
+
+#include "app.hpp"
+#include "user_manager.h"
+
+namespace {
+
+inline void Fail(beast::error_code ec,
+                 std::string_view what,
+                 const tcp::endpoint& endpoint) {
+  APP_ERROR() << "KeepAliveBatcher: " << what << " " << endpoint << " error "
+              << ec.value() << ", " << ec.message() << '\n';
+}
+
+}  // namespace
+
+KeepAliveBatcher::KeepAliveBatcher(
+    net::io_context& ioc,
+    std::shared_ptr<UserServicePool> user_service_pool)
+    : strand_(net::make_strand(ioc)),
+      timer_(strand_),
+      user_service_pool_(std::move(user_service_pool)) {}
+
+void KeepAliveBatcher::Schedule(std::chrono::seconds delay,
+                                std::weak_ptr<UserManager> user_manager) {
+  net::post(strand_, [this, self = shared_from_this(), delay,
+                      user_manager = std::move(user_manager)]() mutable {
+    if (stopped_) {
+      return;
+    }
+    auto deadline = (Clock::now() + delay).time_since_epoch();
+    Clock::time_point due(deadline / kTickInterval * kTickInterval);
+    const bool earliest = schedule_.empty() || due < schedule_.begin()->first;
+    schedule_.emplace(due, std::move(user_manager));
+    if (earliest) {
+      Wait();
+    }
+  });
+}
+
+void KeepAliveBatcher::Stop() {
+  net::post(strand_, [this, self = shared_from_this()]() {
+    stopped_ = true;
+    schedule_.clear();
+    timer_.cancel();
+  });
+}
+
+void KeepAliveBatcher::Wait() {
+  timer_.expires_at(schedule_.begin()->first);
+  timer_.async_wait(
+      beast::bind_front_handler(&KeepAliveBatcher::OnTick, shared_from_this()));
+}
+
+void KeepAliveBatcher::OnTick(beast::error_code ec) {
+  if (ec == net::error::operation_aborted || stopped_) {
+    return;
+  }
+
+  std::vector<std::shared_ptr<UserManager>> due;
+  auto end = schedule_.upper_bound(Clock::now());
+  for (auto it = schedule_.begin(); it != end; ++it) {
+    if (auto user_manager = it->second.lock(); user_manager) {
+      due.emplace_back(std::move(user_manager));
+      if (kMaxBatchSize == due.size()) {
+        Send(std::move(due));
+        due.clear();
+      }
+    }
+  }
+  schedule_.erase(schedule_.begin(), end);
+  if (!due.empty()) {
+    Send(std::move(due));
+  }
+
+  if (!schedule_.empty()) {
+    Wait();
+  }
+}
+
+void KeepAliveBatcher::Send(
+    std::vector<std::shared_ptr<UserManager>> user_managers) {
+  if (!batch_supported_.load(std::memory_order_relaxed) &&
+      1 < user_managers.size()) {
+    for (auto& user_manager : user_managers) {
+      Send({std::move(user_manager)});
+    }
+    return;
+  }
+
+  // Calls are identified by their index in the batch.
+  json::array batch;
+  batch.reserve(user_managers.size());
+  std::erase_if(user_managers, [&batch](const auto& user_manager) {
+    auto request = user_manager->MakeKeepAliveRequest(
+        static_cast<std::int64_t>(batch.size()));
+    if (request.empty()) {
+      // Logged out meanwhile.
+      return true;
+    }
+    batch.emplace_back(std::move(request));
+    return false;
+  });
+  if (batch.empty()) {
+    return;
+  }
+
+  std::string body = 1 == batch.size() ? json::serialize(batch.front())
+                                       : json::serialize(batch);
+  user_service_pool_->Invoke(
+      std::move(body), true,
+      beast::bind_front_handler(&KeepAliveBatcher::OnResponse,
+                                shared_from_this(), std::move(user_managers)));
+}
+
+void KeepAliveBatcher::OnResponse(
+    std::vector<std::shared_ptr<UserManager>> user_managers,
+    beast::error_code ec,
+    UserServicePool::Response response) {
+  std::vector<const json::value*> results(user_managers.size(), nullptr);
+  json::value jv;
+  BOOST_SCOPE_EXIT_ALL(&user_managers, &results) {
+    for (std::size_t i = 0; i < user_managers.size(); ++i) {
+      user_managers[i]->OnKeepAliveResult(results[i]);
+    }
+  };
+
+  const auto& endpoint = user_service_pool_->GetEndpoint();
+  if (ec) {
+    return Fail(ec, "keepalive", endpoint);
+  }
+  if (response.result() != http::status::ok) {
+    return Fail(ec, "http", endpoint);
+  }
+  json::error_code json_ec;
+  jv = json::parse(response.body(), json_ec);
+  if (json_ec) {
+    return Fail(json_ec, "json", endpoint);
+  }
+
+  if (1 == user_managers.size()) {
+    results.front() = &jv;
+    return;
+  }
+  auto batch = jv.if_array();
+  if (nullptr == batch) {
+    APP_WARNING() << "KeepAliveBatcher: batch not supported by " << endpoint
+                  << '\n';
+    batch_supported_.store(false, std::memory_order_relaxed);
+    return;
+  }
+  for (const auto& item : *batch) {
+    if (auto jo = item.if_object(); nullptr != jo) {
+      if (auto id_jv = jo->if_contains("id"); nullptr != id_jv) {
+        if (auto id = id_jv->if_int64();
+            nullptr != id && 0 <= *id &&
+            static_cast<std::size_t>(*id) < results.size()) {
+          results[*id] = &item;
+        }
+      }
+    }
+  }
+}
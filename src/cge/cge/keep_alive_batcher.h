@@ -0,0 +1,68 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <map>
+
+#include "net.hpp"
+
+#include "user_service_pool.h"
+
+class UserManager;
+
+// Collects the keepalive of all sessions of an Engine and sends the ones due
+// in the same tick as one JSON-RPC 2.0 batch.
+//
+// Deadlines are moved back to the tick grid, so a session never keeps alive
+// later than asked, at most kTickInterval earlier. If the user service
+// answers a batch with anything but an array, batching is turned off and
+// every call is sent alone from then on.
+class KeepAliveBatcher : public std::enable_shared_from_this<KeepAliveBatcher> {
+ public:
+  static constexpr std::chrono::seconds kTickInterval{5};
+  static constexpr std::size_t kMaxBatchSize = 256;
+
+  KeepAliveBatcher(net::io_context& ioc,
+                   std::shared_ptr<UserServicePool> user_service_pool);
+  ~KeepAliveBatcher() = default;
+
+  // Thread-safe. The result goes to UserManager::OnKeepAliveResult().
+  void Schedule(std::chrono::seconds delay,
+                std::weak_ptr<UserManager> user_manager);
+  void Stop();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void Wait();
+  void OnTick(beast::error_code ec);
+  void Send(std::vector<std::shared_ptr<UserManager>> user_managers);
+  void OnResponse(std::vector<std::shared_ptr<UserManager>> user_managers,
+                  beast::error_code ec,
+                  UserServicePool::Response response);
+
+ private:
+  net::strand<net::io_context::executor_type> strand_;
+  net::steady_timer timer_;
+  std::shared_ptr<UserServicePool> user_service_pool_;
+
+  bool stopped_{false};
+  // Written from the response handler, which runs on the pool's strand.
+  std::atomic<bool> batch_supported_{true};
+  std::multimap<Clock::time_point, std::weak_ptr<UserManager>> schedule_;
+};
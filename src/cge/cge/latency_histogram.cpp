@@ -0,0 +1,106 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "pch.h"
+
+#include <bit>
+#include <format>
+
+#include "latency_histogram.h"
+
+#include "app.hpp"
+
+void LatencyHistogram::Add(std::uint64_t microseconds) noexcept {
+  const std::size_t bucket =
+      std::min<std::size_t>(std::bit_width(microseconds), kBuckets - 1);
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Reset() noexcept {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+std::array<std::uint64_t, LatencyHistogram::kBuckets>
+LatencyHistogram::GetCounts() const noexcept {
+  std::array<std::uint64_t, kBuckets> counts;
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  return counts;
+}
+
+std::string LatencyHistogram::Format() const {
+  const auto counts = GetCounts();
+  std::uint64_t frames = 0;
+  for (auto count : counts) {
+    frames += count;
+  }
+  if (0 == frames) {
+    return {};
+  }
+
+  auto bound = [](std::size_t bucket) {
+    return kBuckets - 1 == bucket
+               ? std::format(">= {}us", std::uint64_t{1} << (bucket - 1))
+               : std::format("< {}us", std::uint64_t{1} << bucket);
+  };
+  // The bucket reaching percent of the frames.
+  auto percentile = [&](std::uint64_t percent) {
+    std::uint64_t sum = 0;
+    std::size_t i = 0;
+    for (; i < kBuckets - 1; ++i) {
+      sum += counts[i];
+      if (frames * percent <= sum * 100) {
+        break;
+      }
+    }
+    return bound(i);
+  };
+  std::string text = std::format("frames {}, p50 {}, p99 {}", frames,
+                                 percentile(50), percentile(99));
+  for (std::size_t i = 0; i < kBuckets; ++i) {
+    if (0 != counts[i]) {
+      text += std::format(", {}: {}", bound(i), counts[i]);
+    }
+  }
+  return text;
+}
+
+void VideoLatency::Report() const {
+  auto report = [](const char* point, const LatencyHistogram& histogram) {
+    std::string text = histogram.Format();
+    if (!text.empty()) {
+      APP_INFO() << "Video latency since capture to " << point << ": " << text
+                 << ".\n";
+    }
+  };
+  report("convert start", convert_start);
+  report("convert end", convert_end);
+  report("encode end", encode_end);
+  report("enqueue", enqueue);
+  report("write", write);
+}
+
+void VideoLatency::Reset() noexcept {
+  convert_start.Reset();
+  convert_end.Reset();
+  encode_end.Reset();
+  enqueue.Reset();
+  write.Reset();
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+
+// Latencies in buckets of powers of two microseconds, bucket i counting
+// [2^(i-1), 2^i) and the last one everything longer.
+class LatencyHistogram {
+ public:
+  static constexpr std::size_t kBuckets = 24;  // up to about 4s
+
+  LatencyHistogram() noexcept = default;
+  ~LatencyHistogram() = default;
+
+  // Thread-safe.
+  void Add(std::uint64_t microseconds) noexcept;
+  void Reset() noexcept;
+
+  std::array<std::uint64_t, kBuckets> GetCounts() const noexcept;
+
+  // "frames 120, p50 < 2048us, p99 < 8192us, < 1024us: 40, ..." without the
+  // empty buckets, empty without any latency.
+  std::string Format() const;
+
+ private:
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+};
+
+// Latencies of the video frames since they were captured, by cgh on the
+// performance counter, at each point they pass in cge.
+struct VideoLatency {
+  LatencyHistogram convert_start;
+  LatencyHistogram convert_end;
+  LatencyHistogram encode_end;
+  LatencyHistogram enqueue;  // in the write queues of the sessions
+  LatencyHistogram write;    // written to a socket, for each session
+
+  void Report() const;
+  void Reset() noexcept;
+};
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "login_cache.h"
+
+#include "ffmpeg.h"
+#include "regame/protocol.h"
+
+namespace {
+
+constexpr int kSha256Bits = 256;
+constexpr std::size_t kSha256Size = 32;
+
+}  // namespace
+
+bool LoginCache::Verify(const UserManager::Verification& verification) {
+  if (static_cast<std::int64_t>(regame::VerificationType::Token) ==
+      verification.type) {
+    return VerifyToken(verification);
+  }
+  if (static_cast<std::int64_t>(regame::VerificationType::SM3) !=
+      verification.type) {
+    return false;
+  }
+
+  auto digest = Digest(verification);
+  if (digest.empty()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(digest);
+  if (index_.end() == it) {
+    return false;
+  }
+  if (kTimeToLive < Clock::now() - it->second->second) {
+    entries_.erase(it->second);
+    index_.erase(it);
+    return false;
+  }
+  return true;
+}
+
+void LoginCache::Add(const UserManager::Verification& verification) {
+  // Tokens carry their own expiry, and codes are good for one login only, so
+  // that a captured one must not be replayed.
+  if (static_cast<std::int64_t>(regame::VerificationType::SM3) !=
+      verification.type) {
+    return;
+  }
+
+  auto digest = Digest(verification);
+  if (digest.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (auto it = index_.find(digest); index_.end() != it) {
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  entries_.emplace_front(digest, Clock::now());
+  index_.emplace(std::move(digest), entries_.begin());
+  if (kMaxEntries < entries_.size()) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void LoginCache::Remove(const UserManager::Verification& verification) {
+  auto digest = Digest(verification);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (auto it = index_.find(digest); index_.end() != it) {
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+}
+
+bool LoginCache::VerifyToken(
+    const UserManager::Verification& verification) const {
+  if (token_key_.empty() ||
+      verification.data.size() != sizeof(regame::LoginToken)) {
+    return false;
+  }
+
+  regame::LoginToken token;
+  std::memcpy(&token, verification.data.data(), sizeof(token));
+  const auto now = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+  if (static_cast<std::int64_t>(ntohl(token.expires)) <= now.count()) {
+    return false;
+  }
+
+  std::string message = verification.username;
+  message.append(reinterpret_cast<const char*>(&token.expires),
+                 sizeof(token.expires));
+
+  std::uint8_t mac[kSha256Size];
+  auto hmac = av_hmac_alloc(AV_HMAC_SHA256);
+  if (nullptr == hmac) {
+    return false;
+  }
+  int mac_size = av_hmac_calc(
+      hmac, reinterpret_cast<const std::uint8_t*>(message.data()),
+      static_cast<unsigned int>(message.size()),
+      reinterpret_cast<const std::uint8_t*>(token_key_.data()),
+      static_cast<unsigned int>(token_key_.size()), mac, sizeof(mac));
+  av_hmac_free(hmac);
+  if (mac_size < static_cast<int>(regame::kLoginTokenMacSize)) {
+    return false;
+  }
+
+  // Constant time.
+  std::uint8_t difference = 0;
+  for (std::size_t i = 0; i < regame::kLoginTokenMacSize; ++i) {
+    difference |= mac[i] ^ token.mac[i];
+  }
+  return 0 == difference;
+}
+
+// Empty on failure.
+std::string LoginCache::Digest(const UserManager::Verification& verification) {
+  auto sha = av_sha_alloc();
+  if (nullptr == sha) {
+    return {};
+  }
+  std::string digest(kSha256Size, '\0');
+  av_sha_init(sha, kSha256Bits);
+  for (const auto* field : {&verification.username, &verification.data}) {
+    // Length prefixed, so that fields can't run into each other.
+    const auto size = static_cast<std::uint32_t>(field->size());
+    av_sha_update(sha, reinterpret_cast<const std::uint8_t*>(&size),
+                  sizeof(size));
+    av_sha_update(sha, reinterpret_cast<const std::uint8_t*>(field->data()),
+                  field->size());
+  }
+  const auto type = static_cast<std::uint8_t>(verification.type);
+  av_sha_update(sha, &type, sizeof(type));
+  av_sha_final(sha, reinterpret_cast<std::uint8_t*>(digest.data()));
+  av_free(sha);
+  return digest;
+}
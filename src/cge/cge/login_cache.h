@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include "user_manager.h"
+
+// Local login verification, so that an authorized session can start
+// streaming before the user service answers. The user service is still
+// asked, and revokes the session if it disagrees.
+//
+// Two kinds of credentials pass:
+// * a regame::LoginToken signed with the key shared with the user service and
+//   not expired yet;
+// * any SM3 credential the user service accepted within kTimeToLive, the
+//   most recent kMaxEntries are kept. Only their SHA-256 digests are stored.
+//   One-time codes are never cached.
+class LoginCache {
+ public:
+  static constexpr std::size_t kMaxEntries = 1024;
+  static constexpr std::chrono::minutes kTimeToLive{10};
+
+  LoginCache() noexcept = default;
+  ~LoginCache() = default;
+
+  // Empty key disables tokens.
+  void SetTokenKey(std::string token_key) noexcept {
+    token_key_ = std::move(token_key);
+  }
+
+  bool Verify(const UserManager::Verification& verification);
+  void Add(const UserManager::Verification& verification);
+  void Remove(const UserManager::Verification& verification);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  bool VerifyToken(const UserManager::Verification& verification) const;
+  static std::string Digest(const UserManager::Verification& verification);
+
+ private:
+  std::string token_key_;
+
+  std::mutex mutex_;
+  // Most recent first.
+  std::list<std::pair<std::string, Clock::time_point>> entries_;
+  std::unordered_map<std::string, decltype(entries_)::iterator> index_;
+};
@@ -23,6 +23,7 @@ std::wstring ObjectNamer::Get(std::wstring_view name) const noexcept {
   if (is_global_) {
     result.assign(L"Global\\");
   }
+  result.append(prefix_);
   result.append(name);
   return result;
 }
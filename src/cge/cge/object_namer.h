@@ -26,8 +26,16 @@ class ObjectNamer {
     return *this;
   }
 
+  // Distinguishes the objects of engine instances sharing one process.
+  ObjectNamer& SetPrefix(std::wstring prefix) noexcept {
+    prefix_ = std::move(prefix);
+    return *this;
+  }
+
   std::wstring Get(std::wstring_view name) const noexcept;
+  const std::wstring& GetPrefix() const noexcept { return prefix_; }
 
  private:
   bool is_global_{false};
+  std::wstring prefix_;
 };
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "openh264_encoder.h"
+
+#include "app.hpp"
+
+namespace {
+
+// OpenH264 budgets bits by frame rate, the frames are timed by timestamps.
+constexpr float kNominalFrameRate = 60.0f;
+
+}  // namespace
+
+int OpenH264Encoder::Open(const AVCodecContext* context,
+                          int temporal_layers,
+                          int threads,
+                          int slices,
+                          std::uint32_t qp) noexcept {
+  assert(nullptr != context);
+  Close();
+
+  if (AV_PIX_FMT_YUV420P != context->pix_fmt) {
+    APP_ERROR() << "OpenH264 encodes YUV420P only.\n";
+    return -1;
+  }
+  module_ = LoadLibraryW(kLibraryName);
+  if (nullptr == module_) {
+    APP_ERROR() << "Load openh264.dll failed with " << GetLastError()
+                << ".\n";
+    return -1;
+  }
+  auto create_encoder = reinterpret_cast<decltype(&WelsCreateSVCEncoder)>(
+      GetProcAddress(module_, "WelsCreateSVCEncoder"));
+  destroy_encoder_ = reinterpret_cast<decltype(&WelsDestroySVCEncoder)>(
+      GetProcAddress(module_, "WelsDestroySVCEncoder"));
+  if (nullptr == create_encoder || nullptr == destroy_encoder_ ||
+      0 != create_encoder(&encoder_) || nullptr == encoder_) {
+    APP_ERROR() << "Could not create OpenH264 encoder.\n";
+    encoder_ = nullptr;
+    Close();
+    return -1;
+  }
+
+  SEncParamExt param;
+  encoder_->GetDefaultParams(&param);
+  param.iUsageType = CAMERA_VIDEO_REAL_TIME;
+  param.iPicWidth = context->width;
+  param.iPicHeight = context->height;
+  param.fMaxFrameRate = kNominalFrameRate;
+  param.iTargetBitrate = static_cast<int>(context->bit_rate);
+  // Constant QP, like CRF for libx264.
+  param.iRCMode = RC_OFF_MODE;
+  param.bEnableFrameSkip = false;
+  param.uiIntraPeriod = static_cast<unsigned int>(context->gop_size);
+  // Keyframes are requested, not inserted on scene changes.
+  param.bEnableSceneChangeDetect = false;
+  param.bEnableDenoise = false;
+  param.eSpsPpsIdStrategy = CONSTANT_ID;
+  param.iEntropyCodingModeFlag = 0;
+  param.iMultipleThreadIdc = static_cast<unsigned short>(threads);
+  param.iTemporalLayerNum = temporal_layers;
+  param.iSpatialLayerNum = 1;
+
+  SSpatialLayerConfig& layer = param.sSpatialLayers[0];
+  layer.uiProfileIdc = PRO_BASELINE;
+  layer.iVideoWidth = param.iPicWidth;
+  layer.iVideoHeight = param.iPicHeight;
+  layer.fFrameRate = param.fMaxFrameRate;
+  layer.iSpatialBitrate = param.iTargetBitrate;
+  layer.iMaxSpatialBitrate = UNSPECIFIED_BIT_RATE;
+  layer.iDLayerQp = static_cast<int>(qp);
+  if (AVCOL_RANGE_JPEG == context->color_range) {
+    layer.bVideoSignalTypePresent = true;
+    layer.bFullRange = true;
+  }
+  if (0 != slices) {
+    layer.sSliceArgument.uiSliceMode = SM_FIXEDSLCNUM_SLICE;
+    layer.sSliceArgument.uiSliceNum = static_cast<unsigned int>(slices);
+  }
+
+  int error_code = encoder_->InitializeExt(&param);
+  if (cmResultSuccess != error_code) {
+    APP_ERROR() << "ISVCEncoder::InitializeExt() failed with " << error_code
+                << ".\n";
+    Close();
+    return -1;
+  }
+  int format = videoFormatI420;
+  encoder_->SetOption(ENCODER_OPTION_DATAFORMAT, &format);
+  time_base_ = context->time_base;
+  APP_INFO() << "OpenH264 encodes " << temporal_layers
+             << " temporal layers.\n";
+  return 0;
+}
+
+void OpenH264Encoder::Close() noexcept {
+  if (nullptr != encoder_) {
+    encoder_->Uninitialize();
+    destroy_encoder_(encoder_);
+    encoder_ = nullptr;
+  }
+  destroy_encoder_ = nullptr;
+  if (nullptr != module_) {
+    FreeLibrary(module_);
+    module_ = nullptr;
+  }
+}
+
+int OpenH264Encoder::Encode(const AVFrame* frame,
+                            bool keyframe,
+                            Packet& packet) noexcept {
+  assert(IsOpen());
+  assert(nullptr != frame);
+
+  packet = {};
+  if (keyframe) {
+    encoder_->ForceIntraFrame(true);
+  }
+
+  SSourcePicture picture{};
+  picture.iColorFormat = videoFormatI420;
+  picture.iPicWidth = frame->width;
+  picture.iPicHeight = frame->height;
+  for (int i = 0; i < 3; ++i) {
+    picture.iStride[i] = frame->linesize[i];
+    picture.pData[i] = frame->data[i];
+  }
+  picture.uiTimeStamp = av_rescale_q(frame->pts, time_base_, {1, 1000});
+
+  SFrameBSInfo info{};
+  int error_code = encoder_->EncodeFrame(&picture, &info);
+  if (cmResultSuccess != error_code) {
+    ATLTRACE2(atlTraceException, 0, "%s: !EncodeFrame(), #%d.\n", __func__,
+              error_code);
+    return -1;
+  }
+  if (videoFrameTypeSkip == info.eFrameType ||
+      videoFrameTypeInvalid == info.eFrameType) {
+    return 0;
+  }
+
+  // The parameter sets of an IDR frame come in a layer of their own.
+  buffer_.clear();
+  for (int i = 0; i < info.iLayerNum; ++i) {
+    const SLayerBSInfo& layer = info.sLayerInfo[i];
+    std::size_t size = 0;
+    for (int n = 0; n < layer.iNalCount; ++n) {
+      size += layer.pNalLengthInByte[n];
+    }
+    buffer_.insert(buffer_.end(), layer.pBsBuf, layer.pBsBuf + size);
+    if (VIDEO_CODING_LAYER == layer.uiLayerType) {
+      packet.temporal_id = layer.uiTemporalId;
+    }
+  }
+  packet.data = buffer_;
+  packet.is_keyframe = videoFrameTypeIDR == info.eFrameType;
+  return 0;
+}
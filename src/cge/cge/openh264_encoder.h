@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "ffmpeg.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4819)
+#include <wels/codec_api.h>
+#pragma warning(pop)
+
+// Encodes H.264 with OpenH264 in temporal layers: frames of a layer only
+// reference frames of lower layers, so that the upper layers can be dropped
+// for a session without breaking decoding. FFmpeg's libopenh264 does not
+// configure layers.
+//
+// The library is loaded at run time from kLibraryName, the binary Cisco
+// distributes, renamed.
+class OpenH264Encoder {
+ public:
+  static constexpr wchar_t kLibraryName[] = L"openh264.dll";
+  static constexpr int kMaxTemporalLayers = MAX_TEMPORAL_LAYER_NUM;
+
+  // One encoded frame, data is valid until the next Encode().
+  struct Packet {
+    std::span<std::uint8_t> data;  // Annex B, empty if the frame was skipped
+    std::uint8_t temporal_id = 0;
+    bool is_keyframe = false;
+  };
+
+  OpenH264Encoder() noexcept = default;
+  ~OpenH264Encoder() noexcept { Close(); }
+
+  // Takes the size, pixel format and gop from context, which is not opened.
+  int Open(const AVCodecContext* context,
+           int temporal_layers,
+           int threads,
+           int slices,
+           std::uint32_t qp) noexcept;
+  void Close() noexcept;
+  bool IsOpen() const noexcept { return nullptr != encoder_; }
+
+  // frame is YUV420P in the time base of context.
+  int Encode(const AVFrame* frame, bool keyframe, Packet& packet) noexcept;
+
+ private:
+  HMODULE module_ = nullptr;
+  ISVCEncoder* encoder_ = nullptr;
+  decltype(&WelsDestroySVCEncoder) destroy_encoder_ = nullptr;
+  AVRational time_base_{};
+  std::vector<std::uint8_t> buffer_;
+};
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "packet_pool.h"
+
+#include <bit>
+
+#pragma region "SharedPacket"
+SharedPacket::SharedPacket(const SharedPacket& other) noexcept
+    : block_(other.block_) {
+  if (nullptr != block_) {
+    block_->references.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void SharedPacket::Reset() noexcept {
+  if (nullptr != block_ &&
+      1 == block_->references.fetch_sub(1, std::memory_order_acq_rel)) {
+    block_->pool->Recycle(block_);
+  }
+  block_ = nullptr;
+}
+#pragma endregion
+
+#pragma region "PacketPool"
+// Reserved, so that releasing never allocates.
+PacketPool::PacketPool() {
+  buffers_.reserve(kMaxBuffers);
+  blocks_.reserve(kMaxBuffers);
+}
+
+std::string PacketPool::Acquire(std::size_t size) {
+  std::string buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!buffers_.empty()) {
+      // The smallest buffer which fits, or else the largest, so that the
+      // buffers grown by keyframes are kept for the next keyframes.
+      auto found = buffers_.begin();
+      for (auto it = buffers_.begin(); it != buffers_.end(); ++it) {
+        const bool fits = size <= it->capacity();
+        const bool found_fits = size <= found->capacity();
+        if (fits ? !found_fits || it->capacity() < found->capacity()
+                 : !found_fits && found->capacity() < it->capacity()) {
+          found = it;
+        }
+      }
+      buffer = std::move(*found);
+      buffers_.erase(found);
+    }
+  }
+  // Grown to a power of two, so that the capacities fall into a few sizes
+  // and the buffers stop growing soon.
+  if (buffer.capacity() < size) {
+    const std::size_t capacity = std::bit_ceil(size);
+    buffer.reserve(capacity < kMaxBufferCapacity ? capacity : size);
+  }
+  buffer.resize(size);
+  return buffer;
+}
+
+void PacketPool::Release(std::string buffer) noexcept {
+  if (kMaxBufferCapacity < buffer.capacity()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffers_.size() < kMaxBuffers) {
+    buffers_.emplace_back(std::move(buffer));
+  }
+}
+
+SharedPacket PacketPool::Share(std::string buffer) {
+  std::unique_ptr<SharedPacket::Block> block;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!blocks_.empty()) {
+      block = std::move(blocks_.back());
+      blocks_.pop_back();
+    }
+  }
+  if (!block) {
+    block = std::make_unique<SharedPacket::Block>();
+    block->pool = this;
+  }
+  block->buffer = std::move(buffer);
+  block->references.store(1, std::memory_order_relaxed);
+  return SharedPacket(block.release());
+}
+
+void PacketPool::Recycle(SharedPacket::Block* block) noexcept {
+  std::unique_ptr<SharedPacket::Block> owner(block);
+  Release(std::move(block->buffer));
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (blocks_.size() < kMaxBuffers) {
+    blocks_.emplace_back(std::move(owner));
+  }
+}
+#pragma endregion
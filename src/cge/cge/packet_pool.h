@@ -0,0 +1,86 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+class PacketPool;
+
+// A packet broadcast to several sessions without copying it. The buffer
+// goes back to its pool with the last reference.
+class SharedPacket {
+ public:
+  SharedPacket() noexcept = default;
+  SharedPacket(const SharedPacket& other) noexcept;
+  SharedPacket(SharedPacket&& other) noexcept
+      : block_(std::exchange(other.block_, nullptr)) {}
+  SharedPacket& operator=(SharedPacket other) noexcept {
+    std::swap(block_, other.block_);
+    return *this;
+  }
+  ~SharedPacket() { Reset(); }
+
+  explicit operator bool() const noexcept { return nullptr != block_; }
+  const std::string& Get() const noexcept { return block_->buffer; }
+  void Reset() noexcept;
+
+ private:
+  friend class PacketPool;
+
+  struct Block {
+    PacketPool* pool;
+    std::string buffer;
+    std::atomic<std::size_t> references;
+  };
+
+  explicit SharedPacket(Block* block) noexcept : block_(block) {}
+
+ private:
+  Block* block_ = nullptr;
+};
+
+// Buffers of the packets sent to sessions. A video packet is written into
+// the buffer once, right after the room reserved for its heads, and the
+// buffer comes back here when the session has sent it, so that the steady
+// state of streaming allocates nothing.
+class PacketPool {
+ public:
+  static constexpr std::size_t kMaxBuffers = 32;
+  // Keeps the rare huge keyframe from pinning memory.
+  static constexpr std::size_t kMaxBufferCapacity = 0x200000;  // 2MB
+
+  PacketPool();
+  ~PacketPool() = default;
+
+  // Thread-safe. The content is undefined.
+  std::string Acquire(std::size_t size);
+  void Release(std::string buffer) noexcept;
+
+  // Thread-safe. The buffer is released when the packet is no longer used.
+  SharedPacket Share(std::string buffer);
+
+ private:
+  friend class SharedPacket;
+
+  void Recycle(SharedPacket::Block* block) noexcept;
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::string> buffers_;
+  std::vector<std::unique_ptr<SharedPacket::Block>> blocks_;
+};
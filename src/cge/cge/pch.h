@@ -30,11 +30,15 @@
 // #define BOOST_URL_NO_SOURCE_LOCATION
 
 // C
+// Windows only, so that the portable sources also build in the tools for
+// Linux, such as packet_pool.cpp in session_bench.
+#ifdef _WIN32
 #include <SDKDDKVer.h>
 #ifdef _WIN32_WINNT
 #undef _WIN32_WINNT
 #endif
 #define _WIN32_WINNT _WIN32_WINNT_WIN7
+#endif
 
 // STL
 #include <array>
@@ -49,8 +53,10 @@
 #include <thread>
 
 // ATL
+#ifdef _WIN32
 #include <atlbase.h>
 #include <atlfile.h>
+#endif
 
 // Boost
 #include <boost/algorithm/string.hpp>
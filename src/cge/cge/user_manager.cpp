@@ -18,15 +18,15 @@
 
 #include "user_manager.h"
 
+#include <optional>
+
 #include "app.hpp"
 
 using namespace std::literals::chrono_literals;
-using namespace std::literals::string_view_literals;
 
 constexpr std::size_t kMaxRetryTimes = 3;
 constexpr auto kRetryInterval = 7s;
 
-constexpr auto kContentType{"application/json; charset=utf-8"sv};
 constexpr boost::json::string_view kProtocol{"jsonrpc"};
 constexpr boost::json::string_view kProtocolVersion{"2.0"};
 constexpr boost::json::string_view kId{"id"};
@@ -56,228 +56,160 @@ void tag_invoke(const json::value_from_tag,
 
 UserManager::~UserManager() {
   retry_timer_.cancel();
-  keep_alive_timer_.cancel();
-  Close();
-}
-
-void UserManager::Initialize() {
-  request_.version(11);
-  request_.method(http::verb::post);
-  request_.target(g_app.Engine().GetUserServiceTarget());
-  std::stringstream host;
-  host << g_app.Engine().GetUserServiceEndpoint();
-  request_.set(http::field::content_type, kContentType.data());
-  request_.set(http::field::host, host.str());
-  request_.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-}
-
-void UserManager::Close() {
-  if (stream_) {
-    if (stream_->socket().is_open()) {
-      beast::error_code ec;
-      stream_->socket().shutdown(tcp::socket::shutdown_both, ec);
-      stream_->close();
-    }
-  }
-  read_buffer_.clear();
-  response_.clear();
-  response_.body().clear();
-  json_parser_.reset();
 }
 
-void UserManager::Login(const Verification& verification) {
+void UserManager::Login(const Verification& verification, bool authorized) {
+  // Before going to the strand, the session logs it.
   username_ = verification.username;
-
-  json::object jo;
-  jo[kProtocol] = kProtocolVersion;
-  jo[kId] = 0;
-  jo[kMethod] = "login";
-  jo[kParams] = json::value_from(verification);
-  InvokeConnection(Method::kLogin, json::serialize(jo));
+  net::dispatch(strand_, [self = shared_from_this(), verification,
+                          authorized]() {
+    self->verification_ = verification;
+    self->authorized_locally_ = authorized;
+
+    json::object jo;
+    jo[kProtocol] = kProtocolVersion;
+    jo[kId] = 0;
+    jo[kMethod] = "login";
+    jo[kParams] = json::value_from(verification);
+    self->login_request_ = json::serialize(jo);
+    self->Invoke(Method::kLogin, self->login_request_);
+  });
 }
 
 void UserManager::KeepAlive() {
-  if (user_state_ < UserState::kLoggedIn) {
+  auto jo = MakeKeepAliveRequest(0);
+  if (jo.empty()) {
     DEBUG_PRINT("Not logged in!\n");
     return;
   }
-
-  json::object jo;
-  jo[kProtocol] = kProtocolVersion;
-  jo[kId] = 0;
-  jo[kMethod] = "keepalive";
-  auto& params = jo[kParams].emplace_object();
-  params["session_id"] = session_id_;
-  InvokeConnection(Method::kKeepAlive, json::serialize(jo));
+  Invoke(Method::kKeepAlive, json::serialize(jo));
 }
 
 void UserManager::Logout() {
-  if (user_state_ < UserState::kLoggingIn) {
-    DEBUG_PRINT("Not logging/logged in!\n");
-    return;
-  }
+  net::dispatch(strand_, [self = shared_from_this()]() {
+    if (self->user_state_ < UserState::kLoggingIn) {
+      DEBUG_PRINT("Not logging/logged in!\n");
+      return;
+    }
+
+    json::object jo;
+    jo[kProtocol] = kProtocolVersion;
+    // notification, so no id
+    jo[kMethod] = "logout";
+    auto& params = jo[kParams].emplace_object();
+    params["session_id"] = self->session_id_;
+    self->Invoke(Method::kLogout, json::serialize(jo));
+  });
+}
 
+json::object UserManager::MakeKeepAliveRequest(std::int64_t id) {
   json::object jo;
+  std::lock_guard<std::mutex> lock(keep_alive_mutex_);
+  if (keep_alive_session_id_.empty()) {
+    return jo;
+  }
+
   jo[kProtocol] = kProtocolVersion;
-  // notification, so no id
-  jo[kMethod] = "logout";
+  jo[kId] = id;
+  jo[kMethod] = "keepalive";
   auto& params = jo[kParams].emplace_object();
-  params["session_id"] = session_id_;
-  InvokeConnection(Method::kLogout, json::serialize(jo));
+  params["session_id"] = keep_alive_session_id_;
+  return jo;
 }
 
-void UserManager::InvokeConnection(Method method, std::string request_body) {
+void UserManager::Invoke(Method method, std::string request_body) {
   assert(!request_body.empty());
   if (request_body.empty()) {
     return;
   }
 
-  std::lock_guard<std::mutex> lock(request_queue_mutex_);
-  request_queue_.emplace(std::pair(method, std::move(request_body)));
-  if (1 < request_queue_.size()) {
-    return;
-  }
-
-  Close();
-  stream_ = std::make_unique<beast::tcp_stream>(ioc_);
-  if (!stream_) {
-    DEBUG_PRINT("Not enough memory!\n");
-    return;
+  switch (method) {
+    case Method::kLogin:
+      user_state_ = UserState::kLoggingIn;
+      break;
+    case Method::kLogout:
+      user_state_ = UserState::kLoggingOut;
+      {
+        std::lock_guard<std::mutex> lock(keep_alive_mutex_);
+        keep_alive_session_id_.clear();
+      }
+      break;
+    default:
+      break;
   }
 
-  stream_->async_connect(
-      g_app.Engine().GetUserServiceEndpoint(),
-      beast::bind_front_handler(&UserManager::OnConnect, shared_from_this()));
-}
-
-void UserManager::InvokeNextConnection() {
-  std::lock_guard<std::mutex> lock(request_queue_mutex_);
-  if (!request_queue_.empty()) {
-    stream_->async_connect(
-        g_app.Engine().GetUserServiceEndpoint(),
-        beast::bind_front_handler(&UserManager::OnConnect, shared_from_this()));
-  }
+  // Only keepalive may be sent twice without side effects. The pool calls
+  // back on its own strand.
+  engine_.GetUserServicePool().Invoke(
+      std::move(request_body), Method::kKeepAlive == method,
+      [self = shared_from_this(), method](beast::error_code ec,
+                                          UserServicePool::Response response) {
+        auto on_response = [self, method, ec,
+                            response = std::move(response)]() mutable {
+          switch (method) {
+            case Method::kLogin:
+              self->OnLoginResponse(ec, std::move(response));
+              break;
+            case Method::kKeepAlive:
+              self->OnKeepAliveResponse(ec, std::move(response));
+              break;
+            case Method::kLogout:
+              self->OnLogoutResponse(ec, std::move(response));
+              break;
+          }
+        };
+        net::dispatch(self->strand_, std::move(on_response));
+      });
 }
 
 void UserManager::InvokeNextKeepAlive() {
   if (0 < interval_) {
-    keep_alive_timer_.expires_after(std::chrono::seconds(interval_));
-    keep_alive_timer_.async_wait([&](const boost::system::error_code& error) {
-      if (!error) {
-        KeepAlive();
-      }
-    });
+    engine_.GetKeepAliveBatcher().Schedule(std::chrono::seconds(interval_),
+                                           weak_from_this());
   }
 }
 
-void UserManager::RetryNextConnection() {
+void UserManager::RetryLater(Method method) {
   retry_timer_.expires_after(kRetryInterval);
-  retry_timer_.async_wait([&](const boost::system::error_code& error) {
-    if (!error) {
-      InvokeNextConnection();
+  // On strand_, the executor of the timer.
+  retry_timer_.async_wait([weak_self = weak_from_this(),
+                           method](const boost::system::error_code& error) {
+    auto self = weak_self.lock();
+    if (error || !self) {
+      return;
     }
-  });
-}
-
-void UserManager::OnConnect(beast::error_code ec) {
-  assert(!request_queue_.empty());
-
-  if (ec) {
-    ++retry_times_;
-    if (kMaxRetryTimes < retry_times_) {
-      switch (request_queue_.front().first) {
-        case Method::kLogin:
-          user_state_ = UserState::kNone;
-          if (!game_session_.expired()) {
-            auto gs = game_session_.lock();
-            if (gs) {
-              gs->NotifyLoginResult(false);
-            }
-          }
-          break;
-        case Method::kKeepAlive:
-          if (!game_session_.expired()) {
-            auto gs = game_session_.lock();
-            if (gs) {
-              gs->NotifyKeepAliveResult(false);
-            }
-          }
-          break;
-        case Method::kLogout:
-          break;
-      }
+    if (Method::kLogin == method) {
+      self->Invoke(Method::kLogin, self->login_request_);
     } else {
-      RetryNextConnection();
-    }
-    return Fail(ec, "connect", g_app.Engine().GetUserServiceEndpoint());
-  }
-  APP_DEBUG() << "Connected to Regame user service "
-              << g_app.Engine().GetUserServiceEndpoint() << '\n';
-
-  std::lock_guard<std::mutex> lock(request_queue_mutex_);
-  request_.body() = request_queue_.front().second;
-  request_.prepare_payload();
-  DEBUG_VERBOSE(std::format("Request: {}\n", request_.body()));
-  http::async_write(
-      *stream_, request_,
-      beast::bind_front_handler(&UserManager::OnRequest, shared_from_this()));
-}
-
-void UserManager::OnRequest(beast::error_code ec,
-                            std::size_t bytes_transferred) {
-  assert(!request_queue_.empty());
-
-  if (ec) {
-    switch (request_queue_.front().first) {
-      case Method::kLogin:
-        if (!game_session_.expired()) {
-          auto gs = game_session_.lock();
-          if (gs) {
-            gs->NotifyLoginResult(false);
-          }
-        }
-        break;
+      self->KeepAlive();
     }
-    InvokeNextConnection();
-    return Fail(ec, "write", g_app.Engine().GetUserServiceEndpoint());
-  }
-
-  switch (request_queue_.front().first) {
-    case Method::kLogin:
-      user_state_ = UserState::kLoggingIn;
-      http::async_read(*stream_, read_buffer_, response_,
-                       beast::bind_front_handler(&UserManager::OnLoginResponse,
-                                                 shared_from_this()));
-      break;
-    case Method::kKeepAlive:
-      http::async_read(
-          *stream_, read_buffer_, response_,
-          beast::bind_front_handler(&UserManager::OnKeepAliveResponse,
-                                    shared_from_this()));
-      break;
-    case Method::kLogout:
-      user_state_ = UserState::kLoggingOut;
-      http::async_read(*stream_, read_buffer_, response_,
-                       beast::bind_front_handler(&UserManager::OnLogoutResponse,
-                                                 shared_from_this()));
-      break;
-    default:
-      break;
-  }
+  });
 }
 
 void UserManager::OnLoginResponse(beast::error_code ec,
-                                  std::size_t bytes_transferred) {
-  retry_times_ = 0;
-  request_queue_.pop();
-
+                                  UserServicePool::Response response) {
   bool authorized = false;
-  BOOST_SCOPE_EXIT_ALL(this, &authorized) {
-    Close();
-
+  bool retrying = false;
+  BOOST_SCOPE_EXIT_ALL(this, &authorized, &retrying) {
+    if (retrying) {
+      return;
+    }
+    retry_times_ = 0;
+    auto& login_cache = engine_.GetLoginCache();
     if (authorized) {
+      login_cache.Add(verification_);
       user_state_ = UserState::kLoggedIn;
+      {
+        std::lock_guard<std::mutex> lock(keep_alive_mutex_);
+        keep_alive_session_id_ = session_id_;
+      }
       InvokeNextKeepAlive();
+      if (authorized_locally_) {
+        return;
+      }
+    } else {
+      login_cache.Remove(verification_);
+      user_state_ = UserState::kNone;
     }
     if (!game_session_.expired()) {
       auto gs = game_session_.lock();
@@ -288,42 +220,40 @@ void UserManager::OnLoginResponse(beast::error_code ec,
   };
 
   if (ec) {
-    return Fail(ec, "read", g_app.Engine().GetUserServiceEndpoint());
+    // The pool already retried what is safe, so the service is unreachable.
+    if (ec != net::error::operation_aborted) {
+      ++retry_times_;
+      retrying = retry_times_ <= kMaxRetryTimes;
+      if (retrying) {
+        RetryLater(Method::kLogin);
+      }
+    }
+    return Fail(ec, "login", engine_.GetUserServiceEndpoint());
   }
 
-  if (response_.result() != http::status::ok) {
-    return Fail(ec, "http", g_app.Engine().GetUserServiceEndpoint());
+  if (response.result() != http::status::ok) {
+    return Fail(ec, "http", engine_.GetUserServiceEndpoint());
   }
 
   json::error_code json_ec;
-  json_parser_.write(response_.body(), json_ec);
-  if (json_ec) {
-    return Fail(ec, "json", g_app.Engine().GetUserServiceEndpoint());
-  }
-  json_parser_.finish(json_ec);
+  json::value jv = json::parse(response.body(), json_ec);
   if (json_ec) {
-    return Fail(ec, "parse", g_app.Engine().GetUserServiceEndpoint());
+    return Fail(json_ec, "json", engine_.GetUserServiceEndpoint());
   }
-  if (json_parser_.done()) {
-    retry_times_ = 0;
 
-    json::value jv(json_parser_.release());
-    json_parser_.reset();
-
-    if (auto jo = jv.if_object(); nullptr != jo) {
-      DEBUG_VERBOSE(std::format("Login: {}\n", json::serialize(*jo)));
-      if (auto result_jv = jo->if_contains("result"); nullptr != result_jv) {
-        if (auto result_jo = result_jv->if_object(); nullptr != result_jo) {
-          if (auto interval_jv = result_jo->if_contains("interval"),
-              session_id_jv = result_jo->if_contains("session_id");
-              nullptr != interval_jv && nullptr != session_id_jv) {
-            if (auto interval = interval_jv->if_int64(); nullptr != interval) {
-              if (auto session_id = session_id_jv->if_string();
-                  nullptr != session_id) {
-                interval_ = *interval;
-                session_id_ = *session_id;
-                authorized = !session_id_.empty();
-              }
+  if (auto jo = jv.if_object(); nullptr != jo) {
+    DEBUG_VERBOSE(std::format("Login: {}\n", json::serialize(*jo)));
+    if (auto result_jv = jo->if_contains("result"); nullptr != result_jv) {
+      if (auto result_jo = result_jv->if_object(); nullptr != result_jo) {
+        if (auto interval_jv = result_jo->if_contains("interval"),
+            session_id_jv = result_jo->if_contains("session_id");
+            nullptr != interval_jv && nullptr != session_id_jv) {
+          if (auto interval = interval_jv->if_int64(); nullptr != interval) {
+            if (auto session_id = session_id_jv->if_string();
+                nullptr != session_id) {
+              interval_ = *interval;
+              session_id_ = *session_id;
+              authorized = !session_id_.empty();
             }
           }
         }
@@ -333,16 +263,48 @@ void UserManager::OnLoginResponse(beast::error_code ec,
 }
 
 void UserManager::OnKeepAliveResponse(beast::error_code ec,
-                                      std::size_t bytes_transferred) {
+                                      UserServicePool::Response response) {
+  json::value jv;
+  bool parsed = false;
+  BOOST_SCOPE_EXIT_ALL(this, &jv, &parsed) {
+    HandleKeepAliveResult(parsed ? &jv : nullptr);
+  };
+
+  if (ec) {
+    return Fail(ec, "keepalive", engine_.GetUserServiceEndpoint());
+  }
+
+  if (response.result() != http::status::ok) {
+    return Fail(ec, "http", engine_.GetUserServiceEndpoint());
+  }
+
+  json::error_code json_ec;
+  jv = json::parse(response.body(), json_ec);
+  if (json_ec) {
+    return Fail(json_ec, "json", engine_.GetUserServiceEndpoint());
+  }
+  parsed = true;
+}
+
+void UserManager::OnKeepAliveResult(const json::value* response) {
+  std::optional<json::value> result;
+  if (nullptr != response) {
+    result = *response;
+  }
+  net::dispatch(strand_, [self = shared_from_this(),
+                          result = std::move(result)]() {
+    self->HandleKeepAliveResult(result ? &*result : nullptr);
+  });
+}
+
+void UserManager::HandleKeepAliveResult(const json::value* response) {
   bool failed = true;
   bool kept_alive = false;
   BOOST_SCOPE_EXIT_ALL(this, &failed, &kept_alive) {
-    Close();
-
     if (failed) {
       ++retry_times_;
       if (retry_times_ <= kMaxRetryTimes) {
-        RetryNextConnection();
+        RetryLater(Method::kKeepAlive);
       }
     } else {
       if (kept_alive) {
@@ -358,46 +320,26 @@ void UserManager::OnKeepAliveResponse(beast::error_code ec,
     }
   };
 
-  if (ec) {
-    return Fail(ec, "read", g_app.Engine().GetUserServiceEndpoint());
-  }
-
-  if (response_.result() != http::status::ok) {
-    return Fail(ec, "http", g_app.Engine().GetUserServiceEndpoint());
+  if (nullptr == response) {
+    return;
   }
 
-  json::error_code json_ec;
-  json_parser_.write(response_.body(), json_ec);
-  if (json_ec) {
-    return Fail(json_ec, "json", g_app.Engine().GetUserServiceEndpoint());
-  }
-  json_parser_.finish(json_ec);
-  if (json_ec) {
-    return Fail(json_ec, "parse", g_app.Engine().GetUserServiceEndpoint());
-  }
-  if (json_parser_.done()) {
-    retry_times_ = 0;
-    failed = false;
-    request_queue_.pop();
-
-    json::value jv(json_parser_.release());
-    json_parser_.reset();
-
-    if (auto jo = jv.if_object(); nullptr != jo) {
-      DEBUG_VERBOSE(std::format("Keepalive: {}\n", json::serialize(*jo)));
-      if (auto result_jv = jo->if_contains("result"); nullptr != result_jv) {
-        if (auto result_jo = result_jv->if_object(); nullptr != result_jo) {
-          if (auto interval_jv = result_jo->if_contains("interval"),
-              session_id_jv = result_jo->if_contains("session_id");
-              nullptr != interval_jv && nullptr != session_id_jv) {
-            if (auto interval = interval_jv->if_int64(); nullptr != interval) {
-              if (auto session_id = session_id_jv->if_string();
-                  nullptr != session_id) {
-                if (session_id_ == *session_id) {
-                  interval_ = *interval;
-                  kept_alive = true;
-                  return;
-                }
+  retry_times_ = 0;
+  failed = false;
+  if (auto jo = response->if_object(); nullptr != jo) {
+    DEBUG_VERBOSE(std::format("Keepalive: {}\n", json::serialize(*jo)));
+    if (auto result_jv = jo->if_contains("result"); nullptr != result_jv) {
+      if (auto result_jo = result_jv->if_object(); nullptr != result_jo) {
+        if (auto interval_jv = result_jo->if_contains("interval"),
+            session_id_jv = result_jo->if_contains("session_id");
+            nullptr != interval_jv && nullptr != session_id_jv) {
+          if (auto interval = interval_jv->if_int64(); nullptr != interval) {
+            if (auto session_id = session_id_jv->if_string();
+                nullptr != session_id) {
+              if (session_id_ == *session_id) {
+                interval_ = *interval;
+                kept_alive = true;
+                return;
               }
             }
           }
@@ -408,9 +350,10 @@ void UserManager::OnKeepAliveResponse(beast::error_code ec,
 }
 
 void UserManager::OnLogoutResponse(beast::error_code ec,
-                                   std::size_t bytes_transferred) {
-  BOOST_SCOPE_EXIT_ALL(this) { Close(); };
+                                   UserServicePool::Response response) {
   retry_times_ = 0;
   user_state_ = UserState::kNone;
-  request_queue_.pop();
+  if (ec) {
+    return Fail(ec, "logout", engine_.GetUserServiceEndpoint());
+  }
 }
@@ -19,21 +19,27 @@
 #include <boost/json.hpp>
 
 #include "game_session.h"
+#include "user_service_pool.h"
 
 namespace json = boost::json;
 
+class Engine;
+
+// The state is kept on a strand of its own: calls come from the session, the
+// user service pool, the KeepAliveBatcher and the retry timer, which all run
+// on the threads of the shared io_context.
 class UserManager : public std::enable_shared_from_this<UserManager> {
  public:
-  UserManager(net::io_context& ioc, std::weak_ptr<GameSession>&& game_session)
+  UserManager(net::io_context& ioc,
+              Engine& engine,
+              std::weak_ptr<GameSession>&& game_session)
       : ioc_(ioc),
+        engine_(engine),
         game_session_(std::move(game_session)),
-        retry_timer_(ioc),
-        keep_alive_timer_(ioc) {}
+        strand_(net::make_strand(ioc)),
+        retry_timer_(strand_) {}
   ~UserManager();
 
-  void Initialize();
-  void Close();
-
   const std::string& GetUsername() noexcept { return username_; }
 
   struct Verification {
@@ -42,10 +48,18 @@ class UserManager : public std::enable_shared_from_this<UserManager> {
     std::int64_t type;
     std::string data;
   };
-  void Login(const Verification& verification);
-  void KeepAlive();
+  // Thread-safe.
+  // authorized: verified locally by LoginCache, the result is only reported
+  // if the user service disagrees.
+  void Login(const Verification& verification, bool authorized);
   void Logout();
 
+  // For KeepAliveBatcher, thread-safe. Returns an empty object if not logged
+  // in.
+  json::object MakeKeepAliveRequest(std::int64_t id);
+  // nullptr when the request or its batch failed.
+  void OnKeepAliveResult(const json::value* response);
+
  private:
   enum class Method { kLogin, kKeepAlive, kLogout };
   enum class UserState {
@@ -55,34 +69,37 @@ class UserManager : public std::enable_shared_from_this<UserManager> {
     kLoggingOut
   } user_state_ = UserState::kNone;
 
-  void InvokeConnection(Method method, std::string request_body);
-  void InvokeNextConnection();
+  // Called on strand_.
+  void KeepAlive();
+  void HandleKeepAliveResult(const json::value* response);
+  void Invoke(Method method, std::string request_body);
   void InvokeNextKeepAlive();
-  void RetryNextConnection();
+  void RetryLater(Method method);
 
-  void OnConnect(beast::error_code ec);
-  void OnRequest(beast::error_code ec, std::size_t bytes_transferred);
-  void OnLoginResponse(beast::error_code ec, std::size_t bytes_transferred);
-  void OnKeepAliveResponse(beast::error_code ec, std::size_t bytes_transferred);
-  void OnLogoutResponse(beast::error_code ec, std::size_t bytes_transferred);
+  void OnLoginResponse(beast::error_code ec,
+                       UserServicePool::Response response);
+  void OnKeepAliveResponse(beast::error_code ec,
+                           UserServicePool::Response response);
+  void OnLogoutResponse(beast::error_code ec,
+                        UserServicePool::Response response);
 
  private:
   net::io_context& ioc_;
+  Engine& engine_;
   std::weak_ptr<GameSession> game_session_;
-  std::unique_ptr<beast::tcp_stream> stream_{};
-  beast::flat_buffer read_buffer_;
-  http::request<http::string_body> request_;
-  http::response<http::string_body> response_;
-
-  std::mutex request_queue_mutex_;
-  std::queue<std::pair<Method, std::string>> request_queue_;
-
-  json::stream_parser json_parser_;
 
   std::string username_;
+  Verification verification_;
+  bool authorized_locally_{false};
+  std::string login_request_;
   std::string session_id_;
   std::uint64_t interval_;
   std::size_t retry_times_{0};
-  boost::asio::steady_timer retry_timer_;
-  boost::asio::steady_timer keep_alive_timer_;
+
+  net::strand<net::io_context::executor_type> strand_;
+  net::steady_timer retry_timer_;
+
+  // Read by KeepAliveBatcher on its own strand, empty unless logged in.
+  std::mutex keep_alive_mutex_;
+  std::string keep_alive_session_id_;
 };
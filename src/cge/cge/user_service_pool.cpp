@@ -0,0 +1,383 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch.h"
+
+#include "user_service_pool.h"
+
+#include <format>
+#include <optional>
+
+#include "app.hpp"
+#include "handler_memory.hpp"
+
+using namespace std::literals::string_view_literals;
+
+constexpr auto kContentType{"application/json; charset=utf-8"sv};
+
+namespace {
+
+inline void Fail(beast::error_code ec,
+                 std::string_view what,
+                 const tcp::endpoint& endpoint) {
+  APP_ERROR() << "UserServicePool: " << what << " " << endpoint << " error "
+              << ec.value() << ", " << ec.message() << '\n';
+}
+
+// The service closed a kept-alive connection before reading our request.
+inline bool IsStaleError(beast::error_code ec) noexcept {
+  return ec == http::error::end_of_stream || ec == net::error::eof ||
+         ec == net::error::connection_reset ||
+         ec == net::error::connection_aborted || ec == net::error::broken_pipe;
+}
+
+}  // namespace
+
+#pragma region "Connection"
+class UserServicePool::Connection
+    : public std::enable_shared_from_this<Connection> {
+ public:
+  explicit Connection(UserServicePool& pool)
+      : pool_(pool), stream_(pool.strand_) {}
+
+  void Connect() {
+    ++pool_.connects_;
+    stream_.expires_after(kRequestTimeout);
+    stream_.async_connect(
+        pool_.endpoint_,
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Connection::OnConnect,
+                                                    shared_from_this())));
+  }
+
+  void Send(std::shared_ptr<Request> request) {
+    if (0 < served_) {
+      ++pool_.reused_;
+    }
+    if (!in_flight_.empty()) {
+      ++pool_.pipelined_;
+    }
+    if (!request->idempotent) {
+      ++non_idempotent_;
+    }
+    in_flight_.emplace_back(std::move(request));
+    Write();
+  }
+
+  void Close() {
+    if (closed_) {
+      return;
+    }
+    closed_ = true;
+    beast::error_code ec;
+    stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+    stream_.close();
+  }
+
+  // Free for a new request, may be still connecting.
+  bool IsIdle() const noexcept { return !closed_ && in_flight_.empty(); }
+
+  bool IsExpired(std::chrono::steady_clock::time_point now) const noexcept {
+    return IsIdle() && connected_ && kIdleTimeout < now - last_used_;
+  }
+
+  // Only idempotent requests are pipelined, so that a broken connection never
+  // leaves a non-idempotent request in an unknown state behind another one.
+  bool CanPipeline() const noexcept {
+    return !closed_ && connected_ && 0 == non_idempotent_ &&
+           in_flight_.size() < kMaxPipelineDepth;
+  }
+
+  std::size_t GetDepth() const noexcept { return in_flight_.size(); }
+
+ private:
+  void OnConnect(beast::error_code ec) {
+    if (ec) {
+      return Abort(ec, "connect");
+    }
+    connected_ = true;
+    last_used_ = std::chrono::steady_clock::now();
+    Write();
+  }
+
+  void Write() {
+    if (closed_ || !connected_ || writing_ || in_flight_.size() <= written_) {
+      return;
+    }
+    writing_ = true;
+    stream_.expires_after(kRequestTimeout);
+    http::async_write(
+        stream_, in_flight_[written_]->message,
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Connection::OnWrite,
+                                                    shared_from_this())));
+  }
+
+  void OnWrite(beast::error_code ec, std::size_t bytes_transferred) {
+    writing_ = false;
+    if (ec) {
+      return Abort(ec, "write");
+    }
+    ++written_;
+    Read();
+    Write();
+  }
+
+  void Read() {
+    if (closed_ || reading_ || 0 == written_) {
+      return;
+    }
+    reading_ = true;
+    parser_.emplace();
+    stream_.expires_after(kRequestTimeout);
+    http::async_read(
+        stream_, buffer_, *parser_,
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Connection::OnRead,
+                                                    shared_from_this())));
+  }
+
+  void OnRead(beast::error_code ec, std::size_t bytes_transferred) {
+    reading_ = false;
+    if (ec) {
+      return Abort(ec, "read");
+    }
+
+    auto request = std::move(in_flight_.front());
+    in_flight_.pop_front();
+    --written_;
+    if (!request->idempotent) {
+      --non_idempotent_;
+    }
+    ++served_;
+    last_used_ = std::chrono::steady_clock::now();
+
+    auto response = parser_->release();
+    parser_.reset();
+    const bool keep_alive = response.keep_alive();
+    request->handler(ec, std::move(response));
+
+    if (!keep_alive) {
+      // The service won't answer the rest, let them go elsewhere.
+      return Abort(http::error::end_of_stream, "read");
+    }
+    if (in_flight_.empty()) {
+      stream_.expires_never();
+    }
+    Read();
+    pool_.Dispatch();
+  }
+
+  void Abort(beast::error_code ec, std::string_view what) {
+    if (!closed_ && ec != http::error::end_of_stream) {
+      Fail(ec, what, pool_.endpoint_);
+    }
+    // The first request on a reused connection hit a connection closed by
+    // the service while idle, nothing of it has been processed.
+    const bool is_stale = 0 < served_ && IsStaleError(ec) &&
+                          (!parser_ || !parser_->got_some());
+    Close();
+    auto requests = std::move(in_flight_);
+    in_flight_.clear();
+    const std::size_t written = written_;
+    written_ = 0;
+    non_idempotent_ = 0;
+    pool_.OnConnectionClosed(shared_from_this(), std::move(requests), written,
+                             is_stale, ec);
+  }
+
+ private:
+  UserServicePool& pool_;
+  HandlerMemory handler_memory_;
+  beast::tcp_stream stream_;
+  beast::flat_buffer buffer_;
+  std::optional<http::response_parser<http::string_body>> parser_;
+
+  std::deque<std::shared_ptr<Request>> in_flight_;
+  std::size_t written_{0};
+  std::size_t non_idempotent_{0};
+  std::size_t served_{0};
+  std::chrono::steady_clock::time_point last_used_;
+
+  bool connected_{false};
+  bool writing_{false};
+  bool reading_{false};
+  bool closed_{false};
+};
+#pragma endregion
+
+#pragma region "UserServicePool"
+UserServicePool::UserServicePool(net::io_context& ioc,
+                                 const tcp::endpoint& endpoint,
+                                 const std::string& target)
+    : strand_(net::make_strand(ioc)), endpoint_(endpoint) {
+  request_template_.version(11);
+  request_template_.method(http::verb::post);
+  request_template_.target(target);
+  std::stringstream host;
+  host << endpoint;
+  request_template_.set(http::field::content_type, kContentType.data());
+  request_template_.set(http::field::host, host.str());
+  request_template_.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+  request_template_.keep_alive(true);
+}
+
+void UserServicePool::Invoke(std::string body,
+                             bool idempotent,
+                             ResponseHandler handler) {
+  auto request = std::make_shared<Request>();
+  request->message = request_template_;
+  request->message.body() = std::move(body);
+  request->message.prepare_payload();
+  request->idempotent = idempotent;
+  request->handler = std::move(handler);
+  DEBUG_VERBOSE(std::format("Request: {}\n", request->message.body()));
+
+  ++requests_;
+  ++queued_;
+  net::post(strand_, [this, self = shared_from_this(),
+                      request = std::move(request)]() mutable {
+    if (closed_) {
+      --queued_;
+      ++failures_;
+      request->handler(net::error::operation_aborted, {});
+      return;
+    }
+    pending_.emplace_back(std::move(request));
+    Dispatch();
+  });
+}
+
+void UserServicePool::Close() {
+  net::post(strand_, [this, self = shared_from_this()]() {
+    closed_ = true;
+    for (auto& connection : connections_) {
+      connection->Close();
+    }
+    connections_.clear();
+    connection_count_ = 0;
+
+    auto pending = std::move(pending_);
+    pending_.clear();
+    queued_ = 0;
+    for (auto& request : pending) {
+      ++failures_;
+      request->handler(net::error::operation_aborted, {});
+    }
+  });
+}
+
+UserServicePool::Metrics UserServicePool::GetMetrics() const noexcept {
+  return Metrics{requests_.load(),  connects_.load(), reused_.load(),
+                 pipelined_.load(), retries_.load(),  failures_.load(),
+                 connection_count_.load(), queued_.load()};
+}
+
+void UserServicePool::ReportMetrics() const {
+  auto metrics = GetMetrics();
+  APP_INFO() << "User service pool " << endpoint_
+             << ": requests=" << metrics.requests
+             << ", connects=" << metrics.connects
+             << ", reused=" << metrics.reused
+             << ", pipelined=" << metrics.pipelined
+             << ", retries=" << metrics.retries
+             << ", failures=" << metrics.failures
+             << ", connections=" << metrics.connections
+             << ", queued=" << metrics.queued << '\n';
+}
+
+void UserServicePool::Dispatch() {
+  if (closed_) {
+    return;
+  }
+
+  // The service may have dropped connections idle for long.
+  auto now = std::chrono::steady_clock::now();
+  std::erase_if(connections_, [now](const auto& connection) {
+    if (connection->IsExpired(now)) {
+      connection->Close();
+      return true;
+    }
+    return false;
+  });
+
+  while (!pending_.empty()) {
+    auto connection = FindConnection(pending_.front()->idempotent);
+    if (!connection) {
+      break;
+    }
+    connection->Send(std::move(pending_.front()));
+    pending_.pop_front();
+    --queued_;
+  }
+  connection_count_ = connections_.size();
+}
+
+std::shared_ptr<UserServicePool::Connection> UserServicePool::FindConnection(
+    bool idempotent) {
+  for (auto& connection : connections_) {
+    if (connection->IsIdle()) {
+      return connection;
+    }
+  }
+
+  if (connections_.size() < kMaxConnections) {
+    auto connection = std::make_shared<Connection>(*this);
+    connections_.emplace_back(connection);
+    connection->Connect();
+    return connection;
+  }
+
+  if (!idempotent) {
+    return nullptr;
+  }
+  std::shared_ptr<Connection> shallowest;
+  for (auto& connection : connections_) {
+    if (connection->CanPipeline() &&
+        (!shallowest || connection->GetDepth() < shallowest->GetDepth())) {
+      shallowest = connection;
+    }
+  }
+  return shallowest;
+}
+
+void UserServicePool::OnConnectionClosed(
+    const std::shared_ptr<Connection>& connection,
+    std::deque<std::shared_ptr<Request>> requests,
+    std::size_t written,
+    bool is_stale,
+    beast::error_code ec) {
+  std::erase(connections_, connection);
+  connection_count_ = connections_.size();
+
+  // Retry in the original order, in front of the newer requests.
+  for (std::size_t i = requests.size(); 0 < i--;) {
+    auto& request = requests[i];
+    ++request->attempts;
+    const bool unsent = written <= i;
+    const bool safe = unsent || request->idempotent || (0 == i && is_stale);
+    if (!closed_ && safe && request->attempts < kMaxAttempts) {
+      ++retries_;
+      ++queued_;
+      pending_.emplace_front(std::move(request));
+    } else {
+      ++failures_;
+      request->handler(ec, {});
+    }
+  }
+  Dispatch();
+}
+#pragma endregion
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+
+#include "net.hpp"
+
+// HTTP/1.1 keep-alive connections to the user service, shared by all
+// UserManager of an Engine.
+//
+// Requests are sent on an idle connection, or on a new one while there are
+// less than kMaxConnections. Idempotent requests may also be pipelined behind
+// other idempotent requests. When a connection breaks, the requests which
+// can be safely sent again are retried once on another connection; the others
+// complete with the error.
+//
+// All the work is serialized on a strand, handlers are invoked on it too.
+class UserServicePool : public std::enable_shared_from_this<UserServicePool> {
+ public:
+  static constexpr std::size_t kMaxConnections = 8;
+  static constexpr std::size_t kMaxPipelineDepth = 4;
+  static constexpr std::size_t kMaxAttempts = 2;
+  static constexpr std::chrono::seconds kIdleTimeout{30};
+  static constexpr std::chrono::seconds kRequestTimeout{15};
+
+  using Response = http::response<http::string_body>;
+  using ResponseHandler =
+      std::function<void(beast::error_code ec, Response response)>;
+
+  struct Metrics {
+    std::uint64_t requests;
+    std::uint64_t connects;
+    std::uint64_t reused;     // sent on a connection which served before
+    std::uint64_t pipelined;  // sent before the previous response arrived
+    std::uint64_t retries;
+    std::uint64_t failures;
+    std::size_t connections;
+    std::size_t queued;
+  };
+
+  UserServicePool(net::io_context& ioc,
+                  const tcp::endpoint& endpoint,
+                  const std::string& target);
+  ~UserServicePool() = default;
+
+  // Thread-safe.
+  void Invoke(std::string body, bool idempotent, ResponseHandler handler);
+  void Close();
+
+  const tcp::endpoint& GetEndpoint() const noexcept { return endpoint_; }
+  Metrics GetMetrics() const noexcept;
+  void ReportMetrics() const;
+
+ private:
+  struct Request {
+    http::request<http::string_body> message;
+    bool idempotent;
+    std::size_t attempts{0};
+    ResponseHandler handler;
+  };
+  class Connection;
+
+  void Dispatch();
+  std::shared_ptr<Connection> FindConnection(bool idempotent);
+  void OnConnectionClosed(const std::shared_ptr<Connection>& connection,
+                          std::deque<std::shared_ptr<Request>> requests,
+                          std::size_t written,
+                          bool is_stale,
+                          beast::error_code ec);
+
+ private:
+  net::strand<net::io_context::executor_type> strand_;
+  tcp::endpoint endpoint_;
+  http::request<http::string_body> request_template_;
+
+  bool closed_{false};
+  std::deque<std::shared_ptr<Request>> pending_;
+  std::vector<std::shared_ptr<Connection>> connections_;
+
+  std::atomic<std::uint64_t> requests_{0};
+  std::atomic<std::uint64_t> connects_{0};
+  std::atomic<std::uint64_t> reused_{0};
+  std::atomic<std::uint64_t> pipelined_{0};
+  std::atomic<std::uint64_t> retries_{0};
+  std::atomic<std::uint64_t> failures_{0};
+  std::atomic<std::size_t> connection_count_{0};
+  std::atomic<std::size_t> queued_{0};
+};
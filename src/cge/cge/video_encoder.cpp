@@ -24,6 +24,63 @@
 
 using namespace regame;
 
+namespace {
+
+// libx264 and libx265 scale AVRegionOfInterest::qoffset by their QP range.
+constexpr int kQpRange = 51;
+
+// Also read by the conversion stage, which must not touch codec_context_ as
+// the encode stage may reopen it.
+constexpr AVRational kTimeBase{1, kH264TimeBase};
+
+// libsvtav1 derives its rate control from the frame rate, which would be the
+// time base without one. Frames are still timed by their pts.
+constexpr AVRational kNominalFrameRate{60, 1};
+// libsvtav1 CRF is [0, 63], scaled from the [0, 51] of --video-quality.
+constexpr int kSvtAv1MaxCrf = 63;
+
+AVPixelFormat GetPixelFormat(VideoFrameType type) noexcept {
+  switch (type) {
+    case VideoFrameType::kI422:
+      [[fallthrough]];
+    case VideoFrameType::kJ422:
+      return AV_PIX_FMT_YUV422P;
+    case VideoFrameType::kI444:
+      return AV_PIX_FMT_YUV444P;
+    default:
+      // Textures are converted to YUV420P.
+      return AV_PIX_FMT_YUV420P;
+  }
+}
+
+AVColorRange GetColorRange(VideoFrameType type) noexcept {
+  if (VideoFrameType::kJ420 == type || VideoFrameType::kJ422 == type) {
+    return AVCOL_RANGE_JPEG;
+  }
+  return AVCOL_RANGE_UNSPECIFIED;
+}
+
+std::array<DamageDetector::Plane, 3> GetPlanes(const AVFrame* frame) noexcept {
+  int shift_x = 0;
+  int shift_y = 0;
+  av_pix_fmt_get_chroma_sub_sample(static_cast<AVPixelFormat>(frame->format),
+                                   &shift_x, &shift_y);
+  std::array<DamageDetector::Plane, 3> planes;
+  for (int i = 0; i < 3; ++i) {
+    const int x = 0 == i ? 0 : shift_x;
+    const int y = 0 == i ? 0 : shift_y;
+    planes[i] = {frame->data[i],
+                 frame->linesize[i],
+                 static_cast<std::uint32_t>(AV_CEIL_RSHIFT(frame->width, x)),
+                 static_cast<std::uint32_t>(AV_CEIL_RSHIFT(frame->height, y)),
+                 DamageDetector::kTileSize >> x,
+                 DamageDetector::kTileSize >> y};
+  }
+  return planes;
+}
+
+}  // namespace
+
 bool VideoEncoder::Initialize(uint64_t bitrate,
                               AVCodecID codec_id,
                               HardwareEncoder hardware_encoder,
@@ -36,41 +93,37 @@ bool VideoEncoder::Initialize(uint64_t bitrate,
   gop_ = gop;
   video_preset_ = std::move(video_preset);
   quality_ = quality;
+  requested_settings_ = {bitrate_, quality_, gop_, video_preset_};
 
-  HANDLE ev = CreateEvent(g_app.SA(), TRUE, FALSE,
-                          object_namer_.Get(kVideoStartedEventName).data());
-  if (nullptr == ev) {
-    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %u\n",
-              GetLastError());
+  auto ec = started_event_.Create(object_namer_.Get(kVideoStartedEventName),
+                                  true, g_app.SA());
+  if (ec) {
+    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %d\n",
+              ec.value());
     return false;
   }
-  started_event_.Attach(ev);
 
-  ev = CreateEvent(g_app.SA(), TRUE, FALSE,
-                   object_namer_.Get(kVideoStoppedEventName).data());
-  if (nullptr == ev) {
-    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %u\n",
-              GetLastError());
+  ec = stop_event_.Create(object_namer_.Get(kVideoStoppedEventName), true,
+                          g_app.SA());
+  if (ec) {
+    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %d\n",
+              ec.value());
     return false;
   }
-  stop_event_.Attach(ev);
 
-  ev = CreateEvent(g_app.SA(), FALSE, FALSE,
-                   object_namer_.Get(kSharedVideoFrameReadyEventName).data());
-  if (nullptr == ev) {
-    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %u\n",
-              GetLastError());
+  ec = shared_frame_ready_event_.Create(
+      object_namer_.Get(kSharedVideoFrameReadyEventName), false, g_app.SA());
+  if (ec) {
+    ATLTRACE2(atlTraceException, 0, "CreateEvent() failed with %d\n",
+              ec.value());
     return false;
   }
-  shared_frame_ready_event_.Attach(ev);
 
-  BOOL already_existed;
-  HRESULT hr = shared_frame_info_.MapSharedMem(
-      sizeof(SharedVideoFrameInfo),
-      object_namer_.Get(kSharedVideoFrameInfoFileMappingName).data(),
-      &already_existed, g_app.SA());
-  if (FAILED(hr) && !already_existed) {
-    APP_ERROR() << "MapSharedMem(info) failed with 0x" << std::hex << hr
+  ec = shared_frame_info_.Create(
+      object_namer_.Get(kSharedVideoFrameInfoFileMappingName),
+      sizeof(SharedVideoFrameInfo), nullptr, g_app.SA());
+  if (ec) {
+    APP_ERROR() << "Create shared memory(info) failed with " << ec.message()
                 << '\n';
     return false;
   }
@@ -79,7 +132,7 @@ bool VideoEncoder::Initialize(uint64_t bitrate,
 }
 
 int VideoEncoder::Run() {
-  ResetEvent(stop_event_);
+  stop_event_.Reset();
   thread_ = std::thread(&VideoEncoder::EncodingThread, this);
   if (nullptr == thread_.native_handle()) {
     APP_ERROR() << "Create thread failed with " << GetLastError() << '\n';
@@ -92,46 +145,64 @@ void VideoEncoder::Stop() {
   Free(true);
 }
 
+void VideoEncoder::Reconfigure(Settings settings) {
+  APP_INFO() << "Video settings requested: bitrate " << settings.bitrate
+             << ", quality " << settings.quality << ", gop " << settings.gop
+             << ", preset " << settings.preset << ".\n";
+  std::lock_guard<std::mutex> lock(settings_mutex_);
+  if (!UsesBitrate()) {
+    settings.bitrate = requested_settings_.bitrate;
+  }
+  requested_settings_ = std::move(settings);
+  settings_changed_ = true;
+}
+
+VideoEncoder::Settings VideoEncoder::GetSettings() const {
+  std::lock_guard<std::mutex> lock(settings_mutex_);
+  return requested_settings_;
+}
+
+bool VideoEncoder::IsValidPreset(std::string_view preset) const noexcept {
+  auto contains = [preset](const auto& presets) {
+    return presets.cend() !=
+           std::find(presets.cbegin(), presets.cend(), preset);
+  };
+  switch (hardware_encoder_) {
+    case HardwareEncoder::AMF:
+      return contains(kValidAmfPreset);
+    case HardwareEncoder::NVENC:
+      return contains(kValidNvencPreset);
+    case HardwareEncoder::QSV:
+      return contains(kValidQsvPreset);
+    default:
+      return AV_CODEC_ID_AV1 == GetCodecID() ? contains(kValidSvtAv1Preset)
+                                             : contains(kValidPreset);
+  }
+}
+
 int VideoEncoder::EncodingThread() {
   bool restart = false;
   BOOST_SCOPE_EXIT_ALL(&restart, this) {
     if (restart) {
-      g_app.Engine().NotifyRestartVideoEncoder();
+      GetEngine().NotifyRestartVideoEncoder();
     } else {
       Free(restart);
     }
   };
 
-  const char* format_name = nullptr;
-  if (AV_CODEC_ID_H264 == GetCodecID()) {
-    format_name = "h264";
-  } else if (AV_CODEC_ID_HEVC == GetCodecID()) {
-    format_name = "hevc";
-  }
-
-  int error_code = avformat_alloc_output_context2(&format_context_, nullptr,
-                                                  format_name, nullptr);
-  if (error_code < 0) {
-    return error_code;
-  }
-
-  SetEvent(started_event_);
+  started_event_.Set();
 
   // wait for first video frame, to retrieve size.
-  HANDLE events[]{stop_event_, shared_frame_ready_event_};
-  DWORD wait =
-      WaitForMultipleObjects(_countof(events), events, FALSE, INFINITE);
-  if (WAIT_OBJECT_0 == wait) {
+  std::size_t wait = WaitForAny({&stop_event_, &shared_frame_ready_event_});
+  if (0 == wait) {
     ATLTRACE2(atlTraceUtil, 0, "%s: stopping.\n", __func__);
     return 0;
-  } else if (WAIT_OBJECT_0 + 1 != wait) {
-    int error_code = GetLastError();
-    APP_WARNING() << "Unexpected WaitForMultipleObjects() return " << wait
-                  << ", error code " << error_code << ".\n";
-    return error_code;
+  } else if (1 != wait) {
+    APP_WARNING() << "Unexpected WaitForAny() return " << wait << ".\n";
+    return -1;
   }
 
-  SharedVideoFrameInfo* shared_frame_info = shared_frame_info_;
+  auto shared_frame_info = shared_frame_info_.As<SharedVideoFrameInfo>();
   saved_frame_info_ = *shared_frame_info;
   APP_INFO() << "Video timestamp: " << saved_frame_info_.timestamp
              << ", type: " << static_cast<uint32_t>(saved_frame_info_.type)
@@ -143,92 +214,68 @@ int VideoEncoder::EncodingThread() {
     return ERROR_INVALID_DATA;
   }
 
-  if (VideoFrameType::kTexture == saved_frame_info_.type) {
-    HRESULT hr = shared_texture_frames_.OpenMapping(
-        object_namer_.Get(kSharedVideoTextureFramesFileMappingName).data(),
-        sizeof(SharedVideoTextureFrames));
-    if (FAILED(hr)) {
-      APP_ERROR() << "OpenMapping() failed with 0x" << std::hex << hr << '\n';
-      restart = true;
-      return hr;
-    }
-  } else {
-    size_t pixel_size = saved_frame_info_.width * saved_frame_info_.height;
-    size_t yuv_size;
-    switch (saved_frame_info_.type) {
-      case VideoFrameType::kI420:
-        [[fallthrough]];
-      case VideoFrameType::kJ420:
-        yuv_size = pixel_size + (pixel_size >> 1);
-        break;
-      case VideoFrameType::kI422:
-        [[fallthrough]];
-      case VideoFrameType::kJ422:
-        yuv_size = 2 * pixel_size;
-        break;
-      case VideoFrameType::kI444:
-        yuv_size = 3 * pixel_size;
-        break;
-    }
-    size_t frames_size = sizeof(SharedVideoYuvFrames) +
-                         sizeof(PackedVideoYuvFrame) * kNumberOfSharedFrames +
-                         yuv_size * kNumberOfSharedFrames;
-
-    HRESULT hr = shared_yuv_frames_.OpenMapping(
-        object_namer_.Get(kSharedVideoYuvFramesFileMappingName).data(),
-        frames_size);
-    if (FAILED(hr)) {
-      APP_ERROR() << "OpenMapping() failed with 0x" << std::hex << hr << '\n';
-      restart = true;
-      return hr;
-    }
+  int error_code = OpenSharedFrames();
+  if (0 != error_code) {
+    restart = true;
+    return error_code;
+  }
 
-    auto yuv_frames =
-        reinterpret_cast<SharedVideoYuvFrames*>(shared_yuv_frames_.GetData());
-    if (yuv_frames->data_size != sizeof(PackedVideoYuvFrame) + yuv_size) {
-      APP_ERROR() << "Invild data size " << yuv_frames->data_size
-                  << ", should be " << sizeof(PackedVideoYuvFrame) + yuv_size
-                  << '\n';
-      restart = true;
-      return -1;
-    }
+  {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    bitrate_ = requested_settings_.bitrate;
+    quality_ = requested_settings_.quality;
+    gop_ = requested_settings_.gop;
+    video_preset_ = requested_settings_.preset;
+    settings_changed_ = false;
   }
+  reopen_settings_.reset();
 
   const AVCodec* codec = nullptr;
-  error_code = AddStream(codec);
+  error_code = FindEncoder(codec);
   if (error_code < 0) {
     return error_code;
   }
 
-  AVDictionary* opts = nullptr;
-  av_dict_set(&opts, "movflags",
-              "frag_every_frame+dash+delay_moov+skip_sidx+skip_trailer", 0);
-  error_code = Open(codec, &opts);
-  av_dict_free(&opts);
+  output_type_ = saved_frame_info_.type;
+  error_code = Open(codec);
   if (error_code < 0) {
     return error_code;
   }
 
-  AVFrame* frame = nullptr;
-  error_code = InitializeFrame(frame);
+  skipped_frames_ = 0;
+  idle_frames_ = 0;
+  first_timestamp_ = 0;
+  last_pts_ = -1;
+  frames_since_keyframe_ = 0;
+  convert_timing_ = {};
+  damage_timing_ = {};
+  queue_timing_ = {};
+  encode_timing_ = {};
+  latency_.Reset();
+  BOOST_SCOPE_EXIT_ALL(this) {
+    StopPipeline();
+    ReportTiming();
+  };
+  error_code = StartPipeline();
   if (error_code < 0) {
-    APP_ERROR() << "Init frame failed with " << error_code << ".\n";
     return error_code;
   }
-  BOOST_SCOPE_EXIT_ALL(&frame) {
-    av_frame_free(&frame);
-  };
 
   for (;;) {
-    error_code = EncodeFrame(frame);
+    FrameRing::Slot* slot = frame_ring_.Acquire();
+    error_code = ConvertFrame(slot);
+    if (0 == error_code) {
+      frame_ring_.Push(slot);
+    } else {
+      frame_ring_.Release(slot);
+    }
 
-    wait = WaitForMultipleObjects(_countof(events), events, FALSE, INFINITE);
-    if (WAIT_OBJECT_0 == wait) {
+    wait = WaitForAny({&stop_event_, &shared_frame_ready_event_});
+    if (0 == wait) {
       ATLTRACE2(atlTraceUtil, 0, "%s: stopping.\n", __func__);
       return 0;
-    } else if (WAIT_OBJECT_0 + 1 != wait) {
-      APP_WARNING() << "Unexpected WaitForMultipleObjects() return " << wait
-                    << ".\n";
+    } else if (1 != wait) {
+      APP_WARNING() << "Unexpected WaitForAny() return " << wait << ".\n";
       return -1;
     }
 
@@ -239,8 +286,25 @@ int VideoEncoder::EncodingThread() {
         shared_frame_info->height != saved_frame_info_.height) {
       APP_INFO() << "Video dimension changed to " << shared_frame_info->width
                  << " * " << shared_frame_info->height << ".\n";
-      restart = true;
-      return 0;
+      if (!fixed_size_ || VideoFrameType::kNone == shared_frame_info->type) {
+        restart = true;
+        return 0;
+      }
+
+      // Keeps the encoder, the viewers see the new source letterboxed.
+      StopPipeline();
+      CloseSharedFrames();
+      saved_frame_info_ = *shared_frame_info;
+      error_code = OpenSharedFrames();
+      if (0 != error_code) {
+        restart = true;
+        return error_code;
+      }
+      error_code = StartPipeline();
+      if (error_code < 0) {
+        return error_code;
+      }
+      continue;
     }
     if (saved_frame_info_.format != shared_frame_info->format) {
       saved_frame_info_.format = shared_frame_info->format;
@@ -256,46 +320,188 @@ int VideoEncoder::EncodingThread() {
 void VideoEncoder::Free(bool wait_thread) {
   FreeHeader();
 
-  if (nullptr != started_event_) {
-    ResetEvent(started_event_);
+  if (started_event_) {
+    started_event_.Reset();
   }
-  if (nullptr != stop_event_) {
-    SetEvent(stop_event_);
+  if (stop_event_) {
+    stop_event_.Set();
   }
   if (wait_thread && thread_.joinable()) {
     thread_.join();
   }
 
+  StopPipeline();
+  sws_freeContext(sws_context_);
+  sws_context_ = nullptr;
+
+  // Frames referencing shared slots are released by both.
+  openh264_encoder_.Close();
+  avcodec_free_context(&codec_context_);
+  CloseSharedFrames();
+}
+
+int VideoEncoder::OpenSharedFrames() noexcept {
+  if (VideoFrameType::kTexture == saved_frame_info_.type) {
+    if (!record_directory_.empty()) {
+      APP_WARNING() << "Recording supports YUV frames only.\n";
+    }
+    auto ec = shared_texture_frames_.Open(
+        object_namer_.Get(kSharedVideoTextureFramesFileMappingName),
+        sizeof(SharedVideoTextureFrames));
+    if (ec) {
+      APP_ERROR() << "Open shared memory failed with " << ec.message() << '\n';
+      return ec.value();
+    }
+  } else {
+    size_t pixel_size = saved_frame_info_.width * saved_frame_info_.height;
+    size_t yuv_size;
+    switch (saved_frame_info_.type) {
+      case VideoFrameType::kI420:
+        [[fallthrough]];
+      case VideoFrameType::kJ420:
+        yuv_size = pixel_size + (pixel_size >> 1);
+        break;
+      case VideoFrameType::kI422:
+        [[fallthrough]];
+      case VideoFrameType::kJ422:
+        yuv_size = 2 * pixel_size;
+        break;
+      case VideoFrameType::kI444:
+        yuv_size = 3 * pixel_size;
+        break;
+    }
+    // The capturer chooses the number of frames, read the head first.
+    const auto name = object_namer_.Get(kSharedVideoYuvFramesFileMappingName);
+    auto ec = shared_yuv_frames_.Open(name, sizeof(SharedVideoYuvFrames));
+    if (ec) {
+      APP_ERROR() << "Open shared memory failed with " << ec.message() << '\n';
+      return ec.value();
+    }
+    auto yuv_frames = shared_yuv_frames_.As<SharedVideoYuvFrames>();
+    const std::uint32_t data_size = yuv_frames->data_size;
+    const std::uint32_t number_of_frames = yuv_frames->number_of_frames;
+    shared_yuv_frames_.Unmap();
+    if (data_size != sizeof(PackedVideoYuvFrame) + yuv_size) {
+      APP_ERROR() << "Invild data size " << data_size << ", should be "
+                  << sizeof(PackedVideoYuvFrame) + yuv_size << '\n';
+      return -1;
+    }
+    if (number_of_frames < 2 ||
+        kMaxNumberOfSharedYuvFrames < number_of_frames) {
+      APP_ERROR() << "Invild number of frames " << number_of_frames << '\n';
+      return -1;
+    }
+
+    ec = shared_yuv_frames_.Open(
+        name, GetSharedVideoYuvFramesSize(number_of_frames, data_size));
+    if (ec) {
+      APP_ERROR() << "Open shared memory failed with " << ec.message() << '\n';
+      return ec.value();
+    }
+
+    number_of_yuv_frames_ = number_of_frames;
+
+    // Left by an encoder which didn't stop cleanly.
+    yuv_frames = shared_yuv_frames_.As<SharedVideoYuvFrames>();
+    for (std::uint32_t i = 0; i < number_of_frames; ++i) {
+      auto expected = SharedFrameState::kReading;
+      yuv_frames->slots[i].state.compare_exchange_strong(
+          expected, SharedFrameState::kFree);
+    }
+
+    if (!record_directory_.empty()) {
+      StartRecording(data_size);
+    }
+  }
+  return 0;
+}
+
+void VideoEncoder::CloseSharedFrames() noexcept {
+  frame_recorder_.Close();
+
   staging_texture_.Release();
   for (auto& s : shared_textures_) {
     s.texture.Release();
   }
   shared_texture_frames_.Unmap();
-
   shared_yuv_frames_.Unmap();
+}
 
-  // TO-DO: Is it necessary to free stream_?
+int VideoEncoder::StartPipeline() noexcept {
+  assert(nullptr != codec_context_);
+  assert(!encode_thread_.joinable());
+
+  // Fits the source into the output, centered with the aspect ratio kept,
+  // on even pixels for the subsampled chroma.
+  const int width = static_cast<int>(saved_frame_info_.width);
+  const int height = static_cast<int>(saved_frame_info_.height);
+  const double scale =
+      std::min(static_cast<double>(codec_context_->width) / width,
+               static_cast<double>(codec_context_->height) / height);
+  placement_.width = std::min(codec_context_->width,
+                              static_cast<int>(width * scale + 0.5) & ~1);
+  placement_.height = std::min(codec_context_->height,
+                               static_cast<int>(height * scale + 0.5) & ~1);
+  placement_.x = ((codec_context_->width - placement_.width) / 2) & ~1;
+  placement_.y = ((codec_context_->height - placement_.height) / 2) & ~1;
+  if (width != codec_context_->width || height != codec_context_->height) {
+    APP_INFO() << "Video source " << width << " * " << height
+               << " is scaled to " << placement_.width << " * "
+               << placement_.height << " at (" << placement_.x << ", "
+               << placement_.y << ").\n";
+  }
 
-  avcodec_free_context(&codec_context_);
-  if (nullptr != format_context_) {
-    // int error = av_write_trailer(format_context_);
-    // if (error < 0) {
-    //  ATLTRACE2(atlTraceException, 0, "!av_write_trailer(), #%d, %s\n", error,
-    //            GetAvErrorText(error));
-    //}
-    if (nullptr != format_context_->opaque) {
-      av_free(format_context_->opaque);
-      format_context_->opaque = nullptr;
+  // The encoder may keep referencing a frame after it is encoded, so shared
+  // frames are copied if their mapping may go away before the encoder.
+  wraps_shared_frames_ = !fixed_size_ &&
+                         VideoFrameType::kTexture != saved_frame_info_.type &&
+                         width == codec_context_->width &&
+                         height == codec_context_->height;
+  if (!wraps_shared_frames_ &&
+      VideoFrameType::kTexture != saved_frame_info_.type) {
+    source_frame_ = av_frame_alloc();
+    if (nullptr == source_frame_) {
+      return AVERROR(ENOMEM);
     }
-    avio_context_free(&format_context_->pb);
-    avformat_free_context(format_context_);
-    format_context_ = nullptr;
+    source_frame_->format = GetPixelFormat(saved_frame_info_.type);
+    source_frame_->color_range = GetColorRange(saved_frame_info_.type);
+    source_frame_->width = width;
+    source_frame_->height = height;
   }
+
+  int error_code = frame_ring_.Initialize(
+      kPipelineDepth,
+      [this](AVFrame*& frame) { return InitializeFrame(frame); });
+  if (error_code < 0) {
+    APP_ERROR() << "Init frame failed with " << error_code << ".\n";
+    av_frame_free(&source_frame_);
+    return error_code;
+  }
+
+  damage_detector_.Reset(saved_frame_info_.width, saved_frame_info_.height);
+  encode_thread_ = std::thread(&VideoEncoder::EncodeStageThread, this);
+  return 0;
 }
 
-int VideoEncoder::AddStream(const AVCodec*& codec) {
+void VideoEncoder::StopPipeline() noexcept {
+  if (!encode_thread_.joinable()) {
+    return;
+  }
+  frame_ring_.Stop();
+  encode_thread_.join();
+  frame_ring_.Free();
+  av_frame_free(&source_frame_);
+}
+
+int VideoEncoder::FindEncoder(const AVCodec*& codec) {
   assert(nullptr == codec_context_);
 
+  // OpenH264Encoder only takes the parameters of a codec context.
+  if (UsesOpenH264()) {
+    codec = nullptr;
+    return 0;
+  }
+
   const char* codec_name = nullptr;
   if (AV_CODEC_ID_H264 == GetCodecID()) {
     switch (hardware_encoder_) {
@@ -327,6 +533,21 @@ int VideoEncoder::AddStream(const AVCodec*& codec) {
         codec_name = "libx265";
         break;
     }
+  } else if (AV_CODEC_ID_AV1 == GetCodecID()) {
+    switch (hardware_encoder_) {
+      case HardwareEncoder::AMF:
+        codec_name = "av1_amf";
+        break;
+      case HardwareEncoder::NVENC:
+        codec_name = "av1_nvenc";
+        break;
+      case HardwareEncoder::QSV:
+        codec_name = "av1_qsv";
+        break;
+      default:
+        codec_name = "libsvtav1";
+        break;
+    }
   } else {
     assert(false);
   }
@@ -335,38 +556,51 @@ int VideoEncoder::AddStream(const AVCodec*& codec) {
     APP_ERROR() << "Could not find encoder for " << codec_name << ".\n";
     return -1;
   }
-  stream_ = avformat_new_stream(format_context_, nullptr);
-  if (nullptr == stream_) {
-    APP_ERROR() << "Could not allocate stream for " << codec_name << ".\n";
-    return -1;
-  }
-  stream_->id = format_context_->nb_streams - 1;
-  stream_->codecpar->codec_tag = 0;
-
   return 0;
 }
 
-int VideoEncoder::Open(const AVCodec* codec, AVDictionary** opts) {
+int VideoEncoder::Open(const AVCodec* codec, int width, int height) {
   assert(nullptr == codec_context_);
-  assert(nullptr != stream_);
+
+  parameter_sets_.clear();
 
   codec_context_ = avcodec_alloc_context3(codec);
   if (nullptr == codec_context_) {
-    APP_ERROR() << "Could not allocate codec context for " << codec->name
-                << ".\n";
+    APP_ERROR() << "Could not allocate codec context.\n";
     return -1;
   }
 
   codec_context_->thread_count = 1;
+  if (HardwareEncoder::None == hardware_encoder_) {
+    codec_context_->thread_count = threads_;
+    codec_context_->thread_type = FF_THREAD_SLICE;
+    codec_context_->slices = slices_;
+  }
   codec_context_->bit_rate = bitrate_;
   codec_context_->width = saved_frame_info_.width;
   codec_context_->height = saved_frame_info_.height;
-  stream_->time_base = {1, kH264TimeBase};
-  codec_context_->time_base = stream_->time_base;
+  if (0 != width && 0 != height) {
+    codec_context_->width = width;
+    codec_context_->height = height;
+  } else if (0 != output_width_ && 0 != output_height_) {
+    codec_context_->width = output_width_;
+    codec_context_->height = output_height_;
+  } else if (1.0 != scale_) {
+    // Even for the subsampled chroma.
+    codec_context_->width =
+        std::max(2, static_cast<int>(saved_frame_info_.width * scale_) & ~1);
+    codec_context_->height =
+        std::max(2, static_cast<int>(saved_frame_info_.height * scale_) & ~1);
+  }
+  codec_context_->time_base = kTimeBase;
+  if (AV_CODEC_ID_AV1 == GetCodecID()) {
+    codec_context_->framerate = kNominalFrameRate;
+  }
   codec_context_->max_b_frames = 0;
   codec_context_->gop_size = gop_;
 
-  switch (saved_frame_info_.type) {
+  // The source may have changed since, in fixed size mode.
+  switch (output_type_) {
     case VideoFrameType::kI420:
       [[fallthrough]];
     case VideoFrameType::kTexture:
@@ -396,8 +630,18 @@ int VideoEncoder::Open(const AVCodec* codec, AVDictionary** opts) {
   }
   codec_context_->codec_id = GetCodecID();
   codec_context_->flags |= AV_CODEC_FLAG_LOW_DELAY;
-  if (format_context_->oformat->flags & AVFMT_GLOBALHEADER) {
-    codec_context_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+  if (intra_refresh_ && (HardwareEncoder::AMF == hardware_encoder_ ||
+                         HardwareEncoder::QSV == hardware_encoder_ ||
+                         (HardwareEncoder::None == hardware_encoder_ &&
+                          AV_CODEC_ID_AV1 == GetCodecID()) ||
+                         UsesOpenH264())) {
+    APP_WARNING() << "Intra refresh is not supported by AMF, QSV, libsvtav1 "
+                     "and OpenH264.\n";
+  }
+  if (UsesOpenH264()) {
+    return openh264_encoder_.Open(codec_context_, temporal_layers_, threads_,
+                                  slices_, quality_);
   }
 
   auto quality = std::to_string(quality_);
@@ -419,7 +663,8 @@ int VideoEncoder::Open(const AVCodec* codec, AVDictionary** opts) {
       av_opt_set(codec_context_->priv_data, "profile", "main", 0);
       av_opt_set(codec_context_->priv_data, "delay", "0", 0);
       av_opt_set(codec_context_->priv_data, "forced-idr", "1", 0);
-      if (AV_CODEC_ID_H264 == GetCodecID()) {
+      if (AV_CODEC_ID_H264 == GetCodecID() ||
+          AV_CODEC_ID_AV1 == GetCodecID()) {
         av_opt_set(codec_context_->priv_data, "rc", "vbr", 0);
         av_opt_set(codec_context_->priv_data, "cq", quality.data(), 0);
       } else if (AV_CODEC_ID_HEVC == GetCodecID()) {
@@ -427,6 +672,9 @@ int VideoEncoder::Open(const AVCodec* codec, AVDictionary** opts) {
       }
       av_opt_set(codec_context_->priv_data, "tune", "ull", 0);
       av_opt_set(codec_context_->priv_data, "zerolatency", "1", 0);
+      if (intra_refresh_) {
+        av_opt_set(codec_context_->priv_data, "intra-refresh", "1", 0);
+      }
       break;
     case HardwareEncoder::QSV:
       // TO-DO
@@ -438,15 +686,51 @@ int VideoEncoder::Open(const AVCodec* codec, AVDictionary** opts) {
       }
       break;
     default:
+      if (AV_CODEC_ID_AV1 == GetCodecID()) {
+        // Low delay prediction without lookahead, each frame comes out
+        // before the next goes in. Older libsvtav1 warns about rtc and goes
+        // on. The pool of libsvtav1 ignores thread_count.
+        quality = std::to_string(quality_ * kSvtAv1MaxCrf / kQpRange);
+        av_opt_set(codec_context_->priv_data, "preset", video_preset_.data(),
+                   0);
+        av_opt_set(codec_context_->priv_data, "crf", quality.data(), 0);
+        av_opt_set(codec_context_->priv_data, "svtav1-params",
+                   "pred-struct=1:rtc=1", 0);
+        break;
+      }
       av_opt_set(codec_context_->priv_data, "preset", video_preset_.data(), 0);
       av_opt_set(codec_context_->priv_data, "crf", quality.data(), 0);
       av_opt_set(codec_context_->priv_data, "forced-idr", "1", 0);
       av_opt_set(codec_context_->priv_data, "tune", "zerolatency", 0);
 
+      // Both skip regions of interest without adaptive quantization, which
+      // the ultrafast preset turns off.
       if (AV_CODEC_ID_H264 == GetCodecID()) {
         av_opt_set(codec_context_->priv_data, "profile", "baseline", 0);
+        if (intra_refresh_) {
+          av_opt_set(codec_context_->priv_data, "intra-refresh", "1", 0);
+        }
+        if (UsesRegionsOfInterest()) {
+          av_opt_set(codec_context_->priv_data, "aq-mode", "1", 0);
+        }
       } else if (AV_CODEC_ID_HEVC == GetCodecID()) {
         av_opt_set(codec_context_->priv_data, "profile", "main", 0);
+        // libx265 ignores thread_count and slices, its pool runs wavefronts
+        // within a frame.
+        std::string params = "frame-threads=1";
+        if (0 != threads_) {
+          params += ":pools=" + std::to_string(threads_);
+        }
+        if (0 != slices_) {
+          params += ":slices=" + std::to_string(slices_);
+        }
+        if (intra_refresh_) {
+          params += ":intra-refresh=1";
+        }
+        if (UsesRegionsOfInterest()) {
+          params += ":aq-mode=1";
+        }
+        av_opt_set(codec_context_->priv_data, "x265-params", params.data(), 0);
       }
       break;
   }
@@ -458,29 +742,28 @@ int VideoEncoder::Open(const AVCodec* codec, AVDictionary** opts) {
     return error;
   }
 
-  error = avcodec_parameters_from_context(stream_->codecpar, codec_context_);
-  if (error < 0) {
-    ATLTRACE2(atlTraceException, 0,
-              "!avcodec_parameters_from_context(), #%d, %s\n", error,
-              GetAvErrorText(error));
-    return error;
-  }
-  auto buffer = av_malloc(kInitialBufferSize);
-  if (nullptr == buffer) {
-    return AVERROR(ENOMEM);
-  }
-  format_context_->opaque = buffer;
-  format_context_->pb = avio_alloc_context(
-      reinterpret_cast<uint8_t*>(buffer), kInitialBufferSize, 1,
-      static_cast<Encoder*>(this), nullptr, Engine::OnWriteHeader, nullptr);
-  error = avformat_write_header(format_context_, opts);
-  if (error < 0) {
-    ATLTRACE2(atlTraceException, 0, "!avformat_write_header(), #%d, %s\n",
-              error, GetAvErrorText(error));
-    return error;
+  // Raw streams carry the parameter sets in band, unless the encoder exports
+  // them, which are then sent before the first frame. The sessions keep the
+  // header they have, so a reopened encoder sends its own parameter sets in
+  // band if they differ.
+  if (0 < codec_context_->extradata_size) {
+    const std::span extradata(
+        codec_context_->extradata,
+        static_cast<std::size_t>(codec_context_->extradata_size));
+    const std::string& header = GetHeader();
+    if (header.empty()) {
+      SaveHeader(extradata);
+    } else if (!std::equal(
+                   extradata.begin(), extradata.end(),
+                   header.begin() + sizeof(regame::PackageHead) +
+                       GetPacketHeadSize(),
+                   header.end(), [](std::uint8_t a, char b) {
+                     return a == static_cast<std::uint8_t>(b);
+                   })) {
+      parameter_sets_.assign(extradata.begin(), extradata.end());
+    }
   }
-  format_context_->pb->write_packet = Engine::OnWritePacket;
-  return error;
+  return 0;
 }
 
 int VideoEncoder::InitializeFrame(AVFrame*& frame) const noexcept {
@@ -493,25 +776,9 @@ int VideoEncoder::InitializeFrame(AVFrame*& frame) const noexcept {
     return AVERROR(ENOMEM);
   }
 
-  switch (saved_frame_info_.type) {
-    case VideoFrameType::kJ420:
-      frame->color_range = AVCOL_RANGE_JPEG;
-      [[fallthrough]];
-    case VideoFrameType::kI420:
-      [[fallthrough]];
-    case VideoFrameType::kTexture:
-      frame->format = AV_PIX_FMT_YUV420P;
-      break;
-    case VideoFrameType::kJ422:
-      frame->color_range = AVCOL_RANGE_JPEG;
-      [[fallthrough]];
-    case VideoFrameType::kI422:
-      frame->format = AV_PIX_FMT_YUV422P;
-      break;
-    case VideoFrameType::kI444:
-      frame->format = AV_PIX_FMT_YUV444P;
-      break;
-  }
+  // The source may have changed since, in fixed size mode.
+  frame->format = GetPixelFormat(output_type_);
+  frame->color_range = GetColorRange(output_type_);
   frame->width = codec_context_->width;
   frame->height = codec_context_->height;
   frame->pict_type = AV_PICTURE_TYPE_NONE;
@@ -521,29 +788,61 @@ int VideoEncoder::InitializeFrame(AVFrame*& frame) const noexcept {
     av_frame_free(&frame);
     ATLTRACE2(atlTraceException, 0, "!av_frame_get_buffer(), #%d, %s\n",
               error_code, GetAvErrorText(error_code));
+    return error_code;
   }
-  return error_code;
+
+  // Scaling leaves the letterbox as it is.
+  std::array<std::ptrdiff_t, 4> linesize{};
+  std::copy_n(frame->linesize, linesize.size(), linesize.begin());
+  av_image_fill_black(frame->data, linesize.data(),
+                      static_cast<AVPixelFormat>(frame->format),
+                      frame->color_range, frame->width, frame->height);
+  return 0;
 }
 
-int VideoEncoder::EncodeFrame(AVFrame* frame) noexcept {
-  assert(nullptr != codec_context_);
-  assert(nullptr != frame);
-  assert(nullptr != shared_frame_info_);
-  assert(nullptr != shared_frame_info_);
+void VideoEncoder::EncodeStageThread() {
+  for (;;) {
+    FrameRing::Slot* slot = frame_ring_.Pop();
+    if (nullptr == slot) {
+      ATLTRACE2(atlTraceUtil, 0, "%s: stopping.\n", __func__);
+      return;
+    }
+    EncodeYuvFrame(slot);
+    if (wraps_shared_frames_) {
+      // Gives the shared slot back as soon as possible, the frame keeps its
+      // shape for the next WrapYuvFrame().
+      ReleaseFrameBuffers(slot->frame);
+    }
+    frame_ring_.Release(slot);
+  }
+}
 
+int VideoEncoder::ConvertFrame(FrameRing::Slot* slot) noexcept {
+  assert(nullptr != slot);
+  assert(shared_frame_info_);
   assert(VideoFrameType::kNone != saved_frame_info_.type);
 
-  if (produce_keyframe_) {
-    produce_keyframe_ = false;
-    frame->pict_type = AV_PICTURE_TYPE_I;
-  } else {
-    frame->pict_type = AV_PICTURE_TYPE_NONE;
+  if (SkipIdle()) {
+    return ERROR_NO_DATA;
   }
 
-  int error_code = 0;
+  LARGE_INTEGER convert_start;
+  QueryPerformanceCounter(&convert_start);
+
+  AVFrame* frame = slot->frame;
+  std::uint64_t capture_timestamp = 0;
   if (VideoFrameType::kTexture == saved_frame_info_.type) {
-    assert(nullptr != shared_texture_frames_);
-    HRESULT hr = GetSharedTexture();
+    assert(shared_texture_frames_);
+    // The encoder may still reference the buffer of the last frame sent from
+    // this slot.
+    int error_code = av_frame_make_writable(frame);
+    if (error_code < 0) {
+      ATLTRACE2(atlTraceException, 0, "!av_frame_make_writable(), #%d, %s\n",
+                error_code, GetAvErrorText(error_code));
+      return error_code;
+    }
+
+    HRESULT hr = GetSharedTexture(capture_timestamp);
     if (FAILED(hr)) {
       ATLTRACE2(atlTraceException, 0, "!GetSharedTexture(), #0x%08X\n", hr);
       return hr;
@@ -566,69 +865,384 @@ int VideoEncoder::EncodeFrame(AVFrame* frame) noexcept {
       staging_surface->Unmap();
     };
 
-    uint32_t width = saved_frame_info_.width;
-    uint32_t height = saved_frame_info_.height;
-    size_t pixel_size = width * height;
-
-    const int uv_stride = width >> 1;
-    uint8_t* y = yuv_frame_data_.data();
-    uint8_t* u = y + pixel_size;
-    uint8_t* v = u + (pixel_size >> 2);
-
-    {
-      // TO-DO: Texture is alwayse convert to YUV420P now!
-      if (DXGI_FORMAT_R8G8B8A8_UNORM == saved_frame_info_.format) {
-        ABGRToI420(mapped_rect.pBits, mapped_rect.Pitch, y, width, u, uv_stride,
-                   v, uv_stride, width, height);
-      } else if (DXGI_FORMAT_B8G8R8A8_UNORM == saved_frame_info_.format) {
-        ARGBToI420(mapped_rect.pBits, mapped_rect.Pitch, y, width, u, uv_stride,
-                   v, uv_stride, width, height);
-      } else {
-        ATLTRACE2(atlTraceException, 0, "Unsupported format %u.",
-                  saved_frame_info_.format);
+    const DamageDetector::Plane plane{
+        mapped_rect.pBits, mapped_rect.Pitch, 4 * saved_frame_info_.width,
+        saved_frame_info_.height, 4 * DamageDetector::kTileSize,
+        DamageDetector::kTileSize};
+    if (SkipUnchanged({&plane, 1}, slot)) {
+      return ERROR_NO_DATA;
+    }
+
+    const bool is_scaled =
+        placement_.width != frame->width ||
+        placement_.height != frame->height ||
+        AV_PIX_FMT_YUV420P != frame->format;
+    if (is_scaled) {
+      const AVPixelFormat format =
+          DXGI_FORMAT_R8G8B8A8_UNORM == saved_frame_info_.format
+              ? AV_PIX_FMT_RGBA
+              : AV_PIX_FMT_BGRA;
+      const std::uint8_t* const data[4]{mapped_rect.pBits};
+      const int linesize[4]{mapped_rect.Pitch};
+      int error_code = ScaleFrame(data, linesize, format, frame);
+      if (error_code < 0) {
         return error_code;
       }
+    } else if (DXGI_FORMAT_R8G8B8A8_UNORM == saved_frame_info_.format) {
+      ABGRToI420(mapped_rect.pBits, mapped_rect.Pitch, frame->data[0],
+                 frame->linesize[0], frame->data[1], frame->linesize[1],
+                 frame->data[2], frame->linesize[2], frame->width,
+                 frame->height);
+    } else if (DXGI_FORMAT_B8G8R8A8_UNORM == saved_frame_info_.format) {
+      ARGBToI420(mapped_rect.pBits, mapped_rect.Pitch, frame->data[0],
+                 frame->linesize[0], frame->data[1], frame->linesize[1],
+                 frame->data[2], frame->linesize[2], frame->width,
+                 frame->height);
+    } else {
+      ATLTRACE2(atlTraceException, 0, "Unsupported format %u.",
+                saved_frame_info_.format);
+      return ERROR_NOT_SUPPORTED;
+    }
+  } else if (wraps_shared_frames_) {
+    int error_code = WrapYuvFrame(frame, capture_timestamp);
+    if (0 != error_code) {
+      return error_code;
+    }
+    if (SkipUnchanged(GetPlanes(frame), slot)) {
+      // Gives the shared slot back.
+      ReleaseFrameBuffers(frame);
+      return ERROR_NO_DATA;
     }
-    error_code = EncodeYuvFrame(frame, yuv_frame_data_.data());
   } else {
-    assert(nullptr != shared_yuv_frames_);
-    auto yuv_frames =
-        reinterpret_cast<SharedVideoYuvFrames*>(shared_yuv_frames_.GetData());
-    auto yuv_frame = reinterpret_cast<PackedVideoYuvFrame*>(yuv_frames->data);
-    auto yuv_frame1 = reinterpret_cast<PackedVideoYuvFrame*>(
-        yuv_frames->data + yuv_frames->data_size);
+    int error_code = av_frame_make_writable(frame);
+    if (error_code < 0) {
+      ATLTRACE2(atlTraceException, 0, "!av_frame_make_writable(), #%d, %s\n",
+                error_code, GetAvErrorText(error_code));
+      return error_code;
+    }
+    error_code = WrapYuvFrame(source_frame_, capture_timestamp);
+    if (0 != error_code) {
+      return error_code;
+    }
+    BOOST_SCOPE_EXIT_ALL(this) {
+      ReleaseFrameBuffers(source_frame_);
+    };
+    if (SkipUnchanged(GetPlanes(source_frame_), slot)) {
+      return ERROR_NO_DATA;
+    }
+    error_code = ScaleFrame(source_frame_->data, source_frame_->linesize,
+                            static_cast<AVPixelFormat>(source_frame_->format),
+                            frame);
+    if (error_code < 0) {
+      return error_code;
+    }
+  }
+
+  // Timed by the capture, on the performance counter, so that the jitter of
+  // converting and queuing does not reach the timestamps.
+  const std::uint64_t timestamp =
+      0 != capture_timestamp ? capture_timestamp : convert_start.QuadPart;
+  if (0 == first_timestamp_) {
+    first_timestamp_ = timestamp;
+  }
+  int64_t pts = av_rescale(
+      static_cast<int64_t>(timestamp - first_timestamp_), kTimeBase.den,
+      g_app.GetFrequency().QuadPart * kTimeBase.num);
+  // Strictly increasing, even if the capturer repeats a timestamp.
+  pts = std::max(pts, last_pts_ + 1);
+  last_pts_ = pts;
+  frame->pts = pts;
 
-    if (yuv_frame->stats.timestamp < yuv_frame1->stats.timestamp) {
-      yuv_frame = yuv_frame1;
+  LARGE_INTEGER convert_end;
+  QueryPerformanceCounter(&convert_end);
+  slot->capture_timestamp = capture_timestamp;
+  slot->convert_start = convert_start.QuadPart;
+  slot->convert_end = convert_end.QuadPart;
+  convert_timing_.Add(convert_end.QuadPart - convert_start.QuadPart);
+  if (0 != capture_timestamp) {
+    latency_.convert_start.Add(
+        g_app.TicksToMicroseconds(convert_start.QuadPart - capture_timestamp));
+    latency_.convert_end.Add(
+        g_app.TicksToMicroseconds(convert_end.QuadPart - capture_timestamp));
+  }
+  return 0;
+}
+
+int VideoEncoder::WrapYuvFrame(AVFrame* frame,
+                               std::uint64_t& capture_timestamp) noexcept {
+  assert(shared_yuv_frames_);
+  auto yuv_frames = shared_yuv_frames_.As<SharedVideoYuvFrames>();
+  const std::uint32_t index =
+      AcquireSharedFrameToRead(yuv_frames, number_of_yuv_frames_);
+  if (number_of_yuv_frames_ == index) {
+    // Nothing new since the last frame.
+    return ERROR_NO_DATA;
+  }
+  auto yuv_frame = GetPackedVideoYuvFrame(yuv_frames, index);
+  ATLTRACE2(atlTraceUtil, 0, "latest video frame %llu, sequence %llu\n",
+            yuv_frame->stats.timestamp,
+            yuv_frames->slots[index].sequence.load());
+  capture_timestamp = yuv_frame->stats.timestamp;
+  if (frame_recorder_.IsOpen()) {
+    frame_recorder_.Write(yuv_frame);
+  }
+
+  // Zero-copy, the frame references the shared slot, which goes back to the
+  // capturer once the encoder and the ring are done with it.
+  ReleaseFrameBuffers(frame);
+  frame->buf[0] = av_buffer_create(
+      yuv_frame->data, yuv_frames->data_size - sizeof(PackedVideoYuvFrame),
+      [](void* opaque, uint8_t* data) {
+        ReleaseSharedFrame(*static_cast<SharedFrameSlot*>(opaque));
+      },
+      &yuv_frames->slots[index], AV_BUFFER_FLAG_READONLY);
+  if (nullptr == frame->buf[0]) {
+    ReleaseSharedFrame(yuv_frames->slots[index]);
+    return AVERROR(ENOMEM);
+  }
+
+  int error_code = av_image_fill_arrays(
+      frame->data, frame->linesize, yuv_frame->data,
+      static_cast<AVPixelFormat>(frame->format), frame->width, frame->height,
+      1);
+  if (error_code < 0) {
+    ATLTRACE2(atlTraceException, 0, "!av_image_fill_arrays(), #%d, %s\n",
+              error_code, GetAvErrorText(error_code));
+    ReleaseFrameBuffers(frame);
+    return error_code;
+  }
+  return 0;
+}
+
+// Also updates the changed tiles of slot.
+bool VideoEncoder::SkipUnchanged(std::span<const DamageDetector::Plane> planes,
+                                 FrameRing::Slot* slot) noexcept {
+  if (0 == refresh_interval_.count() && !UsesRegionsOfInterest()) {
+    return false;
+  }
+
+  LARGE_INTEGER damage_start;
+  QueryPerformanceCounter(&damage_start);
+  const std::uint32_t changed_tiles =
+      damage_detector_.Update(planes, slot->changed_tiles);
+  LARGE_INTEGER damage_end;
+  QueryPerformanceCounter(&damage_end);
+  damage_timing_.Add(damage_end.QuadPart - damage_start.QuadPart);
+
+  const auto now = std::chrono::steady_clock::now();
+  if (0 == changed_tiles && !produce_keyframe_ &&
+      0 != refresh_interval_.count() &&
+      now - last_pushed_time_ < refresh_interval_) {
+    ++skipped_frames_;
+    return true;
+  }
+  last_pushed_time_ = now;
+  return false;
+}
+
+// Leaves the shared frames skipped to the capturer, unread.
+bool VideoEncoder::SkipIdle() noexcept {
+  if (!idle_ || 0 == idle_interval_.count()) {
+    return false;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (now - last_idle_time_ < idle_interval_) {
+    ++idle_frames_;
+    return true;
+  }
+  last_idle_time_ = now;
+  return false;
+}
+
+int VideoEncoder::ScaleFrame(const std::uint8_t* const data[],
+                             const int linesize[],
+                             AVPixelFormat format,
+                             AVFrame* frame) noexcept {
+  int shift_x = 0;
+  int shift_y = 0;
+  av_pix_fmt_get_chroma_sub_sample(static_cast<AVPixelFormat>(frame->format),
+                                   &shift_x, &shift_y);
+  std::uint8_t* destination[4]{};
+  for (int i = 0; i < 3; ++i) {
+    const int x = 0 == i ? placement_.x : placement_.x >> shift_x;
+    const int y = 0 == i ? placement_.y : placement_.y >> shift_y;
+    destination[i] = frame->data[i] + y * frame->linesize[i] + x;
+  }
+
+  // Downscaling textures is fused with the conversion, which saves
+  // converting the full size first.
+  if ((AV_PIX_FMT_BGRA == format || AV_PIX_FMT_RGBA == format) &&
+      AV_PIX_FMT_YUV420P == frame->format) {
+    auto scale_to_i420 =
+        AV_PIX_FMT_RGBA == format ? ABGRScaleToI420 : ARGBScaleToI420;
+    // Fails if not a downscale.
+    if (0 == scale_to_i420(data[0], linesize[0], saved_frame_info_.width,
+                           saved_frame_info_.height, destination[0],
+                           frame->linesize[0], destination[1],
+                           frame->linesize[1], destination[2],
+                           frame->linesize[2], placement_.width,
+                           placement_.height)) {
+      return 0;
     }
-    ATLTRACE2(atlTraceUtil, 0, "latest video frame %llu\n",
-              yuv_frame->stats.timestamp);
-    error_code = EncodeYuvFrame(frame, yuv_frame->data);
   }
-  return error_code;
+
+  sws_context_ = sws_getCachedContext(
+      sws_context_, saved_frame_info_.width, saved_frame_info_.height, format,
+      placement_.width, placement_.height,
+      static_cast<AVPixelFormat>(frame->format), SWS_FAST_BILINEAR, nullptr,
+      nullptr, nullptr);
+  if (nullptr == sws_context_) {
+    ATLTRACE2(atlTraceException, 0, "!sws_getCachedContext()\n");
+    return AVERROR(EINVAL);
+  }
+
+  int error_code =
+      sws_scale(sws_context_, data, linesize, 0, saved_frame_info_.height,
+                destination, frame->linesize);
+  if (error_code < 0) {
+    ATLTRACE2(atlTraceException, 0, "!sws_scale(), #%d, %s\n", error_code,
+              GetAvErrorText(error_code));
+    return error_code;
+  }
+  return 0;
 }
 
-int VideoEncoder::EncodeYuvFrame(AVFrame* frame, const uint8_t* yuv) noexcept {
-  av_image_fill_arrays(frame->data, frame->linesize, yuv,
-                       static_cast<AVPixelFormat>(frame->format), frame->width,
-                       frame->height, 1);
+void VideoEncoder::ReleaseFrameBuffers(AVFrame* frame) noexcept {
+  for (auto& buf : frame->buf) {
+    av_buffer_unref(&buf);
+  }
+}
 
-  int64_t pts = 0;
-  using namespace std::chrono;
-  auto now = steady_clock::now();
-  if (steady_clock::duration::zero() == startup_time_.time_since_epoch()) {
-    startup_time_ = now;
+// Runs of changed tiles in each row of tiles come first, as the first region
+// wins where regions overlap, then the whole frame for the unchanged tiles.
+int VideoEncoder::AddRegionsOfInterest(
+    AVFrame* frame,
+    const std::vector<std::uint8_t>& changed_tiles) const noexcept {
+  const std::uint32_t columns = damage_detector_.GetColumns();
+  const std::uint32_t rows = damage_detector_.GetRows();
+  if (changed_tiles.size() != static_cast<std::size_t>(columns) * rows) {
+    return 0;
+  }
+
+  std::size_t runs = 0;
+  for (std::size_t i = 0; i < changed_tiles.size(); ++i) {
+    if (changed_tiles[i] && (0 == i % columns || !changed_tiles[i - 1])) {
+      ++runs;
+    }
+  }
+  AVFrameSideData* side_data =
+      av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                             (runs + 1) * sizeof(AVRegionOfInterest));
+  if (nullptr == side_data) {
+    return AVERROR(ENOMEM);
+  }
+
+  // Tiles are on the source, which may be scaled into the frame.
+  constexpr int kTileSize = DamageDetector::kTileSize;
+  const auto to_x = [this](std::uint32_t x) {
+    x = std::min(x, saved_frame_info_.width);
+    return placement_.x + static_cast<int>(std::uint64_t{x} * placement_.width /
+                                           saved_frame_info_.width);
+  };
+  const auto to_y = [this](std::uint32_t y) {
+    y = std::min(y, saved_frame_info_.height);
+    return placement_.y +
+           static_cast<int>(std::uint64_t{y} * placement_.height /
+                            saved_frame_info_.height);
+  };
+  auto regions = reinterpret_cast<AVRegionOfInterest*>(side_data->data);
+  std::size_t count = 0;
+  for (std::uint32_t row = 0; row < rows; ++row) {
+    const std::uint8_t* changed = changed_tiles.data() + row * columns;
+    for (std::uint32_t column = 0; column < columns; ++column) {
+      if (!changed[column]) {
+        continue;
+      }
+      const int right = to_x((column + 1) * kTileSize);
+      if (0 != column && changed[column - 1]) {
+        regions[count - 1].right = right;
+        continue;
+      }
+      regions[count++] = {sizeof(AVRegionOfInterest),
+                          to_y(row * kTileSize),
+                          to_y((row + 1) * kTileSize),
+                          to_x(column * kTileSize),
+                          right,
+                          {-roi_qp_offset_, kQpRange}};
+    }
+  }
+  regions[count] = {sizeof(AVRegionOfInterest), 0, frame->height, 0,
+                    frame->width, {roi_qp_offset_, kQpRange}};
+  return 0;
+}
+
+int VideoEncoder::EncodeYuvFrame(FrameRing::Slot* slot) noexcept {
+  assert(nullptr != slot);
+  // Only after Reopen() failed, until the encoder restarts.
+  if (nullptr == codec_context_) {
+    return AVERROR(EINVAL);
+  }
+
+  if (settings_changed_) {
+    ApplySettings();
+  }
+
+  // Decided here rather than in the conversion stage, as frames waiting in
+  // the ring may be dropped. With intra refresh the request stays pending
+  // until the next sweep starts, which also keeps unchanged frames from being
+  // skipped.
+  AVFrame* frame = slot->frame;
+  if (produce_keyframe_ && !RefreshesOnRequest()) {
+    produce_keyframe_ = false;
+    frame->pict_type = AV_PICTURE_TYPE_I;
   } else {
-    using FpSeconds =
-        std::chrono::duration<float, std::chrono::seconds::period>;
-    static_assert(std::chrono::treat_as_floating_point<FpSeconds::rep>::value,
-                  "Rep required to be floating point");
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+  }
 
-    pts = static_cast<int64_t>(
-        duration_cast<FpSeconds>(now - startup_time_).count() /
-        av_q2d(stream_->time_base));
+  // A new encoder starts with a keyframe, so it takes over where the old one
+  // would have sent a keyframe anyway.
+  if (reopen_settings_ && (AV_PICTURE_TYPE_I == frame->pict_type ||
+                           gop_ <= frames_since_keyframe_ + 1)) {
+    int error_code = Reopen();
+    if (error_code < 0) {
+      return error_code;
+    }
+    frame->pict_type = AV_PICTURE_TYPE_I;
   }
-  frame->pts = pts;
+
+  av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+  // Not on keyframes, as the following frames skip the unchanged tiles,
+  // which would keep a coarse quality until the next keyframe.
+  if (UsesRegionsOfInterest() && AV_PICTURE_TYPE_I != frame->pict_type &&
+      frames_since_keyframe_ + 1 < gop_) {
+    int error_code = AddRegionsOfInterest(frame, slot->changed_tiles);
+    if (error_code < 0) {
+      ATLTRACE2(atlTraceException, 0, "%s: !AddRegionsOfInterest(), #%d.\n",
+                __func__, error_code);
+    }
+  }
+
+  LARGE_INTEGER encode_start;
+  QueryPerformanceCounter(&encode_start);
+  queue_timing_.Add(encode_start.QuadPart - slot->convert_end);
+  frame_info_.frame_id = ++frame_id_;
+  frame_info_.capture_timestamp = slot->capture_timestamp;
+
+  if (UsesOpenH264()) {
+    OpenH264Encoder::Packet packet;
+    int error_code = openh264_encoder_.Encode(
+        frame, AV_PICTURE_TYPE_I == frame->pict_type, packet);
+    if (error_code < 0) {
+      return error_code;
+    }
+    if (!packet.data.empty()) {
+      WriteEncoded(packet.data, packet.is_keyframe, packet.temporal_id,
+                   encode_start.QuadPart);
+    }
+    return 0;
+  }
+
   int error_code = avcodec_send_frame(codec_context_, frame);
   if (error_code < 0) {
     ATLTRACE2(atlTraceException, 0, "%s: !avcodec_send_frame(), #%d, %s.\n",
@@ -656,24 +1270,121 @@ int VideoEncoder::EncodeYuvFrame(AVFrame* frame, const uint8_t* yuv) noexcept {
       av_packet_unref(packet);
     };
 
-    packet->stream_index = stream_->index;
-    written = av_write_frame(format_context_, packet);
-    // flush the buffer.
-    av_write_frame(format_context_, nullptr);
+    written = WriteEncoded(
+        std::span(packet->data, static_cast<std::size_t>(packet->size)),
+        0 != (packet->flags & AV_PKT_FLAG_KEY), 0, encode_start.QuadPart);
   }  // end of for
 
   return 0;
 }
 
-HRESULT VideoEncoder::GetSharedTexture() noexcept {
+void VideoEncoder::ApplySettings() noexcept {
+  Settings settings;
+  {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    settings = requested_settings_;
+    settings_changed_ = false;
+  }
+
+  if (UsesLibx264() && settings.quality != quality_) {
+    quality_ = settings.quality;
+    av_opt_set(codec_context_->priv_data, "crf",
+               std::to_string(quality_).data(), 0);
+  }
+  // NVENC changes the bitrate of its rate control dynamically, where the GPU
+  // supports it.
+  if (HardwareEncoder::NVENC == hardware_encoder_ &&
+      settings.bitrate != bitrate_) {
+    bitrate_ = settings.bitrate;
+    codec_context_->bit_rate = static_cast<std::int64_t>(bitrate_);
+  }
+
+  if (settings.bitrate != bitrate_ || settings.quality != quality_ ||
+      settings.gop != gop_ || settings.preset != video_preset_) {
+    reopen_settings_ = std::move(settings);
+  } else {
+    reopen_settings_.reset();
+  }
+}
+
+int VideoEncoder::Reopen() noexcept {
+  assert(reopen_settings_);
+
+  // Not derived again, the source may have changed since in fixed size mode.
+  const int width = codec_context_->width;
+  const int height = codec_context_->height;
+  auto open = [this, width, height](const Settings& settings) {
+    bitrate_ = settings.bitrate;
+    quality_ = settings.quality;
+    gop_ = settings.gop;
+    video_preset_ = settings.preset;
+    avcodec_free_context(&codec_context_);
+    const AVCodec* codec = nullptr;
+    int error_code = FindEncoder(codec);
+    return error_code < 0 ? error_code : Open(codec, width, height);
+  };
+  const Settings previous{bitrate_, quality_, gop_, video_preset_};
+  int error_code = open(*reopen_settings_);
+  reopen_settings_.reset();
+  if (0 <= error_code) {
+    APP_INFO() << "Video encoder reopened.\n";
+    return 0;
+  }
+
+  APP_ERROR() << "Reopen video encoder failed with " << error_code
+              << ", back to the previous settings.\n";
+  error_code = open(previous);
+  if (0 <= error_code) {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    if (!settings_changed_) {
+      requested_settings_ = previous;
+    }
+    return 0;
+  }
+  GetEngine().NotifyRestartVideoEncoder();
+  return error_code;
+}
+
+int VideoEncoder::WriteEncoded(std::span<std::uint8_t> data,
+                               bool is_keyframe,
+                               std::uint8_t temporal_id,
+                               std::uint64_t encode_start) noexcept {
+  LARGE_INTEGER encode_end;
+  QueryPerformanceCounter(&encode_end);
+  frame_info_.encode_duration = encode_end.QuadPart - encode_start;
+  frame_info_.is_keyframe = is_keyframe;
+  frame_info_.temporal_id = temporal_id;
+  frames_since_keyframe_ = is_keyframe ? 0 : frames_since_keyframe_ + 1;
+  if (is_keyframe && RefreshesOnRequest()) {
+    produce_keyframe_ = false;
+  }
+  encode_timing_.Add(frame_info_.encode_duration);
+  if (0 != frame_info_.capture_timestamp) {
+    latency_.encode_end.Add(g_app.TicksToMicroseconds(
+        encode_end.QuadPart - frame_info_.capture_timestamp));
+  }
+
+  // Annex B or OBUs as they are, straight into the buffer sent to the
+  // sessions.
+  if (is_keyframe && !parameter_sets_.empty()) {
+    keyframe_.assign(parameter_sets_.begin(), parameter_sets_.end());
+    keyframe_.insert(keyframe_.end(), data.begin(), data.end());
+    return GetEngine().WritePacket(this, keyframe_);
+  }
+  return GetEngine().WritePacket(this, data);
+}
+
+HRESULT VideoEncoder::GetSharedTexture(
+    std::uint64_t& capture_timestamp) noexcept {
   int index = 0;
-  SharedVideoTextureFrames* texture_frames = shared_texture_frames_;
+  auto texture_frames = shared_texture_frames_.As<SharedVideoTextureFrames>();
   PackedVideoTextureFrame* texture_frame = texture_frames->frames;
   auto texture_frame1 = texture_frame + 1;
   if (texture_frame->stats.timestamp < texture_frame1->stats.timestamp) {
     texture_frame = texture_frame1;
     index = 1;
   }
+  capture_timestamp = texture_frame->stats.timestamp;
 
   bool should_update_shared_texture = false;
   if (!shared_textures_[index].texture) {
@@ -783,12 +1494,59 @@ HRESULT VideoEncoder::GetSharedTexture() noexcept {
         return hr;
       }
       staging_texture_ = staging_texture;
-
-      yuv_frame_data_.resize(4 * saved_frame_info_.width *
-                             saved_frame_info_.height);
     }
   }
 
   context_->CopyResource(staging_texture_, shared_textures_[index].texture);
   return S_OK;
 }
+
+void VideoEncoder::ReportTiming() const noexcept {
+  auto report = [](const char* stage, const StageTiming& timing) {
+    if (0 == timing.frames) {
+      return;
+    }
+    APP_INFO() << "Video " << stage << " stage: " << timing.frames
+               << " frames, average "
+               << g_app.TicksToMicroseconds(timing.total / timing.frames)
+               << "us, max " << g_app.TicksToMicroseconds(timing.max)
+               << "us.\n";
+  };
+  report("convert", convert_timing_);
+  report("damage", damage_timing_);
+  report("queue", queue_timing_);
+  report("encode", encode_timing_);
+  latency_.Report();
+  APP_INFO() << "Video dropped " << frame_ring_.GetDroppedFrames()
+             << " converted frames.\n";
+  if (0 != idle_frames_) {
+    APP_INFO() << "Video skipped " << idle_frames_ << " frames while idle.\n";
+  }
+  if (0 != skipped_frames_ && 0 != convert_timing_.frames &&
+      0 != encode_timing_.frames) {
+    // Estimated by the average of the frames converted and encoded, which is
+    // wall time, and so less than CPU time with a multithreaded encoder.
+    const std::uint64_t saved =
+        skipped_frames_ * (convert_timing_.total / convert_timing_.frames +
+                           encode_timing_.total / encode_timing_.frames);
+    APP_INFO() << "Video skipped " << skipped_frames_
+               << " unchanged frames, saved about "
+               << g_app.TicksToMicroseconds(saved) / 1'000'000.0
+               << "s of converting and encoding for "
+               << g_app.TicksToMicroseconds(damage_timing_.total) / 1'000'000.0
+               << "s of hashing.\n";
+  }
+}
+
+void VideoEncoder::StartRecording(std::uint32_t data_size) {
+  using namespace std::chrono;
+  // One file per start, as the dimension may change.
+  auto path = record_directory_ /
+              std::format(L"{}{:%Y%m%d-%H%M%S}-{}x{}.rawv",
+                          object_namer_.GetPrefix(),
+                          floor<seconds>(system_clock::now()),
+                          saved_frame_info_.width, saved_frame_info_.height);
+  if (!frame_recorder_.Open(path, saved_frame_info_, data_size)) {
+    APP_WARNING() << "Video is not recorded.\n";
+  }
+}
@@ -16,19 +16,39 @@
 
 #pragma once
 
-#include <atlfile.h>
-
+// Windows only, unlike regame/shared_mem_transport.h.
 #include <d3d11_1.h>
 #include <dxgi.h>
 
 #include <chrono>
+#include <optional>
 
+#include "damage_detector.h"
 #include "encoder.h"
+#include "frame_recorder.h"
+#include "frame_ring.h"
+#include "latency_histogram.h"
+#include "openh264_encoder.h"
 
 #include "regame/shared_mem_info.h"
+#include "regame/shared_mem_transport.h"
 
 enum class HardwareEncoder { None = 0, AMF, NVENC, QSV };
 
+constexpr std::array<std::string_view, 3> kValidAmfPreset{"speed", "balanced",
+                                                          "quality"};
+constexpr std::array<std::string_view, 10> kValidNvencPreset{
+    // NVENC_HAVE_NEW_PRESETS: slow=p7, medium=p4, fast=p1
+    "p1", "p2", "p3", "p4", "p5", "p6", "p7", "slow", "medium", "fast"};
+constexpr std::array<std::string_view, 7> kValidQsvPreset{
+    "veryfast", "faster", "fast", "medium", "slow", "slower", "veryslow"};
+// libsvtav1 presets fast enough for real time.
+constexpr std::array<std::string_view, 6> kValidSvtAv1Preset{"8",  "9",  "10",
+                                                             "11", "12", "13"};
+constexpr std::array<std::string_view, 10> kValidPreset{
+    "ultrafast", "superfast", "veryfast", "faster",   "fast",
+    "medium",    "slow",      "slower",   "veryslow", "placebo"};
+
 struct SharedTexture {
   std::uint64_t instance_id;
   std::uint64_t texture_id;
@@ -39,8 +59,22 @@ class ObjectNamer;
 
 class VideoEncoder : public Encoder {
  public:
-  VideoEncoder(ObjectNamer& object_namer)
-      : Encoder(regame::ServerAction::kVideo), object_namer_(object_namer) {}
+  static constexpr std::uint64_t kMinBitrate = 100'000;
+  static constexpr int kMinGop = 1;
+  static constexpr int kMaxGop = 500;
+  static constexpr std::uint32_t kMaxQuality = 51;
+
+  // What Initialize() takes and Reconfigure() changes.
+  struct Settings {
+    std::uint64_t bitrate;
+    std::uint32_t quality;
+    int gop;
+    std::string preset;
+  };
+
+  VideoEncoder(Engine& engine, ObjectNamer& object_namer)
+      : Encoder(engine, regame::ServerAction::kVideo),
+        object_namer_(object_namer) {}
   ~VideoEncoder() noexcept = default;
 
   bool Initialize(uint64_t bitrate,
@@ -64,15 +98,179 @@ class VideoEncoder : public Encoder {
 
   void ProduceKeyframe() noexcept { produce_keyframe_ = true; }
 
+  // Thread-safe. The running encoder takes the new settings before its next
+  // frame. libx264 takes a quality and NVENC a bitrate as they are,
+  // otherwise the encoder is reopened at its next keyframe, and goes back to
+  // the old settings if it fails to open. An encoder started later opens
+  // with them. The bitrate is kept for encoders which ignore it, see
+  // GetSettings().
+  void Reconfigure(Settings settings);
+  Settings GetSettings() const;
+  bool IsValidPreset(std::string_view preset) const noexcept;
+
+  // While idle, with no session to send to, frames are encoded at the idle
+  // frame rate only, zero keeps the full rate.
+  void SetIdle(bool idle) noexcept { idle_ = idle; }
+  bool IsIdle() const noexcept { return idle_; }
+  void SetIdleFrameRate(std::uint32_t frame_rate) noexcept {
+    idle_interval_ = 0 == frame_rate ? std::chrono::milliseconds(0)
+                                     : std::chrono::milliseconds(1000) /
+                                           frame_rate;
+  }
+
+  // Records the shared YUV frames into a new raw video file in directory
+  // each time the encoder starts, empty to disable.
+  void SetRecordDirectory(std::filesystem::path directory) noexcept {
+    record_directory_ = std::move(directory);
+  }
+
+  // Frames with no changed tile are not encoded, unless the last frame was
+  // encoded interval ago, zero to encode every frame.
+  void SetRefreshInterval(std::chrono::milliseconds interval) noexcept {
+    refresh_interval_ = interval;
+  }
+
+  // Keeps the encoder when the dimension of the source changes, and scales
+  // the new source into the first dimension, letterboxed.
+  void SetFixedSize(bool fixed_size) noexcept { fixed_size_ = fixed_size; }
+
+  // Encodes at width * height instead of the source size, zero for the
+  // source size times the scale. Sources of another aspect ratio are
+  // letterboxed.
+  void SetOutputSize(std::uint32_t width, std::uint32_t height) noexcept {
+    output_width_ = width;
+    output_height_ = height;
+  }
+  void SetScale(double scale) noexcept { scale_ = scale; }
+
+  // Software encoders encode slices of a frame on threads, frame threading
+  // would delay every frame by the number of threads. Zero threads is one
+  // per core, zero slices lets the encoder pick.
+  void SetThreads(int threads) noexcept { threads_ = threads; }
+  void SetSlices(int slices) noexcept { slices_ = slices; }
+
+  // Replaces periodic IDR frames with a column of intra blocks sweeping the
+  // picture every gop frames, so that no frame spikes. Where the encoder
+  // flags the start of each sweep, keyframe requests wait for the next one
+  // instead of forcing an IDR frame.
+  void SetIntraRefresh(bool intra_refresh) noexcept {
+    intra_refresh_ = intra_refresh;
+  }
+
+  // More than one layer encodes H.264 with OpenH264 instead of libx264, see
+  // OpenH264Encoder.
+  void SetTemporalLayers(int temporal_layers) noexcept {
+    temporal_layers_ = temporal_layers;
+  }
+
+  // The software encoder quantizes unchanged tiles qp_offset coarser and
+  // changed tiles qp_offset finer, zero to disable.
+  void SetRoiQpOffset(int qp_offset) noexcept { roi_qp_offset_ = qp_offset; }
+
+  // Describes the frame being written, only valid in the encode stage.
+  struct FrameInfo {
+    std::uint32_t frame_id;
+    std::uint64_t capture_timestamp;  // performance counter ticks
+    std::uint64_t encode_duration;    // performance counter ticks
+    bool is_keyframe;
+    std::uint8_t temporal_id;  // 0 is the base layer
+  };
+  const FrameInfo& GetFrameInfo() const noexcept { return frame_info_; }
+
+  // Thread-safe, reported when the encoder stops.
+  VideoLatency& GetLatency() noexcept { return latency_; }
+
  private:
+  // Frames between the conversion stage and the encode stage, one is being
+  // converted, one is being encoded and one is waiting.
+  static constexpr std::size_t kPipelineDepth = 3;
+
+  // Where the source goes in the frames encoded.
+  struct Placement {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+  };
+
+  // Performance counter ticks spent by frames in a stage.
+  struct StageTiming {
+    std::uint64_t frames = 0;
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+
+    void Add(std::uint64_t ticks) noexcept {
+      ++frames;
+      total += ticks;
+      max = std::max(max, ticks);
+    }
+  };
+
+  // Waits for shared frames and runs the conversion stage.
   int EncodingThread();
+  // Runs the encode stage.
+  void EncodeStageThread();
   void Free(bool wait_thread);
-  int AddStream(const AVCodec*& codec);
-  int Open(const AVCodec* codec, AVDictionary** opts);
+  int OpenSharedFrames() noexcept;
+  void CloseSharedFrames() noexcept;
+  int StartPipeline() noexcept;
+  void StopPipeline() noexcept;
+  int FindEncoder(const AVCodec*& codec);
+  // width and height of the encoder, 0 to derive them from the source and the
+  // options.
+  int Open(const AVCodec* codec, int width = 0, int height = 0);
   int InitializeFrame(AVFrame*& frame) const noexcept;
-  int EncodeFrame(AVFrame* frame) noexcept;
-  int EncodeYuvFrame(AVFrame* frame, const uint8_t* yuv) noexcept;
-  HRESULT GetSharedTexture() noexcept;
+  int ConvertFrame(FrameRing::Slot* slot) noexcept;
+  int WrapYuvFrame(AVFrame* frame, std::uint64_t& capture_timestamp) noexcept;
+  int ScaleFrame(const std::uint8_t* const data[],
+                 const int linesize[],
+                 AVPixelFormat format,
+                 AVFrame* frame) noexcept;
+  static void ReleaseFrameBuffers(AVFrame* frame) noexcept;
+  bool SkipUnchanged(std::span<const DamageDetector::Plane> planes,
+                     FrameRing::Slot* slot) noexcept;
+  bool SkipIdle() noexcept;
+  bool UsesOpenH264() const noexcept {
+    return 1 < temporal_layers_ && HardwareEncoder::None == hardware_encoder_ &&
+           AV_CODEC_ID_H264 == GetCodecID();
+  }
+  bool UsesRegionsOfInterest() const noexcept {
+    return 0 != roi_qp_offset_ && HardwareEncoder::None == hardware_encoder_ &&
+           !intra_refresh_ && !UsesOpenH264();
+  }
+  // Only libx264 flags the packets starting a sweep as keyframes.
+  bool RefreshesOnRequest() const noexcept {
+    return intra_refresh_ && HardwareEncoder::None == hardware_encoder_ &&
+           AV_CODEC_ID_H264 == GetCodecID() && !UsesOpenH264();
+  }
+  int AddRegionsOfInterest(
+      AVFrame* frame,
+      const std::vector<std::uint8_t>& changed_tiles) const noexcept;
+  int EncodeYuvFrame(FrameRing::Slot* slot) noexcept;
+  // Encode stage. Changes what the encoder changes live, and leaves the rest
+  // to Reopen().
+  void ApplySettings() noexcept;
+  // Keeps the size and the pixel format, which the frames in frame_ring_ and
+  // the viewers were set up for.
+  int Reopen() noexcept;
+  // libavcodec passes changes of its crf to x264_encoder_reconfig().
+  bool UsesLibx264() const noexcept {
+    return HardwareEncoder::None == hardware_encoder_ &&
+           AV_CODEC_ID_H264 == GetCodecID() && !UsesOpenH264();
+  }
+  // The others encode at a constant quality, crf or QP, and ignore it.
+  bool UsesBitrate() const noexcept {
+    return HardwareEncoder::NVENC == hardware_encoder_ ||
+           HardwareEncoder::QSV == hardware_encoder_;
+  }
+  // Returns what Engine::WritePacket() returns.
+  int WriteEncoded(std::span<std::uint8_t> data,
+                   bool is_keyframe,
+                   std::uint8_t temporal_id,
+                   std::uint64_t encode_start) noexcept;
+  HRESULT GetSharedTexture(std::uint64_t& capture_timestamp) noexcept;
+  void ReportTiming() const noexcept;
+  void StartRecording(std::uint32_t data_size);
 
  private:
   ObjectNamer& object_namer_;
@@ -81,29 +279,79 @@ class VideoEncoder : public Encoder {
   int gop_;
   std::string video_preset_;
   uint32_t quality_;
+  int threads_ = 1;
+  int slices_ = 0;
+  bool intra_refresh_ = false;
+  int temporal_layers_ = 1;
+
+  // Taken by the encode stage, or before opening.
+  mutable std::mutex settings_mutex_;
+  Settings requested_settings_;  // guarded by settings_mutex_
+  std::atomic<bool> settings_changed_{false};
+  std::optional<Settings> reopen_settings_;  // encode stage only
+  // Exported by a reopened encoder and different from the header the
+  // sessions have, sent in band before each keyframe.
+  std::vector<std::uint8_t> parameter_sets_;  // encode stage only
+  std::vector<std::uint8_t> keyframe_;        // encode stage only
 
-  CHandle started_event_;
-  CHandle stop_event_;
+  regame::SharedEvent started_event_;
+  regame::SharedEvent stop_event_;
   std::thread thread_;
+  std::thread encode_thread_;
 
-  CAtlFileMapping<regame::SharedVideoFrameInfo> shared_frame_info_;
+  regame::SharedMemory shared_frame_info_;
   regame::SharedVideoFrameInfo saved_frame_info_;
-  CAtlFileMapping<uint8_t> shared_yuv_frames_;
-  CAtlFileMapping<regame::SharedVideoTextureFrames> shared_texture_frames_;
-  CHandle shared_frame_ready_event_;
+  regame::SharedMemory shared_yuv_frames_;
+  // As validated when opened, not read from shared_yuv_frames_ again.
+  std::uint32_t number_of_yuv_frames_ = 0;
+  regame::SharedMemory shared_texture_frames_;
+  regame::SharedEvent shared_frame_ready_event_;
 
   CComPtr<ID3D11DeviceContext> context_;
   CComPtr<ID3D11Device> device_;
   CComPtr<ID3D11Device1> device1_;
   std::array<SharedTexture, regame::kNumberOfSharedFrames> shared_textures_;
   CComPtr<ID3D11Texture2D> staging_texture_;
-  std::vector<uint8_t> yuv_frame_data_;
 
-  AVStream* stream_ = nullptr;
+  bool fixed_size_ = false;
+  std::uint32_t output_width_ = 0;
+  std::uint32_t output_height_ = 0;
+  double scale_ = 1.0;
+  regame::VideoFrameType output_type_ = regame::VideoFrameType::kNone;
+  Placement placement_;
+  bool wraps_shared_frames_ = false;
+  AVFrame* source_frame_ = nullptr;    // conversion stage only
+  SwsContext* sws_context_ = nullptr;  // conversion stage only
+
+  FrameRing frame_ring_;
+  StageTiming convert_timing_;  // conversion stage only
+  StageTiming damage_timing_;   // conversion stage only
+  StageTiming queue_timing_;    // encode stage only
+  StageTiming encode_timing_;   // encode stage only
+  VideoLatency latency_;
+
+  std::chrono::milliseconds refresh_interval_{0};
+  DamageDetector damage_detector_;  // Update() in conversion stage only
+  std::chrono::steady_clock::time_point last_pushed_time_;
+  std::uint64_t skipped_frames_ = 0;
+  std::chrono::milliseconds idle_interval_{0};
+  std::chrono::steady_clock::time_point last_idle_time_;
+  std::uint64_t idle_frames_ = 0;
+  int roi_qp_offset_ = 0;
+  int frames_since_keyframe_ = 0;  // encode stage only
+
+  std::filesystem::path record_directory_;
+  FrameRecorder frame_recorder_;
+
+  // Not opened when OpenH264 encodes.
   AVCodecContext* codec_context_ = nullptr;
-  AVFormatContext* format_context_ = nullptr;
+  OpenH264Encoder openh264_encoder_;
 
-  std::chrono::steady_clock::time_point startup_time_;
+  std::uint64_t first_timestamp_ = 0;  // conversion stage only
+  std::int64_t last_pts_ = -1;         // conversion stage only
+  std::uint32_t frame_id_ = 0;
+  FrameInfo frame_info_{};
 
   mutable std::atomic<bool> produce_keyframe_{false};
+  std::atomic<bool> idle_{false};
 };
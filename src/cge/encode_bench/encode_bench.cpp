@@ -0,0 +1,498 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the per-frame latency of the software encoders configured like
+// cge, over resolutions, presets and numbers of slice threads, to pick
+// --video-threads and --video-slices for a host. The bitrate and the PSNR of
+// the decoded frames compare the codecs at matched quality.
+
+// C++, STL
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// C++, Boost
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+#include <boost/scope_exit.hpp>
+
+#pragma warning(push)
+#pragma warning(disable : 4819)
+_CRT_BEGIN_C_HEADER
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+_CRT_END_C_HEADER
+#pragma warning(pop)
+
+#pragma comment(lib, "avcodec.lib")
+#pragma comment(lib, "avutil.lib")
+
+namespace po = boost::program_options;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kTimeBase = 90000;
+constexpr int kFrameRate = 60;
+constexpr int kGop = 180;
+
+struct Size {
+  int width = 0;
+  int height = 0;
+};
+
+struct Config {
+  AVCodecID codec_id = AV_CODEC_ID_NONE;
+  std::vector<Size> sizes;
+  std::vector<std::string> presets;
+  std::vector<int> threads;
+  int slices = 0;
+  int frames = 0;
+  int quality = 0;
+};
+
+struct Result {
+  double mean = 0;  // milliseconds
+  double p99 = 0;
+  double max = 0;
+  double kilobits = 0;  // per frame
+  double psnr = 0;      // luma, decibels
+};
+
+const char* GetEncoderName(AVCodecID codec_id) noexcept {
+  switch (codec_id) {
+    case AV_CODEC_ID_HEVC:
+      return "libx265";
+    case AV_CODEC_ID_AV1:
+      return "libsvtav1";
+    default:
+      return "libx264";
+  }
+}
+
+// The native AV1 decoder needs a hardware accelerator.
+const AVCodec* FindDecoder(AVCodecID codec_id) noexcept {
+  if (AV_CODEC_ID_AV1 == codec_id) {
+    return avcodec_find_decoder_by_name("libdav1d");
+  }
+  return avcodec_find_decoder(codec_id);
+}
+
+std::vector<std::string> Split(const std::string& text) {
+  std::vector<std::string> arr;
+  boost::algorithm::split(arr, text, boost::is_any_of(","),
+                          boost::algorithm::token_compress_on);
+  arr.erase(std::remove(arr.begin(), arr.end(), std::string()), arr.end());
+  return arr;
+}
+
+// WIDTHxHEIGHT, even.
+Size ParseSize(const std::string& text) {
+  std::vector<std::string> arr;
+  boost::algorithm::split(arr, text, boost::is_any_of("x"));
+  if (2 != arr.size()) {
+    throw std::invalid_argument("sizes must be WIDTHxHEIGHT!");
+  }
+  Size size{std::stoi(arr[0]), std::stoi(arr[1])};
+  if (size.width < 16 || size.height < 16 || 0 != (size.width & 1) ||
+      0 != (size.height & 1)) {
+    throw std::out_of_range("sizes out of range!");
+  }
+  return size;
+}
+
+// A panning gradient with a moving block of noise, so that every frame has
+// motion and detail to encode.
+void FillFrame(AVFrame* frame, int index) {
+  std::uint32_t seed = index + 1;
+  const int block_x = (index * 8) % (frame->width / 2);
+  const int block_y = frame->height / 4;
+  for (int y = 0; y < frame->height; ++y) {
+    std::uint8_t* row = frame->data[0] + y * frame->linesize[0];
+    for (int x = 0; x < frame->width; ++x) {
+      row[x] = static_cast<std::uint8_t>(x + y + index * 4);
+    }
+    if (block_y <= y && y < block_y + frame->height / 2) {
+      for (int x = block_x; x < block_x + frame->width / 2; ++x) {
+        seed = seed * 1664525 + 1013904223;
+        row[x] = static_cast<std::uint8_t>(seed >> 24);
+      }
+    }
+  }
+  for (int i = 1; i < 3; ++i) {
+    for (int y = 0; y < frame->height / 2; ++y) {
+      std::uint8_t* row = frame->data[i] + y * frame->linesize[i];
+      for (int x = 0; x < frame->width / 2; ++x) {
+        row[x] = static_cast<std::uint8_t>(128 + ((x * i + y) >> 3) - index);
+      }
+    }
+  }
+}
+
+// Opens the encoder like VideoEncoder::Open() does for software encoders.
+AVCodecContext* OpenEncoder(const Config& config,
+                            const Size& size,
+                            const std::string& preset,
+                            int threads) {
+  const char* encoder_name = GetEncoderName(config.codec_id);
+  const AVCodec* codec = avcodec_find_encoder_by_name(encoder_name);
+  if (nullptr == codec) {
+    std::cerr << "Error: " << encoder_name << " not found!\n";
+    return nullptr;
+  }
+  AVCodecContext* context = avcodec_alloc_context3(codec);
+  if (nullptr == context) {
+    return nullptr;
+  }
+  context->thread_count = threads;
+  context->thread_type = FF_THREAD_SLICE;
+  context->slices = config.slices;
+  context->width = size.width;
+  context->height = size.height;
+  context->time_base = {1, kTimeBase};
+  context->max_b_frames = 0;
+  context->gop_size = kGop;
+  context->pix_fmt = AV_PIX_FMT_YUV420P;
+  context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+  std::string quality = std::to_string(config.quality);
+  if (AV_CODEC_ID_AV1 == config.codec_id) {
+    quality = std::to_string(config.quality * 63 / 51);
+  }
+  av_opt_set(context->priv_data, "preset", preset.data(), 0);
+  av_opt_set(context->priv_data, "crf", quality.data(), 0);
+  av_opt_set(context->priv_data, "forced-idr", "1", 0);
+  av_opt_set(context->priv_data, "tune", "zerolatency", 0);
+  if (AV_CODEC_ID_AV1 == config.codec_id) {
+    // Like cge, libsvtav1 needs a frame rate for its rate control.
+    context->framerate = {kFrameRate, 1};
+    av_opt_set(context->priv_data, "svtav1-params", "pred-struct=1:rtc=1", 0);
+  } else if (AV_CODEC_ID_HEVC == config.codec_id) {
+    av_opt_set(context->priv_data, "profile", "main", 0);
+    std::string params = "frame-threads=1";
+    if (0 != threads) {
+      params += ":pools=" + std::to_string(threads);
+    }
+    if (0 != config.slices) {
+      params += ":slices=" + std::to_string(config.slices);
+    }
+    av_opt_set(context->priv_data, "x265-params", params.data(), 0);
+  } else {
+    av_opt_set(context->priv_data, "profile", "baseline", 0);
+  }
+
+  int error_code = avcodec_open2(context, codec, nullptr);
+  if (error_code < 0) {
+    std::cerr << "Error: avcodec_open2() failed with " << error_code << '\n';
+    avcodec_free_context(&context);
+  }
+  return context;
+}
+
+AVCodecContext* OpenDecoder(AVCodecID codec_id) {
+  const AVCodec* codec = FindDecoder(codec_id);
+  if (nullptr == codec) {
+    std::cerr << "Error: no decoder for " << avcodec_get_name(codec_id)
+              << '\n';
+    return nullptr;
+  }
+  AVCodecContext* context = avcodec_alloc_context3(codec);
+  if (nullptr == context) {
+    return nullptr;
+  }
+  context->thread_count = 1;
+  int error_code = avcodec_open2(context, codec, nullptr);
+  if (error_code < 0) {
+    std::cerr << "Error: avcodec_open2() failed with " << error_code << '\n';
+    avcodec_free_context(&context);
+  }
+  return context;
+}
+
+// Adds the squared luma error of the decoded frames to the frames they were
+// encoded from, which are drawn again.
+class ErrorMeter {
+ public:
+  ErrorMeter(AVCodecContext* decoder, AVFrame* decoded, AVFrame* reference)
+      : decoder_(decoder), decoded_(decoded), reference_(reference) {}
+
+  // nullptr to drain the decoder.
+  bool Decode(const AVPacket* packet) noexcept {
+    int error_code = avcodec_send_packet(decoder_, packet);
+    if (error_code < 0) {
+      return false;
+    }
+    while (0 <= (error_code = avcodec_receive_frame(decoder_, decoded_))) {
+      FillFrame(reference_, frames_++);
+      for (int y = 0; y < reference_->height; ++y) {
+        const std::uint8_t* a = decoded_->data[0] + y * decoded_->linesize[0];
+        const std::uint8_t* b =
+            reference_->data[0] + y * reference_->linesize[0];
+        for (int x = 0; x < reference_->width; ++x) {
+          const int d = a[x] - b[x];
+          squared_error_ += d * d;
+        }
+      }
+      av_frame_unref(decoded_);
+    }
+    return AVERROR(EAGAIN) == error_code || AVERROR_EOF == error_code;
+  }
+
+  int GetFrames() const noexcept { return frames_; }
+
+  double GetPsnr() const noexcept {
+    const double samples = static_cast<double>(frames_) * reference_->width *
+                           reference_->height;
+    if (0 == squared_error_) {
+      return 100.0;
+    }
+    return 10.0 * std::log10(255.0 * 255.0 * samples / squared_error_);
+  }
+
+ private:
+  AVCodecContext* decoder_;
+  AVFrame* decoded_;
+  AVFrame* reference_;
+  int frames_ = 0;
+  std::uint64_t squared_error_ = 0;
+};
+
+// Empty on failure.
+std::vector<double> Encode(AVCodecContext* context,
+                           AVCodecContext* decoder,
+                           int frames,
+                           std::uint64_t& bytes,
+                           double& psnr) {
+  AVFrame* frame = av_frame_alloc();
+  AVFrame* reference = av_frame_alloc();
+  AVFrame* decoded = av_frame_alloc();
+  AVPacket* packet = av_packet_alloc();
+  std::vector<double> durations;
+  BOOST_SCOPE_EXIT_ALL(&) {
+    av_packet_free(&packet);
+    av_frame_free(&decoded);
+    av_frame_free(&reference);
+    av_frame_free(&frame);
+  };
+  if (nullptr == frame || nullptr == reference || nullptr == decoded ||
+      nullptr == packet) {
+    return durations;
+  }
+  for (AVFrame* f : {frame, reference}) {
+    f->format = context->pix_fmt;
+    f->width = context->width;
+    f->height = context->height;
+    if (av_frame_get_buffer(f, 0) < 0) {
+      return durations;
+    }
+  }
+
+  ErrorMeter meter(decoder, decoded, reference);
+  durations.reserve(frames);
+  for (int i = 0; i < frames; ++i) {
+    if (av_frame_make_writable(frame) < 0) {
+      durations.clear();
+      break;
+    }
+    FillFrame(frame, i);
+    frame->pts = static_cast<std::int64_t>(i) * kTimeBase / kFrameRate;
+
+    // Zero latency, each frame comes out before the next goes in.
+    const auto start = Clock::now();
+    std::vector<AVPacket*> packets;
+    int error_code = avcodec_send_frame(context, frame);
+    while (0 <= error_code) {
+      error_code = avcodec_receive_packet(context, packet);
+      if (0 <= error_code) {
+        bytes += packet->size;
+        packets.emplace_back(av_packet_clone(packet));
+        av_packet_unref(packet);
+      }
+    }
+    durations.emplace_back(
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count());
+    bool decoded_all = true;
+    for (AVPacket* p : packets) {
+      decoded_all = decoded_all && nullptr != p && meter.Decode(p);
+      av_packet_free(&p);
+    }
+    if (AVERROR(EAGAIN) != error_code || !decoded_all) {
+      durations.clear();
+      break;
+    }
+  }
+
+  if (!durations.empty() &&
+      (!meter.Decode(nullptr) || 0 == meter.GetFrames())) {
+    durations.clear();
+  }
+  psnr = meter.GetPsnr();
+  return durations;
+}
+
+bool Run(const Config& config,
+         const Size& size,
+         const std::string& preset,
+         int threads,
+         Result& result) {
+  AVCodecContext* context = OpenEncoder(config, size, preset, threads);
+  if (nullptr == context) {
+    return false;
+  }
+  AVCodecContext* decoder = OpenDecoder(config.codec_id);
+  if (nullptr == decoder) {
+    avcodec_free_context(&context);
+    return false;
+  }
+  std::uint64_t bytes = 0;
+  std::vector<double> durations =
+      Encode(context, decoder, config.frames, bytes, result.psnr);
+  avcodec_free_context(&decoder);
+  avcodec_free_context(&context);
+  if (durations.empty()) {
+    return false;
+  }
+
+  std::sort(durations.begin(), durations.end());
+  result.mean = std::accumulate(durations.begin(), durations.end(), 0.0) /
+                durations.size();
+  // Nearest rank.
+  const auto rank = static_cast<std::size_t>(
+      std::ceil(0.99 * static_cast<double>(durations.size())));
+  result.p99 = durations[std::clamp<std::size_t>(rank, 1, durations.size()) -
+                         1];
+  result.max = durations.back();
+  result.kilobits = bytes * 8 / 1000.0 / durations.size();
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string codec;
+  std::string sizes;
+  std::string presets;
+  std::string threads;
+  Config config;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("codec",
+        po::value<std::string>(&codec)->default_value("h264"),
+        "Set codec, h264, hevc or av1")
+      ("frames,n",
+        po::value<int>(&config.frames)->default_value(300),
+        "Set number of frames encoded by each setting")
+      ("presets",
+        po::value<std::string>(&presets),
+        "Set comma separated presets, ultrafast,superfast,veryfast by default "
+        "or 12,11,10 for av1")
+      ("quality",
+        po::value<int>(&config.quality)->default_value(23),
+        "Set CRF like cge --video-quality")
+      ("sizes",
+        po::value<std::string>(&sizes)->default_value("1280x720,1920x1080,2560x1440"),
+        "Set comma separated resolutions")
+      ("slices",
+        po::value<int>(&config.slices)->default_value(0),
+        "Set slices per frame like cge --video-slices, 0 lets the encoder pick")
+      ("threads",
+        po::value<std::string>(&threads)->default_value("1,2,4,8"),
+        "Set comma separated numbers of threads, 0 is one per core");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    if ("h264" == codec) {
+      config.codec_id = AV_CODEC_ID_H264;
+    } else if ("hevc" == codec || "h265" == codec) {
+      config.codec_id = AV_CODEC_ID_HEVC;
+    } else if ("av1" == codec) {
+      config.codec_id = AV_CODEC_ID_AV1;
+    } else {
+      throw std::invalid_argument("codec must be h264, hevc or av1!");
+    }
+    if (presets.empty()) {
+      presets = AV_CODEC_ID_AV1 == config.codec_id
+                    ? "12,11,10"
+                    : "ultrafast,superfast,veryfast";
+    }
+    if (config.frames < 1 || config.slices < 0) {
+      throw std::out_of_range("frames and slices out of range!");
+    }
+    for (const auto& s : Split(sizes)) {
+      config.sizes.emplace_back(ParseSize(s));
+    }
+    config.presets = Split(presets);
+    for (const auto& s : Split(threads)) {
+      config.threads.emplace_back(std::stoi(s));
+      if (config.threads.back() < 0) {
+        throw std::out_of_range("threads out of range!");
+      }
+    }
+    if (config.sizes.empty() || config.presets.empty() ||
+        config.threads.empty()) {
+      throw std::invalid_argument("sizes, presets and threads are required!");
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  av_log_set_level(AV_LOG_ERROR);
+  std::cout << std::fixed << std::setprecision(2) << std::left
+            << std::setw(12) << "size" << std::setw(12) << "preset"
+            << std::right << std::setw(8) << "threads" << std::setw(10)
+            << "mean ms" << std::setw(10) << "p99 ms" << std::setw(10)
+            << "max ms" << std::setw(12) << "kbit/frame" << std::setw(10)
+            << "PSNR dB" << '\n';
+  for (const auto& size : config.sizes) {
+    for (const auto& preset : config.presets) {
+      for (int t : config.threads) {
+        Result result;
+        if (!Run(config, size, preset, t, result)) {
+          return EXIT_FAILURE;
+        }
+        std::cout << std::left << std::setw(12)
+                  << std::to_string(size.width) + 'x' +
+                         std::to_string(size.height)
+                  << std::setw(12) << preset << std::right << std::setw(8)
+                  << t << std::setw(10) << result.mean << std::setw(10)
+                  << result.p99 << std::setw(10) << result.max
+                  << std::setw(12) << result.kilobits << std::setw(10)
+                  << result.psnr << '\n';
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Feeds a raw video file recorded by cge --video-record-dir back to the
+// encoder through the shared video frame protocol, so that the content of a
+// game can be encoded again on any machine.
+//
+// --timing original publishes the frames at the intervals they were
+// captured, and drops them like a game would if the encoder falls behind.
+// --timing fast publishes the next frame as soon as the encoder has taken
+// the last one, so every frame is encoded and the encoder sets the pace.
+
+// C++, STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// C++, Boost
+#include <boost/program_options.hpp>
+#include <boost/scope_exit.hpp>
+
+#include "regame/raw_video_file.h"
+#include "regame/shared_frame_producer.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+using namespace regame;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kPollInterval = std::chrono::microseconds(100);
+
+struct Config {
+  std::string input;
+  bool fast = false;
+  std::uint64_t loops = 0;  // 0 until stopped
+  bool preload = false;
+  std::uint32_t number_of_frames = 0;  // of the shared ring
+  std::wstring name_prefix;
+};
+
+std::atomic<bool> interrupted{false};
+
+void OnSignal(int) {
+  interrupted = true;
+}
+
+std::size_t GetYuvSize(const RawVideoFileHeader& header) noexcept {
+  const std::size_t pixel_size =
+      static_cast<std::size_t>(header.width) * header.height;
+  switch (header.type) {
+    case VideoFrameType::kI420:
+      [[fallthrough]];
+    case VideoFrameType::kJ420:
+      return pixel_size + (pixel_size >> 1);
+    case VideoFrameType::kI422:
+      [[fallthrough]];
+    case VideoFrameType::kJ422:
+      return 2 * pixel_size;
+    case VideoFrameType::kI444:
+      return 3 * pixel_size;
+    default:
+      return 0;
+  }
+}
+
+class RawVideoReader {
+ public:
+  bool Open(const std::string& path, bool preload) {
+    file_.open(path, std::ios::binary);
+    if (!file_) {
+      std::cerr << "Error: can't open " << path << '\n';
+      return false;
+    }
+    file_.read(reinterpret_cast<char*>(&header_), sizeof(header_));
+    if (!file_ ||
+        !std::equal(std::begin(kRawVideoFileMagic),
+                    std::end(kRawVideoFileMagic), header_.magic) ||
+        kRawVideoFileVersion != header_.version) {
+      std::cerr << "Error: " << path << " is not a raw video file!\n";
+      return false;
+    }
+    const std::size_t yuv_size = GetYuvSize(header_);
+    if (0 == yuv_size || 0 == header_.timestamp_frequency ||
+        sizeof(PackedVideoYuvFrame) + yuv_size != header_.data_size) {
+      std::cerr << "Error: invalid header of " << path << '\n';
+      return false;
+    }
+
+    file_.seekg(0, std::ios::end);
+    const std::uint64_t file_size = file_.tellg();
+    number_of_frames_ = (file_size - sizeof(header_)) / header_.data_size;
+    if (0 == number_of_frames_) {
+      std::cerr << "Error: no frame in " << path << '\n';
+      return false;
+    }
+
+    if (preload) {
+      frames_.resize(number_of_frames_ * header_.data_size);
+      file_.seekg(sizeof(header_));
+      file_.read(reinterpret_cast<char*>(frames_.data()), frames_.size());
+      if (!file_) {
+        std::cerr << "Error: read " << path << " failed!\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const RawVideoFileHeader& GetHeader() const noexcept { return header_; }
+  std::uint64_t GetNumberOfFrames() const noexcept { return number_of_frames_; }
+
+  // Reads frame index into frame, data_size bytes.
+  bool Read(std::uint64_t index, PackedVideoYuvFrame* frame) {
+    if (!frames_.empty()) {
+      std::memcpy(frame, frames_.data() + index * header_.data_size,
+                  header_.data_size);
+      return true;
+    }
+    if (next_ != index) {
+      file_.seekg(sizeof(header_) + index * header_.data_size);
+    }
+    file_.read(reinterpret_cast<char*>(frame), header_.data_size);
+    next_ = index + 1;
+    return static_cast<bool>(file_);
+  }
+
+  // The original timestamp of frame index, without reading it into a slot.
+  std::uint64_t ReadTimestamp(std::uint64_t index) {
+    VideoFrameStats stats;
+    if (!frames_.empty()) {
+      std::memcpy(&stats, frames_.data() + index * header_.data_size,
+                  sizeof(stats));
+    } else {
+      file_.seekg(sizeof(header_) + index * header_.data_size);
+      file_.read(reinterpret_cast<char*>(&stats), sizeof(stats));
+      next_ = number_of_frames_;  // seek before the next Read()
+    }
+    return stats.timestamp;
+  }
+
+ private:
+  std::ifstream file_;
+  RawVideoFileHeader header_{};
+  std::uint64_t number_of_frames_ = 0;
+  std::uint64_t next_ = 0;
+  std::vector<std::uint8_t> frames_;  // if preloaded
+};
+
+struct Statistics {
+  std::uint64_t published = 0;
+  std::uint64_t dropped = 0;  // no free slot
+  Clock::duration elapsed{};
+
+  void Report() const {
+    std::cout << "published: " << published << '\n'
+              << "dropped: " << dropped << '\n';
+    if (0 != published) {
+      std::cout << "fps: "
+                << published / std::chrono::duration<double>(elapsed).count()
+                << '\n';
+    }
+  }
+};
+
+// Returns false if interrupted.
+bool WaitForEncoder(SharedFrameProducer& producer) {
+  std::cout << "Waiting for the encoder...\n";
+  while (!interrupted) {
+    if (producer.WaitForEncoder(std::chrono::milliseconds(100))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns nullptr if interrupted or the encoder is stopped.
+PackedVideoYuvFrame* AcquireWhenDrained(SharedFrameProducer& producer) {
+  for (;;) {
+    if (interrupted || producer.IsEncoderStopped()) {
+      return nullptr;
+    }
+    if (producer.IsDrained()) {
+      // The encoder may still hold every slot.
+      if (auto frame = producer.Acquire()) {
+        return frame;
+      }
+    }
+    std::this_thread::sleep_for(kPollInterval);
+  }
+}
+
+// Returns false if interrupted or the encoder is stopped.
+bool ReplayOnce(const Config& config,
+                RawVideoReader& reader,
+                SharedFrameProducer& producer,
+                Statistics& statistics) {
+  const RawVideoFileHeader& header = reader.GetHeader();
+  const std::uint64_t first_timestamp = reader.ReadTimestamp(0);
+  const auto start = Clock::now();
+  BOOST_SCOPE_EXIT_ALL(&) {
+    statistics.elapsed += Clock::now() - start;
+  };
+
+  for (std::uint64_t i = 0; i < reader.GetNumberOfFrames(); ++i) {
+    PackedVideoYuvFrame* frame = nullptr;
+    if (config.fast) {
+      frame = AcquireWhenDrained(producer);
+      if (nullptr == frame) {
+        return false;
+      }
+    } else {
+      const std::uint64_t ticks = reader.ReadTimestamp(i) - first_timestamp;
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::duration<double>(
+                          static_cast<double>(ticks) /
+                          header.timestamp_frequency)));
+      if (interrupted || producer.IsEncoderStopped()) {
+        return false;
+      }
+      frame = producer.Acquire();
+      if (nullptr == frame) {
+        ++statistics.dropped;
+        continue;
+      }
+    }
+
+    if (!reader.Read(i, frame)) {
+      std::cerr << "Error: read frame " << i << " failed!\n";
+      interrupted = true;
+      return false;
+    }
+    // Now is the capture time, the elapsed stats stay the original ones.
+    frame->stats.timestamp = GetTimestamp();
+    producer.Publish();
+    ++statistics.published;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string timing;
+  std::string name_prefix;
+  bool global_mode = false;
+  Config config;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("global-mode",
+        po::value<bool>(&global_mode)->default_value(false),
+        "Set global mode")
+      ("input,i",
+        po::value<std::string>(&config.input)->required(),
+        "Set raw video file recorded by cge --video-record-dir")
+      ("loops,n",
+        po::value<std::uint64_t>(&config.loops)->default_value(1),
+        "Set number of times to replay, 0 until Ctrl+C")
+      ("name-prefix",
+        po::value<std::string>(&name_prefix)->default_value(""),
+        "Set prefix of shared object names, such as Regame0_")
+      ("preload",
+        po::value<bool>(&config.preload)->default_value(false),
+        "Read the whole file into memory first")
+      ("ring-size",
+        po::value<std::uint32_t>(&config.number_of_frames)->default_value(
+            kDefaultNumberOfSharedYuvFrames),
+        "Set number of shared frames")
+      ("timing",
+        po::value<std::string>(&timing)->default_value("original"),
+        "Set timing, original or fast");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+
+    if ("fast" == timing) {
+      config.fast = true;
+    } else if ("original" != timing) {
+      throw std::invalid_argument("timing must be original or fast!");
+    }
+    if (config.number_of_frames < 2 ||
+        kMaxNumberOfSharedYuvFrames < config.number_of_frames) {
+      throw std::out_of_range("ring-size must be between 2 and " +
+                              std::to_string(kMaxNumberOfSharedYuvFrames) +
+                              '!');
+    }
+    if (global_mode) {
+      config.name_prefix = L"Global\\";
+    }
+    config.name_prefix.append(name_prefix.begin(), name_prefix.end());
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  RawVideoReader reader;
+  if (!reader.Open(config.input, config.preload)) {
+    return EXIT_FAILURE;
+  }
+  const RawVideoFileHeader& header = reader.GetHeader();
+  std::cout << reader.GetNumberOfFrames() << " frames of " << header.width
+            << " * " << header.height << ", type "
+            << static_cast<std::uint32_t>(header.type) << '\n';
+
+  SharedFrameProducer producer;
+  auto ec =
+      producer.Open(config.name_prefix, config.number_of_frames,
+                    header.data_size);
+  if (ec) {
+    std::cerr << "Error: " << ec.message() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+
+  Statistics statistics;
+  std::uint64_t loops = 0;
+  while ((0 == config.loops || loops < config.loops) &&
+         WaitForEncoder(producer)) {
+    std::cout << "The encoder is started.\n";
+    producer.Start(header.type, header.width, header.height);
+    while ((0 == config.loops || loops < config.loops) &&
+           ReplayOnce(config, reader, producer, statistics)) {
+      ++loops;
+    }
+    if (producer.IsEncoderStopped()) {
+      std::cout << "The encoder is stopped.\n";
+    }
+  }
+
+  producer.Close();
+  statistics.Report();
+  return EXIT_SUCCESS;
+}
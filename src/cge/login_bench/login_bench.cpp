@@ -0,0 +1,319 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Login storm against cge: opens many WebSocket sessions at once, logs each
+// in and measures the time from connecting to ServerLoginResult.
+//
+// Run cge with --user-service pointing to user_service_mock, or build cge in
+// Debug, which accepts UMU/123456 without a user service.
+
+// C++, STL
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// C++, Boost
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/program_options.hpp>
+
+#include "regame/protocol.h"
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+namespace po = boost::program_options;
+namespace websocket = beast::websocket;
+
+using tcp = net::ip::tcp;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  tcp::endpoint endpoint;
+  std::string username;
+  bool numbered_usernames = false;
+  std::string verification_code;
+  std::chrono::seconds timeout{30};
+};
+
+class Results {
+ public:
+  void Add(std::chrono::microseconds duration) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    durations_.emplace_back(duration);
+  }
+
+  void Fail(std::string_view what, const beast::error_code& ec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++failures_;
+    if (failures_ <= kMaxReportedFailures) {
+      std::cerr << what << ": " << ec.message() << '\n';
+    }
+  }
+
+  void Report(std::size_t sessions, std::chrono::microseconds elapsed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::cout << "sessions: " << sessions << '\n'
+              << "authorized: " << durations_.size() << '\n'
+              << "failed: " << failures_ << '\n'
+              << "elapsed: " << elapsed.count() / 1000.0 << " ms\n";
+    if (durations_.empty()) {
+      return;
+    }
+    std::sort(durations_.begin(), durations_.end());
+    auto total = std::accumulate(durations_.begin(), durations_.end(),
+                                 std::chrono::microseconds(0));
+    std::cout << "time to authorized (ms):\n"
+              << "  min: " << ToMilliseconds(durations_.front()) << '\n'
+              << "  mean: " << ToMilliseconds(total / durations_.size())
+              << '\n';
+    for (double percentile : {50.0, 90.0, 99.0, 99.9}) {
+      std::cout << "  p" << percentile << ": "
+                << ToMilliseconds(Percentile(percentile)) << '\n';
+    }
+    std::cout << "  max: " << ToMilliseconds(durations_.back()) << '\n';
+  }
+
+ private:
+  static constexpr std::size_t kMaxReportedFailures = 10;
+
+  static double ToMilliseconds(std::chrono::microseconds duration) {
+    return duration.count() / 1000.0;
+  }
+
+  // Nearest rank, durations_ must be sorted.
+  std::chrono::microseconds Percentile(double percentile) const {
+    auto rank = static_cast<std::size_t>(
+        std::ceil(percentile / 100.0 * durations_.size()));
+    return durations_[std::clamp<std::size_t>(rank, 1, durations_.size()) - 1];
+  }
+
+  std::mutex mutex_;
+  std::vector<std::chrono::microseconds> durations_;
+  std::size_t failures_ = 0;
+};
+
+class Session : public std::enable_shared_from_this<Session> {
+ public:
+  Session(net::io_context& ioc,
+          const Config& config,
+          std::size_t index,
+          Results& results)
+      : ws_(net::make_strand(ioc)),
+        config_(config),
+        index_(index),
+        results_(results) {}
+
+  void Run() {
+    start_ = Clock::now();
+    beast::get_lowest_layer(ws_).expires_after(config_.timeout);
+    beast::get_lowest_layer(ws_).async_connect(
+        config_.endpoint,
+        beast::bind_front_handler(&Session::OnConnect, shared_from_this()));
+  }
+
+ private:
+  void OnConnect(beast::error_code ec) {
+    if (ec) {
+      return results_.Fail("connect", ec);
+    }
+    ws_.set_option(websocket::stream_base::decorator(
+        [](websocket::request_type& req) {
+          req.set(beast::http::field::sec_websocket_protocol, "webgame");
+        }));
+    std::stringstream host;
+    host << config_.endpoint;
+    ws_.async_handshake(
+        host.str(), "/",
+        beast::bind_front_handler(&Session::OnHandshake, shared_from_this()));
+  }
+
+  void OnHandshake(beast::error_code ec) {
+    if (ec) {
+      return results_.Fail("handshake", ec);
+    }
+    ws_.binary(true);
+
+    login_.resize(sizeof(regame::PackageHead) + sizeof(regame::ClientLogin));
+    auto head = reinterpret_cast<regame::PackageHead*>(login_.data());
+    head->size = htonl(sizeof(regame::ClientLogin));
+    auto cl = reinterpret_cast<regame::ClientLogin*>(head + 1);
+    cl->head.action = regame::ClientAction::kLogin;
+    cl->protocol_version = regame::kProtocolVersion;
+    std::string username = config_.username;
+    if (config_.numbered_usernames) {
+      username += std::to_string(index_);
+    }
+    username.copy(cl->username, sizeof(cl->username) - 1);
+    cl->verification_type = regame::VerificationType::Code;
+    cl->verification_size = static_cast<std::uint8_t>(
+        config_.verification_code.copy(cl->verification_data,
+                                       sizeof(cl->verification_data)));
+
+    ws_.async_write(
+        net::buffer(login_),
+        beast::bind_front_handler(&Session::OnWrite, shared_from_this()));
+  }
+
+  void OnWrite(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+      return results_.Fail("write", ec);
+    }
+    Read();
+  }
+
+  void Read() {
+    ws_.async_read(buffer_, beast::bind_front_handler(&Session::OnRead,
+                                                      shared_from_this()));
+  }
+
+  void OnRead(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+      return results_.Fail("read", ec);
+    }
+    if (buffer_.size() <
+        sizeof(regame::PackageHead) + sizeof(regame::ServerPacketHead)) {
+      buffer_.clear();
+      return Read();
+    }
+    auto head = static_cast<const regame::PackageHead*>(buffer_.data().data());
+    auto server_packet =
+        reinterpret_cast<const regame::ServerPacketHead*>(head + 1);
+    if (regame::ServerAction::kLoginResult != server_packet->action ||
+        buffer_.size() <
+            sizeof(regame::PackageHead) + sizeof(regame::ServerLoginResult)) {
+      buffer_.clear();
+      return Read();
+    }
+
+    auto login_result =
+        reinterpret_cast<const regame::ServerLoginResult*>(server_packet);
+    if (0 != login_result->error_code) {
+      const auto error_code =
+          static_cast<int>(ntohl(login_result->error_code));
+      return results_.Fail(
+          "login", beast::error_code(error_code, beast::generic_category()));
+    }
+    results_.Add(std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - start_));
+
+    beast::get_lowest_layer(ws_).expires_after(config_.timeout);
+    ws_.async_close(websocket::close_code::normal,
+                    [self = shared_from_this()](beast::error_code) {});
+  }
+
+ private:
+  websocket::stream<beast::tcp_stream> ws_;
+  const Config& config_;
+  std::size_t index_;
+  Results& results_;
+
+  Clock::time_point start_;
+  std::string login_;
+  beast::flat_buffer buffer_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string host;
+  std::uint16_t port = 0;
+  std::size_t sessions = 0;
+  std::size_t threads = 0;
+  std::uint32_t timeout = 0;
+  Config config;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("host",
+        po::value<std::string>(&host)->default_value("127.0.0.1"),
+        "Set cge address")
+      ("numbered-usernames",
+        po::value<bool>(&config.numbered_usernames)->default_value(false),
+        "Append the session index to username")
+      ("port,p",
+        po::value<std::uint16_t>(&port)->default_value(8080),
+        "Set cge port")
+      ("sessions,n",
+        po::value<std::size_t>(&sessions)->default_value(200),
+        "Set number of concurrent logins")
+      ("threads",
+        po::value<std::size_t>(&threads)->default_value(1),
+        "Set number of I/O threads")
+      ("timeout",
+        po::value<std::uint32_t>(&timeout)->default_value(30),
+        "Set timeout in seconds of each step")
+      ("username,u",
+        po::value<std::string>(&config.username)->default_value("UMU"),
+        "Set username")
+      ("verification-code",
+        po::value<std::string>(&config.verification_code)->default_value("123456"),
+        "Set verification code");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    if (0 == sessions || 0 == threads) {
+      throw std::out_of_range("sessions and threads must be positive!");
+    }
+    config.endpoint = tcp::endpoint(net::ip::make_address(host), port);
+    config.timeout = std::chrono::seconds(timeout);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  net::io_context ioc(static_cast<int>(threads));
+  Results results;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < sessions; ++i) {
+    std::make_shared<Session>(ioc, config, i, results)->Run();
+  }
+
+  std::vector<std::thread> io_threads;
+  io_threads.reserve(threads - 1);
+  for (std::size_t i = 1; i < threads; ++i) {
+    io_threads.emplace_back([&ioc] { ioc.run(); });
+  }
+  ioc.run();
+  for (auto& t : io_threads) {
+    t.join();
+  }
+
+  results.Report(sessions,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     Clock::now() - start));
+  return EXIT_SUCCESS;
+}
@@ -699,7 +699,8 @@ void SdlHack::CopyTextureToSharedYuv(D3D11_RenderData* render_data) {
   bool need_create_file_mapping = false;
   if (nullptr == shared_yuv_frames_) {
     need_create_file_mapping = true;
-  } else if (sizeof(SharedVideoYuvFrames) + data_size * kNumberOfSharedFrames >
+  } else if (GetSharedVideoYuvFramesSize(kDefaultNumberOfSharedYuvFrames,
+                                         data_size) >
              shared_yuv_frames_.GetMappingSize()) {
     hr = shared_yuv_frames_.Unmap();
     need_create_file_mapping = true;
@@ -713,7 +714,7 @@ void SdlHack::CopyTextureToSharedYuv(D3D11_RenderData* render_data) {
   if (need_create_file_mapping) {
     BOOL already_existed;
     hr = shared_yuv_frames_.MapSharedMem(
-        sizeof(SharedVideoYuvFrames) + data_size * kNumberOfSharedFrames,
+        GetSharedVideoYuvFramesSize(kDefaultNumberOfSharedYuvFrames, data_size),
         GetName(kSharedVideoYuvFramesFileMappingName).data(), &already_existed,
         &sa_);
     if (FAILED(hr)) {
@@ -726,17 +727,28 @@ void SdlHack::CopyTextureToSharedYuv(D3D11_RenderData* render_data) {
       return;
     }
 
-    ATLTRACE2(atlTraceUtil, 0, "MapSharedMem size = %zu + %zu * %zu = %zu\n",
-              sizeof(SharedVideoYuvFrames), data_size, kNumberOfSharedFrames,
-              sizeof(SharedVideoYuvFrames) + data_size * kNumberOfSharedFrames);
+    ATLTRACE2(atlTraceUtil, 0, "MapSharedMem size = %zu + %zu * %u = %zu\n",
+              sizeof(SharedVideoYuvFrames), data_size,
+              kDefaultNumberOfSharedYuvFrames,
+              GetSharedVideoYuvFramesSize(kDefaultNumberOfSharedYuvFrames,
+                                          data_size));
   }
   auto frames =
       static_cast<SharedVideoYuvFrames*>(shared_yuv_frames_.GetData());
-  frames->data_size = static_cast<uint32_t>(data_size);
+  if (need_create_file_mapping ||
+      frames->data_size != static_cast<uint32_t>(data_size)) {
+    ResetSharedVideoYuvFrames(frames, kDefaultNumberOfSharedYuvFrames,
+                              static_cast<uint32_t>(data_size));
+  }
 
-  auto frame = reinterpret_cast<PackedVideoYuvFrame*>(
-      static_cast<char*>(shared_yuv_frames_) + sizeof(SharedVideoYuvFrames) +
-      (frame_count_ % kNumberOfSharedFrames) * data_size);
+  const std::uint32_t index =
+      AcquireSharedFrameToWrite(frames, kDefaultNumberOfSharedYuvFrames);
+  if (kDefaultNumberOfSharedYuvFrames == index) {
+    ATLTRACE2(atlTraceUtil, 0, "frame[%zd] dropped, no free shared frame.\n",
+              frame_count_);
+    return;
+  }
+  auto frame = GetPackedVideoYuvFrame(frames, index);
   uint8_t* y = reinterpret_cast<uint8_t*>(frame->data);
   uint8_t* u = y + pixel_size;
 
@@ -827,6 +839,7 @@ void SdlHack::CopyTextureToSharedYuv(D3D11_RenderData* render_data) {
   frame->stats.elapsed.yuv_convert = stats.elapsed.yuv_convert;
   frame->stats.elapsed.total = stats.elapsed.total;
 
+  PublishSharedFrame(frames, index);
   ++frame_count_;
   SetEvent(shared_frame_ready_event_);
 }
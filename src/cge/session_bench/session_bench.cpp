@@ -0,0 +1,427 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the steady state of a session allocates nothing: streams
+// packets over a loopback WebSocket the way GameSession does, shared packets
+// of a PacketPool queued in a circular buffer and written with handler
+// memory, while the client answers each packet with a control packet which
+// the session reads. Once --warm-up packets in a row allocated nothing, the
+// heap allocations of the whole process are counted over --packets more, and
+// any fails the run.
+
+// C++, STL
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+
+// C++, Boost
+#include <boost/asio.hpp>
+#include <boost/circular_buffer.hpp>
+#include <boost/program_options.hpp>
+
+#include "handler_memory.hpp"
+#include "packet_pool.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+std::atomic<std::size_t> allocation_count{0};
+
+}  // namespace
+
+// The array, nothrow and sized forms forward to these.
+void* operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  for (;;) {
+    if (void* pointer = std::malloc(0 == size ? 1 : size); nullptr != pointer) {
+      return pointer;
+    }
+    auto handler = std::get_new_handler();
+    if (nullptr == handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// As GameSession.
+constexpr std::size_t kInitialQueueCapacity = 32;
+using Socket = net::basic_stream_socket<tcp, net::io_context::executor_type>;
+using Stream = beast::basic_stream<tcp, net::io_context::executor_type>;
+
+constexpr std::size_t kKeyframeInterval = 60;
+constexpr std::size_t kControlSize = 16;
+// Counts anyway after so many times --warm-up packets.
+constexpr std::size_t kMaxWarmUps = 100;
+
+struct Config {
+  std::size_t warm_up;
+  std::size_t packets;
+  std::size_t window;
+  std::size_t max_size;
+};
+
+struct Result {
+  std::size_t warm_up_packets = 0;
+  std::size_t allocations = 0;
+  std::size_t bytes = 0;
+  Clock::duration duration{};
+  std::size_t handler_memory_fallbacks = 0;
+  std::size_t queue_capacity = 0;
+  bool done = false;
+};
+
+// A keyframe every kKeyframeInterval packets, smaller packets of varying
+// sizes between them, like a video stream.
+std::size_t GetPacketSize(const Config& config, std::size_t index) {
+  if (0 == index % kKeyframeInterval) {
+    return config.max_size;
+  }
+  const std::size_t base = config.max_size / 16;
+  return base + index * 7919 % base;
+}
+
+class Session : public std::enable_shared_from_this<Session> {
+ public:
+  Session(net::io_context& ioc,
+          Socket&& socket,
+          PacketPool& packet_pool,
+          const Config& config,
+          Result& result) noexcept
+      : ioc_(ioc),
+        ws_(std::move(socket)),
+        packet_pool_(packet_pool),
+        config_(config),
+        result_(result) {}
+
+  void Run() {
+    ws_.binary(true);
+    ws_.async_accept(BindHandlerMemory(
+        handler_memory_,
+        beast::bind_front_handler(&Session::OnAccept, shared_from_this())));
+  }
+
+  // As GameSession::Write().
+  void Write(SharedPacket packet) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (write_queue_.full()) {
+      write_queue_.set_capacity(write_queue_.capacity() * 2);
+    }
+    write_queue_.push_back(std::move(packet));
+    if (1 < write_queue_.size()) {
+      return;
+    }
+    ws_.async_write(
+        net::buffer(write_queue_.front().Get()),
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Session::OnWrite,
+                                                    shared_from_this())));
+  }
+
+ private:
+  void OnAccept(beast::error_code ec) {
+    if (ec) {
+      std::cerr << "Error: accept, " << ec.message() << '\n';
+      return;
+    }
+    for (std::size_t i = 0; i < config_.window; ++i) {
+      Produce();
+    }
+    Read();
+  }
+
+  void Read() {
+    ws_.async_read(read_buffer_,
+                   BindHandlerMemory(
+                       handler_memory_,
+                       beast::bind_front_handler(&Session::OnRead,
+                                                 shared_from_this())));
+  }
+
+  // Each control packet read lets one more packet out, so that window
+  // packets are in flight.
+  void OnRead(beast::error_code ec, std::size_t /*bytes_transferred*/) {
+    if (ec) {
+      std::cerr << "Error: read, " << ec.message() << '\n';
+      return;
+    }
+    read_buffer_.consume(read_buffer_.size());
+    ++read_packets_;
+    if (!counting_) {
+      WarmUp();
+    } else if (config_.packets == ++counted_packets_) {
+      result_.allocations =
+          allocation_count.load(std::memory_order_relaxed) -
+          start_allocations_;
+      result_.bytes = written_bytes_ - start_bytes_;
+      result_.duration = Clock::now() - start_time_;
+      result_.handler_memory_fallbacks = handler_memory_.GetFallbackCount();
+      result_.queue_capacity = write_queue_.capacity();
+      result_.done = true;
+      ioc_.stop();
+      return;
+    }
+    Produce();
+    Read();
+  }
+
+  // Until --warm-up packets in a row allocated nothing, since the buffers of
+  // the pool grow as packets larger than the free ones come.
+  void WarmUp() {
+    const std::size_t allocations =
+        allocation_count.load(std::memory_order_relaxed);
+    if (start_allocations_ != allocations) {
+      start_allocations_ = allocations;
+      quiet_packets_ = 0;
+    } else {
+      ++quiet_packets_;
+    }
+    if (config_.warm_up == quiet_packets_ ||
+        config_.warm_up * kMaxWarmUps == read_packets_) {
+      counting_ = true;
+      result_.warm_up_packets = read_packets_;
+      start_bytes_ = written_bytes_;
+      start_time_ = Clock::now();
+    }
+  }
+
+  void OnWrite(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+      std::cerr << "Error: write, " << ec.message() << '\n';
+      return;
+    }
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    written_bytes_ += bytes_transferred;
+    write_queue_.pop_front();
+    if (!write_queue_.empty()) {
+      ws_.async_write(
+          net::buffer(write_queue_.front().Get()),
+          BindHandlerMemory(handler_memory_,
+                            beast::bind_front_handler(&Session::OnWrite,
+                                                      shared_from_this())));
+    }
+  }
+
+  // As Engine::WritePacket() and GameService::Send().
+  void Produce() {
+    const std::size_t size = GetPacketSize(config_, produced_packets_++);
+    std::string buffer = packet_pool_.Acquire(size);
+    buffer.front() = static_cast<char>(produced_packets_);
+    Write(packet_pool_.Share(std::move(buffer)));
+  }
+
+ private:
+  net::io_context& ioc_;
+  HandlerMemory handler_memory_;
+  websocket::stream<Stream> ws_;
+  PacketPool& packet_pool_;
+  const Config& config_;
+  Result& result_;
+  beast::flat_buffer read_buffer_;
+  std::size_t read_packets_ = 0;
+  std::size_t produced_packets_ = 0;
+
+  std::mutex queue_mutex_;
+  boost::circular_buffer<SharedPacket> write_queue_{kInitialQueueCapacity};
+  std::size_t written_bytes_ = 0;
+
+  bool counting_ = false;
+  std::size_t quiet_packets_ = 0;
+  std::size_t counted_packets_ = 0;
+  std::size_t start_allocations_ = 0;
+  std::size_t start_bytes_ = 0;
+  Clock::time_point start_time_;
+};
+
+// Answers every packet with a control packet, queued behind the one being
+// written if any.
+class Client : public std::enable_shared_from_this<Client> {
+ public:
+  explicit Client(net::io_context& ioc) : ws_(ioc.get_executor()) {}
+
+  void Run(const tcp::endpoint& endpoint) {
+    ws_.next_layer().async_connect(
+        endpoint,
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Client::OnConnect,
+                                                    shared_from_this())));
+  }
+
+ private:
+  void OnConnect(beast::error_code ec) {
+    if (ec) {
+      std::cerr << "Error: connect, " << ec.message() << '\n';
+      return;
+    }
+    ws_.binary(true);
+    ws_.async_handshake(
+        "localhost", "/",
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Client::OnHandshake,
+                                                    shared_from_this())));
+  }
+
+  void OnHandshake(beast::error_code ec) {
+    if (ec) {
+      std::cerr << "Error: handshake, " << ec.message() << '\n';
+      return;
+    }
+    Read();
+  }
+
+  void Read() {
+    ws_.async_read(read_buffer_,
+                   BindHandlerMemory(
+                       handler_memory_,
+                       beast::bind_front_handler(&Client::OnRead,
+                                                 shared_from_this())));
+  }
+
+  void OnRead(beast::error_code ec, std::size_t /*bytes_transferred*/) {
+    if (ec) {
+      return;
+    }
+    read_buffer_.consume(read_buffer_.size());
+    if (0 == pending_controls_++) {
+      WriteControl();
+    }
+    Read();
+  }
+
+  void WriteControl() {
+    ws_.async_write(
+        net::buffer(control_),
+        BindHandlerMemory(handler_memory_,
+                          beast::bind_front_handler(&Client::OnWrite,
+                                                    shared_from_this())));
+  }
+
+  void OnWrite(beast::error_code ec, std::size_t /*bytes_transferred*/) {
+    if (ec) {
+      return;
+    }
+    if (0 != --pending_controls_) {
+      WriteControl();
+    }
+  }
+
+ private:
+  HandlerMemory handler_memory_;
+  websocket::stream<Stream> ws_;
+  beast::flat_buffer read_buffer_;
+  std::array<std::uint8_t, kControlSize> control_{};
+  std::size_t pending_controls_ = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Config config{};
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("max-size",
+        po::value<std::size_t>(&config.max_size)->default_value(200'000),
+        "Set bytes of the largest packets, every 60th")
+      ("packets,n",
+        po::value<std::size_t>(&config.packets)->default_value(100'000),
+        "Set number of packets counted")
+      ("warm-up",
+        po::value<std::size_t>(&config.warm_up)->default_value(1'000),
+        "Set number of packets in a row without allocations before counting")
+      ("window",
+        po::value<std::size_t>(&config.window)->default_value(4),
+        "Set number of packets in flight, at most 32");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    // A session falling further behind grows its queue, which allocates.
+    if (0 == config.warm_up || 0 == config.packets || 0 == config.window ||
+        kInitialQueueCapacity < config.window || config.max_size < 16 ||
+        PacketPool::kMaxBufferCapacity < config.max_size) {
+      throw std::invalid_argument("option out of range!");
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  // Before the sessions, which return their packets to it.
+  PacketPool packet_pool;
+  Result result;
+  {
+    net::io_context ioc(1);
+    tcp::acceptor acceptor(ioc, {net::ip::make_address("127.0.0.1"), 0});
+    acceptor.async_accept(ioc, [&](beast::error_code ec, Socket socket) {
+      if (ec) {
+        std::cerr << "Error: accept, " << ec.message() << '\n';
+        return;
+      }
+      socket.set_option(tcp::no_delay(true));
+      std::make_shared<Session>(ioc, std::move(socket), packet_pool, config,
+                                result)
+          ->Run();
+    });
+    std::make_shared<Client>(ioc)->Run(acceptor.local_endpoint());
+    ioc.run();
+  }
+  if (!result.done) {
+    return EXIT_FAILURE;
+  }
+
+  const double seconds =
+      std::chrono::duration<double>(result.duration).count();
+  std::cout << "warm-up packets: " << result.warm_up_packets << '\n'
+            << "packets: " << config.packets << '\n'
+            << "packets/s: " << config.packets / seconds << '\n'
+            << "MB/s: " << result.bytes / seconds / 1'000'000 << '\n'
+            << "allocations: " << result.allocations << '\n'
+            << "handler memory fallbacks: "
+            << result.handler_memory_fallbacks << '\n'
+            << "queue capacity: " << result.queue_capacity << '\n';
+  if (0 != result.allocations) {
+    std::cerr << "Error: the steady state allocated.\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
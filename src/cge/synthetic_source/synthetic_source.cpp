@@ -0,0 +1,705 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Headless capturer: renders synthetic YUV frames into the shared video frame
+// protocol at a fixed frame rate, so the encoder can be measured without a
+// GPU or a game. Every run with the same options produces the same frames.
+//
+// Motions, from the cheapest to the most expensive to encode:
+// * static, color bars which never change;
+// * text, lines of glyphs scrolling up like a terminal or a chat;
+// * pan, a camera moving over a large textured world like a game;
+// * noise, every pixel random in every frame.
+
+// C++, STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// C++, Boost
+#include <boost/program_options.hpp>
+
+#include "regame/shared_frame_producer.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+using namespace regame;
+
+using Clock = std::chrono::steady_clock;
+
+enum class Motion { kStatic, kText, kPan, kNoise };
+
+struct Config {
+  std::uint32_t width = 0;
+  std::uint32_t height = 0;
+  std::uint32_t fps = 0;
+  VideoFrameType type = VideoFrameType::kNone;
+  Motion motion = Motion::kStatic;
+  std::uint32_t speed = 0;  // pixels per frame of text and pan
+  std::uint64_t seed = 0;
+  std::uint64_t frames = 0;  // 0 until stopped
+  std::uint32_t number_of_frames = 0;  // of the shared ring
+  std::wstring name_prefix;
+};
+
+std::atomic<bool> interrupted{false};
+
+void OnSignal(int) {
+  interrupted = true;
+}
+
+// xorshift64*
+class Random {
+ public:
+  explicit Random(std::uint64_t seed) noexcept : state_(seed | 1) {}
+
+  std::uint64_t Next() noexcept {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545F4914F6CDD1DULL;
+  }
+
+ private:
+  std::uint64_t state_;
+};
+
+std::uint64_t Hash(std::uint64_t x) noexcept {
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+struct Yuv {
+  std::uint8_t y;
+  std::uint8_t u;
+  std::uint8_t v;
+};
+
+// BT.601, full range. Limited range is applied to the whole frame.
+Yuv ToYuv(int r, int g, int b) noexcept {
+  auto clamp = [](double value) {
+    return static_cast<std::uint8_t>(std::clamp(std::lround(value), 0L, 255L));
+  };
+  return {clamp(0.299 * r + 0.587 * g + 0.114 * b),
+          clamp(128 - 0.168736 * r - 0.331264 * g + 0.5 * b),
+          clamp(128 + 0.5 * r - 0.418688 * g - 0.081312 * b)};
+}
+
+// Planar YUV of one VideoFrameType.
+class Layout {
+ public:
+  Layout(VideoFrameType type, std::uint32_t width, std::uint32_t height)
+      : width_(width), height_(height) {
+    switch (type) {
+      case VideoFrameType::kI420:
+        [[fallthrough]];
+      case VideoFrameType::kJ420:
+        chroma_shift_x_ = 1;
+        chroma_shift_y_ = 1;
+        break;
+      case VideoFrameType::kI422:
+        [[fallthrough]];
+      case VideoFrameType::kJ422:
+        chroma_shift_x_ = 1;
+        break;
+      default:
+        break;
+    }
+    full_range_ =
+        VideoFrameType::kJ420 == type || VideoFrameType::kJ422 == type;
+  }
+
+  std::uint32_t GetWidth(int plane) const noexcept {
+    return 0 == plane ? width_ : width_ >> chroma_shift_x_;
+  }
+  std::uint32_t GetHeight(int plane) const noexcept {
+    return 0 == plane ? height_ : height_ >> chroma_shift_y_;
+  }
+  int GetChromaShiftX() const noexcept { return chroma_shift_x_; }
+  int GetChromaShiftY() const noexcept { return chroma_shift_y_; }
+  std::size_t GetPlaneSize(int plane) const noexcept {
+    return static_cast<std::size_t>(GetWidth(plane)) * GetHeight(plane);
+  }
+  std::size_t GetOffset(int plane) const noexcept {
+    std::size_t offset = 0;
+    for (int i = 0; i < plane; ++i) {
+      offset += GetPlaneSize(i);
+    }
+    return offset;
+  }
+  std::size_t GetYuvSize() const noexcept { return GetOffset(3); }
+  bool IsFullRange() const noexcept { return full_range_; }
+
+ private:
+  std::uint32_t width_;
+  std::uint32_t height_;
+  int chroma_shift_x_ = 0;
+  int chroma_shift_y_ = 0;
+  bool full_range_ = false;
+};
+
+class Generator {
+ public:
+  explicit Generator(const Config& config)
+      : config_(config), layout_(config.type, config.width, config.height) {
+    if (!layout_.IsFullRange()) {
+      for (int i = 0; i < 256; ++i) {
+        luma_range_[i] = static_cast<std::uint8_t>(16 + (i * 219 + 127) / 255);
+        chroma_range_[i] =
+            static_cast<std::uint8_t>(128 + ((i - 128) * 224) / 255);
+      }
+    }
+
+    switch (config.motion) {
+      case Motion::kStatic:
+        RenderColorBars();
+        break;
+      case Motion::kText:
+        CreateGlyphs();
+        break;
+      case Motion::kPan:
+        RenderWorld();
+        break;
+      case Motion::kNoise:
+        break;
+    }
+  }
+
+  const Layout& GetLayout() const noexcept { return layout_; }
+
+  void Render(std::uint64_t index, std::uint8_t* yuv) {
+    switch (config_.motion) {
+      case Motion::kStatic:
+        std::memcpy(yuv, cache_.data(), cache_.size());
+        return;
+      case Motion::kText:
+        RenderText(index, yuv);
+        break;
+      case Motion::kPan:
+        RenderPan(index, yuv);
+        return;
+      case Motion::kNoise:
+        RenderNoise(index, yuv);
+        break;
+    }
+    ApplyRange(yuv);
+  }
+
+ private:
+  static constexpr std::uint32_t kGlyphWidth = 8;
+  static constexpr std::uint32_t kGlyphHeight = 16;
+  static constexpr std::size_t kNumberOfGlyphs = 64;
+  // Of the world in frames.
+  static constexpr std::uint32_t kWorldScale = 2;
+
+  void ApplyRange(std::uint8_t* yuv) const noexcept {
+    if (layout_.IsFullRange()) {
+      return;
+    }
+    std::uint8_t* end = yuv + layout_.GetPlaneSize(0);
+    for (std::uint8_t* p = yuv; p < end; ++p) {
+      *p = luma_range_[*p];
+    }
+    for (std::uint8_t* p = end; p < yuv + layout_.GetYuvSize(); ++p) {
+      *p = chroma_range_[*p];
+    }
+  }
+
+  // 75% bars over a luma ramp.
+  void RenderColorBars() {
+    static constexpr int kBars[][3] = {
+        {191, 191, 191}, {191, 191, 0}, {0, 191, 191}, {0, 191, 0},
+        {191, 0, 191},   {191, 0, 0},   {0, 0, 191},   {16, 16, 16}};
+    cache_.resize(layout_.GetYuvSize());
+    for (int plane = 0; plane < 3; ++plane) {
+      const std::uint32_t width = layout_.GetWidth(plane);
+      const std::uint32_t height = layout_.GetHeight(plane);
+      std::uint8_t* row = cache_.data() + layout_.GetOffset(plane);
+      for (std::uint32_t y = 0; y < height; ++y, row += width) {
+        const bool ramp = y >= height * 3 / 4;
+        for (std::uint32_t x = 0; x < width; ++x) {
+          if (ramp) {
+            row[x] = 0 == plane ? static_cast<std::uint8_t>(x * 255 / width)
+                                : 128;
+            continue;
+          }
+          const auto& bar = kBars[x * std::size(kBars) / width];
+          const Yuv yuv = ToYuv(bar[0], bar[1], bar[2]);
+          row[x] = 0 == plane ? yuv.y : 1 == plane ? yuv.u : yuv.v;
+        }
+      }
+    }
+    ApplyRange(cache_.data());
+  }
+
+  // Strokes of a 7-segment display and two diagonals, which have the edges
+  // of text without a font.
+  void CreateGlyphs() {
+    glyphs_.resize(kNumberOfGlyphs * kGlyphHeight);
+    for (std::size_t i = 0; i < kNumberOfGlyphs; ++i) {
+      const std::uint64_t segments = Hash(config_.seed + i) | 1;
+      std::uint8_t* rows = &glyphs_[i * kGlyphHeight];
+      auto horizontal = [rows](std::uint32_t y) { rows[y] |= 0x7C; };
+      auto vertical = [rows](std::uint32_t x, std::uint32_t top) {
+        for (std::uint32_t y = top; y < top + 5; ++y) {
+          rows[y] |= 0x80 >> x;
+        }
+      };
+      if (segments & 0x01) horizontal(3);
+      if (segments & 0x02) horizontal(8);
+      if (segments & 0x04) horizontal(13);
+      if (segments & 0x08) vertical(1, 3);
+      if (segments & 0x10) vertical(1, 8);
+      if (segments & 0x20) vertical(5, 3);
+      if (segments & 0x40) vertical(5, 8);
+      for (std::uint32_t y = 3; y <= 13; ++y) {
+        const std::uint32_t x = 1 + (y - 3) * 4 / 10;
+        if (segments & 0x80) rows[y] |= 0x80 >> x;
+        if (segments & 0x100) rows[y] |= 0x80 >> (6 - x);
+      }
+    }
+  }
+
+  // Light text on a dark background, the chroma is flat.
+  void RenderText(std::uint64_t index, std::uint8_t* yuv) const noexcept {
+    constexpr std::uint8_t kBackground = 24;
+    constexpr std::uint8_t kForeground = 220;
+    const std::uint32_t width = layout_.GetWidth(0);
+    const std::uint32_t height = layout_.GetHeight(0);
+    const std::uint32_t columns = width / kGlyphWidth;
+    const std::uint64_t scroll = index * config_.speed;
+
+    std::uint8_t* row = yuv;
+    for (std::uint32_t y = 0; y < height; ++y, row += width) {
+      std::memset(row, kBackground, width);
+      const std::uint64_t line = (scroll + y) / kGlyphHeight;
+      const std::uint32_t glyph_row = (scroll + y) % kGlyphHeight;
+      // Lines of different length, words of up to 8 glyphs.
+      const std::uint64_t line_hash = Hash(config_.seed ^ (line << 20));
+      const std::uint32_t length =
+          columns / 4 + static_cast<std::uint32_t>(line_hash % (columns + 1));
+      for (std::uint32_t column = 0; column < columns && column < length;
+           ++column) {
+        const std::uint64_t glyph_hash = Hash(line_hash + column);
+        if (0 == glyph_hash % 8) {
+          continue;  // space
+        }
+        const std::uint8_t bits =
+            glyphs_[(glyph_hash / 8 % kNumberOfGlyphs) * kGlyphHeight +
+                    glyph_row];
+        std::uint8_t* pixel = row + column * kGlyphWidth;
+        for (std::uint32_t x = 0; x < kGlyphWidth; ++x) {
+          if (bits & (0x80 >> x)) {
+            pixel[x] = kForeground;
+          }
+        }
+      }
+    }
+    std::memset(yuv + layout_.GetOffset(1), 128,
+                layout_.GetPlaneSize(1) + layout_.GetPlaneSize(2));
+  }
+
+  // Hills of value noise with buildings on them, kWorldScale times the frame
+  // in each direction and wrapping around.
+  void RenderWorld() {
+    constexpr std::uint32_t kCell = 64;
+    const std::uint32_t world_width = layout_.GetWidth(0) * kWorldScale;
+    const std::uint32_t world_height = layout_.GetHeight(0) * kWorldScale;
+    std::vector<std::uint8_t> red(std::size_t{world_width} * world_height);
+    std::vector<std::uint8_t> green(red.size());
+    std::vector<std::uint8_t> blue(red.size());
+
+    auto lattice = [this, world_width, world_height](
+                       std::uint32_t x, std::uint32_t y,
+                       std::uint32_t cell) -> double {
+      const std::uint32_t columns = std::max(world_width / cell, 1U);
+      const std::uint32_t rows = std::max(world_height / cell, 1U);
+      return (Hash(config_.seed ^ (std::uint64_t{cell} << 48) ^
+                   (std::uint64_t{y % rows} << 24) ^ (x % columns)) &
+              0xFFFF) /
+             65535.0;
+    };
+    auto noise = [&lattice](std::uint32_t x, std::uint32_t y,
+                            std::uint32_t cell) {
+      const double fx = static_cast<double>(x % cell) / cell;
+      const double fy = static_cast<double>(y % cell) / cell;
+      const double sx = fx * fx * (3 - 2 * fx);
+      const double sy = fy * fy * (3 - 2 * fy);
+      const std::uint32_t cx = x / cell;
+      const std::uint32_t cy = y / cell;
+      const double top = lattice(cx, cy, cell) +
+                         (lattice(cx + 1, cy, cell) - lattice(cx, cy, cell)) *
+                             sx;
+      const double bottom =
+          lattice(cx, cy + 1, cell) +
+          (lattice(cx + 1, cy + 1, cell) - lattice(cx, cy + 1, cell)) * sx;
+      return top + (bottom - top) * sy;
+    };
+
+    for (std::uint32_t y = 0; y < world_height; ++y) {
+      for (std::uint32_t x = 0; x < world_width; ++x) {
+        const double height = 0.6 * noise(x, y, kCell * 4) +
+                              0.3 * noise(x, y, kCell) +
+                              0.1 * noise(x, y, kCell / 8);
+        const std::size_t i = std::size_t{y} * world_width + x;
+        red[i] = static_cast<std::uint8_t>(60 + 120 * height);
+        green[i] = static_cast<std::uint8_t>(90 + 140 * height);
+        blue[i] = static_cast<std::uint8_t>(40 + 60 * height);
+      }
+    }
+
+    Random random(config_.seed);
+    const std::size_t buildings = std::size_t{world_width} * world_height /
+                                  (kCell * kCell * 4);
+    for (std::size_t i = 0; i < buildings; ++i) {
+      const std::uint32_t left = random.Next() % world_width;
+      const std::uint32_t top = random.Next() % world_height;
+      const std::uint32_t width = kCell / 2 + random.Next() % (kCell * 2);
+      const std::uint32_t height = kCell / 2 + random.Next() % (kCell * 2);
+      const std::uint64_t color = random.Next();
+      for (std::uint32_t y = top; y < top + height; ++y) {
+        for (std::uint32_t x = left; x < left + width; ++x) {
+          const std::size_t j =
+              std::size_t{y % world_height} * world_width + x % world_width;
+          // Windows every 8 pixels.
+          const int shade = (x - left) % 8 < 2 || (y - top) % 8 < 2 ? 0 : 40;
+          red[j] = static_cast<std::uint8_t>((color & 0x7F) + shade);
+          green[j] = static_cast<std::uint8_t>((color >> 8 & 0x7F) + shade);
+          blue[j] = static_cast<std::uint8_t>((color >> 16 & 0x7F) + shade);
+        }
+      }
+    }
+
+    std::size_t size = 0;
+    for (int plane = 0; plane < 3; ++plane) {
+      size += layout_.GetPlaneSize(plane) * kWorldScale * kWorldScale;
+    }
+    cache_.resize(size);
+    std::uint8_t* out = cache_.data();
+    for (int plane = 0; plane < 3; ++plane) {
+      const int shift_x = 0 == plane ? 0 : layout_.GetChromaShiftX();
+      const int shift_y = 0 == plane ? 0 : layout_.GetChromaShiftY();
+      const std::uint32_t width = layout_.GetWidth(plane) * kWorldScale;
+      const std::uint32_t height = layout_.GetHeight(plane) * kWorldScale;
+      for (std::uint32_t y = 0; y < height; ++y) {
+        for (std::uint32_t x = 0; x < width; ++x) {
+          const std::size_t i =
+              std::size_t{y << shift_y} * world_width + (x << shift_x);
+          const Yuv yuv = ToYuv(red[i], green[i], blue[i]);
+          const std::uint8_t value =
+              0 == plane ? yuv.y : 1 == plane ? yuv.u : yuv.v;
+          *out++ = layout_.IsFullRange() ? value
+                   : 0 == plane          ? luma_range_[value]
+                                         : chroma_range_[value];
+        }
+      }
+    }
+  }
+
+  // Steady pan to the right with a slow vertical sway.
+  void RenderPan(std::uint64_t index, std::uint8_t* yuv) const noexcept {
+    const std::uint32_t world_width = layout_.GetWidth(0) * kWorldScale;
+    const std::uint32_t world_height = layout_.GetHeight(0) * kWorldScale;
+    const std::uint64_t x0 = index * config_.speed % world_width;
+    const double sway =
+        std::sin(static_cast<double>(index) / config_.fps * 0.5);
+    const std::uint64_t y0 = static_cast<std::uint64_t>(
+        (sway + 1) / 2 * (world_height - layout_.GetHeight(0)));
+
+    const std::uint8_t* world = cache_.data();
+    for (int plane = 0; plane < 3; ++plane) {
+      const int shift_x = 0 == plane ? 0 : layout_.GetChromaShiftX();
+      const int shift_y = 0 == plane ? 0 : layout_.GetChromaShiftY();
+      const std::uint32_t width = layout_.GetWidth(plane);
+      const std::uint32_t height = layout_.GetHeight(plane);
+      const std::uint32_t plane_world_width = width * kWorldScale;
+      const std::uint32_t plane_world_height = height * kWorldScale;
+      const std::uint32_t left = static_cast<std::uint32_t>(x0 >> shift_x);
+      const std::uint32_t top = static_cast<std::uint32_t>(y0 >> shift_y);
+      // Wraps at the right edge of the world.
+      const std::uint32_t first = std::min(width, plane_world_width - left);
+      for (std::uint32_t y = 0; y < height; ++y) {
+        const std::uint8_t* source =
+            world + std::size_t{(top + y) % plane_world_height} *
+                        plane_world_width;
+        std::memcpy(yuv, source + left, first);
+        std::memcpy(yuv + first, source, width - first);
+        yuv += width;
+      }
+      world += std::size_t{plane_world_width} * plane_world_height;
+    }
+  }
+
+  void RenderNoise(std::uint64_t index, std::uint8_t* yuv) const noexcept {
+    Random random(Hash(config_.seed + index));
+    const std::size_t size = layout_.GetYuvSize();
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+      const std::uint64_t value = random.Next();
+      std::memcpy(yuv + i, &value, sizeof(value));
+    }
+    for (; i < size; ++i) {
+      yuv[i] = static_cast<std::uint8_t>(random.Next());
+    }
+  }
+
+ private:
+  const Config& config_;
+  Layout layout_;
+  std::uint8_t luma_range_[256]{};
+  std::uint8_t chroma_range_[256]{};
+  // Frame of kStatic, world of kPan.
+  std::vector<std::uint8_t> cache_;
+  std::vector<std::uint8_t> glyphs_;
+};
+
+struct Statistics {
+  std::uint64_t published = 0;
+  std::uint64_t dropped = 0;  // no free slot
+  std::uint64_t late = 0;     // missed the frame interval
+  Clock::duration render{};
+  Clock::duration max_render{};
+  Clock::duration elapsed{};
+
+  void Report() const {
+    std::cout << "published: " << published << '\n'
+              << "dropped: " << dropped << '\n'
+              << "late: " << late << '\n';
+    if (0 == published) {
+      return;
+    }
+    auto to_milliseconds = [](Clock::duration duration) {
+      return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    std::cout << "fps: "
+              << published / std::chrono::duration<double>(elapsed).count()
+              << '\n'
+              << "render (ms):\n"
+              << "  mean: " << to_milliseconds(render / published) << '\n'
+              << "  max: " << to_milliseconds(max_render) << '\n';
+  }
+};
+
+// Returns false if interrupted.
+bool WaitForEncoder(SharedFrameProducer& producer) {
+  std::cout << "Waiting for the encoder...\n";
+  while (!interrupted) {
+    if (producer.WaitForEncoder(std::chrono::milliseconds(100))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Until the encoder stops, config.frames are published or interrupted.
+void Publish(const Config& config,
+             Generator& generator,
+             SharedFrameProducer& producer,
+             Statistics& statistics) {
+  producer.Start(config.type, config.width, config.height);
+
+  const auto interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::seconds(1)) / config.fps;
+  const auto start = Clock::now();
+  auto next = start;
+  for (; !interrupted && (0 == config.frames ||
+                          statistics.published < config.frames);
+       next += interval) {
+    std::this_thread::sleep_until(next);
+    if (producer.IsEncoderStopped()) {
+      std::cout << "The encoder is stopped.\n";
+      break;
+    }
+    const auto now = Clock::now();
+    if (now > next + interval) {
+      // Don't catch up with a burst.
+      ++statistics.late;
+      next = now;
+    }
+
+    PackedVideoYuvFrame* frame = producer.Acquire();
+    if (nullptr == frame) {
+      ++statistics.dropped;
+      continue;
+    }
+    const std::uint64_t timestamp = GetTimestamp();
+    generator.Render(statistics.published + statistics.dropped, frame->data);
+    const auto render = Clock::now() - now;
+    statistics.render += render;
+    statistics.max_render = std::max(statistics.max_render, render);
+
+    frame->stats = {};
+    frame->stats.timestamp = timestamp;
+    frame->stats.elapsed.yuv_convert = GetTimestamp() - timestamp;
+    frame->stats.elapsed.total = frame->stats.elapsed.yuv_convert;
+    producer.Publish();
+    ++statistics.published;
+  }
+  statistics.elapsed += Clock::now() - start;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string type;
+  std::string motion;
+  std::string name_prefix;
+  bool global_mode = false;
+  Config config;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("fps",
+        po::value<std::uint32_t>(&config.fps)->default_value(60),
+        "Set frames per second")
+      ("frames,n",
+        po::value<std::uint64_t>(&config.frames)->default_value(0),
+        "Set number of frames to publish, 0 until Ctrl+C")
+      ("frame-type",
+        po::value<std::string>(&type)->default_value("i420"),
+        "Set frame type, i420, j420, i422, j422 or i444")
+      ("global-mode",
+        po::value<bool>(&global_mode)->default_value(false),
+        "Set global mode")
+      ("height",
+        po::value<std::uint32_t>(&config.height)->default_value(1080),
+        "Set frame height")
+      ("motion",
+        po::value<std::string>(&motion)->default_value("pan"),
+        "Set motion, static, text, pan or noise")
+      ("name-prefix",
+        po::value<std::string>(&name_prefix)->default_value(""),
+        "Set prefix of shared object names, such as Regame0_")
+      ("ring-size",
+        po::value<std::uint32_t>(&config.number_of_frames)->default_value(
+            kDefaultNumberOfSharedYuvFrames),
+        "Set number of shared frames")
+      ("seed",
+        po::value<std::uint64_t>(&config.seed)->default_value(1),
+        "Set seed of the generated content")
+      ("speed",
+        po::value<std::uint32_t>(&config.speed)->default_value(4),
+        "Set pixels per frame of text and pan")
+      ("width",
+        po::value<std::uint32_t>(&config.width)->default_value(1920),
+        "Set frame width");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+
+    if ("i420" == type) {
+      config.type = VideoFrameType::kI420;
+    } else if ("j420" == type) {
+      config.type = VideoFrameType::kJ420;
+    } else if ("i422" == type) {
+      config.type = VideoFrameType::kI422;
+    } else if ("j422" == type) {
+      config.type = VideoFrameType::kJ422;
+    } else if ("i444" == type) {
+      config.type = VideoFrameType::kI444;
+    } else if ("tex" == type) {
+      // Shared D3D11 textures need a GPU, use video_source.
+      throw std::invalid_argument("tex is not supported headless!");
+    } else {
+      throw std::invalid_argument("Unknown frame type " + type + '!');
+    }
+
+    if ("static" == motion) {
+      config.motion = Motion::kStatic;
+    } else if ("text" == motion) {
+      config.motion = Motion::kText;
+    } else if ("pan" == motion) {
+      config.motion = Motion::kPan;
+    } else if ("noise" == motion) {
+      config.motion = Motion::kNoise;
+    } else {
+      throw std::invalid_argument("Unknown motion " + motion + '!');
+    }
+
+    if (0 == config.width || 0 == config.height || 0 != config.width % 2 ||
+        0 != config.height % 2) {
+      throw std::out_of_range("width and height must be positive and even!");
+    }
+    if (0 == config.fps) {
+      throw std::out_of_range("fps must be positive!");
+    }
+    if (config.number_of_frames < 2 ||
+        kMaxNumberOfSharedYuvFrames < config.number_of_frames) {
+      throw std::out_of_range("ring-size must be between 2 and " +
+                              std::to_string(kMaxNumberOfSharedYuvFrames) +
+                              '!');
+    }
+    if (global_mode) {
+      config.name_prefix = L"Global\\";
+    }
+    config.name_prefix.append(name_prefix.begin(), name_prefix.end());
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Rendering...\n";
+  Generator generator(config);
+  SharedFrameProducer producer;
+  auto ec = producer.Open(
+      config.name_prefix, config.number_of_frames,
+      static_cast<std::uint32_t>(sizeof(PackedVideoYuvFrame) +
+                                 generator.GetLayout().GetYuvSize()));
+  if (ec) {
+    std::cerr << "Error: " << ec.message() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+
+  Statistics statistics;
+  while (WaitForEncoder(producer)) {
+    std::cout << "The encoder is started.\n";
+    Publish(config, generator, producer, statistics);
+    if (0 != config.frames && statistics.published >= config.frames) {
+      break;
+    }
+  }
+
+  producer.Close();
+  statistics.Report();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Wake-up latency of the shared memory transport between the capturer and
+// the encoder: the producer stores a timestamp in shared memory and signals
+// the frame ready event, the consumer measures how long it took to wake up.
+//
+// --role both runs the two sides as threads of one process. To measure across
+// processes, start --role consumer first, then --role producer.
+
+// C++, STL
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+// C++, Boost
+#include <boost/program_options.hpp>
+
+#include "regame/shared_mem_transport.h"
+
+namespace po = boost::program_options;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::wstring_view kStopEventName{
+    L"{0F4A6D0E-7C55-4B0B-9E0A-6A4C8E6B2E11}"};
+constexpr std::wstring_view kReadyEventName{
+    L"{5B1E3C7A-2D8F-4E61-A0C4-3F9B7D2E8A52}"};
+constexpr std::wstring_view kMemoryName{
+    L"{9C2D4E6F-8A1B-4C3D-B5E7-1F0A2B4C6D83}"};
+
+struct Shared {
+  std::atomic<std::int64_t> signal_time;  // Clock ticks
+};
+
+struct Transport {
+  regame::SharedEvent stop_event;
+  regame::SharedEvent ready_event;
+  regame::SharedMemory memory;
+
+  bool Open() {
+    std::error_code ec;
+    if ((ec = stop_event.Create(kStopEventName, true)) ||
+        (ec = ready_event.Create(kReadyEventName, false)) ||
+        (ec = memory.Create(kMemoryName, sizeof(Shared)))) {
+      std::cerr << "Error: " << ec.message() << '\n';
+      return false;
+    }
+    return true;
+  }
+
+  Shared* Get() const { return memory.As<Shared>(); }
+};
+
+void Produce(Transport& transport,
+             std::size_t iterations,
+             std::chrono::microseconds interval) {
+  for (std::size_t i = 0; i < iterations; ++i) {
+    std::this_thread::sleep_for(interval);
+    transport.Get()->signal_time.store(
+        Clock::now().time_since_epoch().count(), std::memory_order_release);
+    transport.ready_event.Set();
+  }
+  // Let the consumer take the last frame before stopping it.
+  std::this_thread::sleep_for(interval);
+  transport.stop_event.Set();
+}
+
+std::vector<std::chrono::nanoseconds> Consume(Transport& transport) {
+  std::vector<std::chrono::nanoseconds> latencies;
+  for (;;) {
+    std::size_t wait =
+        regame::WaitForAny({&transport.stop_event, &transport.ready_event});
+    const auto now = Clock::now();
+    if (1 != wait) {
+      break;
+    }
+    const Clock::time_point signal_time(Clock::duration(
+        transport.Get()->signal_time.load(std::memory_order_acquire)));
+    latencies.emplace_back(now - signal_time);
+  }
+  return latencies;
+}
+
+// iterations is 0 if the producer is another process.
+void Report(std::vector<std::chrono::nanoseconds> latencies,
+            std::size_t iterations) {
+  if (0 != iterations) {
+    std::cout << "signaled: " << iterations << '\n';
+  }
+  std::cout << "woken: " << latencies.size() << '\n';
+  if (latencies.empty()) {
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto to_microseconds = [](std::chrono::nanoseconds latency) {
+    return latency.count() / 1000.0;
+  };
+  // Nearest rank.
+  auto percentile = [&latencies](double percentile) {
+    auto rank = static_cast<std::size_t>(
+        std::ceil(percentile / 100.0 * latencies.size()));
+    return latencies[std::clamp<std::size_t>(rank, 1, latencies.size()) - 1];
+  };
+  auto total = std::accumulate(latencies.begin(), latencies.end(),
+                               std::chrono::nanoseconds(0));
+  std::cout << "wake-up latency (us):\n"
+            << "  min: " << to_microseconds(latencies.front()) << '\n'
+            << "  mean: " << to_microseconds(total / latencies.size())
+            << '\n';
+  for (double p : {50.0, 90.0, 99.0, 99.9}) {
+    std::cout << "  p" << p << ": " << to_microseconds(percentile(p)) << '\n';
+  }
+  std::cout << "  max: " << to_microseconds(latencies.back()) << '\n';
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string role;
+  std::size_t iterations = 0;
+  std::uint32_t interval = 0;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("interval",
+        po::value<std::uint32_t>(&interval)->default_value(1000),
+        "Set microseconds between signals")
+      ("iterations,n",
+        po::value<std::size_t>(&iterations)->default_value(10000),
+        "Set number of signals")
+      ("role",
+        po::value<std::string>(&role)->default_value("both"),
+        "Set role, both, producer or consumer");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    if ("both" != role && "producer" != role && "consumer" != role) {
+      throw std::invalid_argument("role must be both, producer or consumer!");
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  Transport transport;
+  if (!transport.Open()) {
+    return EXIT_FAILURE;
+  }
+  if ("producer" != role) {
+    transport.stop_event.Reset();
+    transport.ready_event.Reset();
+  }
+
+  if ("producer" == role) {
+    Produce(transport, iterations, std::chrono::microseconds(interval));
+    return EXIT_SUCCESS;
+  }
+
+  std::thread producer;
+  if ("both" == role) {
+    producer = std::thread(Produce, std::ref(transport), iterations,
+                           std::chrono::microseconds(interval));
+  }
+  auto latencies = Consume(transport);
+  if (producer.joinable()) {
+    producer.join();
+  }
+
+  regame::SharedEvent::Unlink(kStopEventName);
+  regame::SharedEvent::Unlink(kReadyEventName);
+  regame::SharedMemory::Unlink(kMemoryName);
+  Report(std::move(latencies), "both" == role ? iterations : 0);
+  return EXIT_SUCCESS;
+}
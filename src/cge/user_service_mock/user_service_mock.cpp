@@ -0,0 +1,425 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A stand-in for regame-user-service, to exercise cge's UserManager without
+// the real one. Speaks JSON-RPC 2.0 over HTTP/1.1 keep-alive, including
+// batches, and accepts every login with a non-empty username.
+
+// C++, STL
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// C++, Boost
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/json.hpp>
+#include <boost/program_options.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace json = boost::json;
+namespace net = boost::asio;
+namespace po = boost::program_options;
+
+using tcp = net::ip::tcp;
+
+namespace {
+
+constexpr std::uint16_t kDefaultPort = 8545;
+constexpr std::int64_t kDefaultInterval = 60;
+
+// JSON-RPC 2.0 error codes.
+constexpr std::int64_t kInvalidRequest = -32600;
+constexpr std::int64_t kMethodNotFound = -32601;
+constexpr std::int64_t kInvalidParams = -32602;
+constexpr std::int64_t kServerError = -32000;
+
+struct Config {
+  std::chrono::milliseconds latency{0};
+  std::chrono::milliseconds jitter{0};
+  double failure_rate = 0.0;
+  std::int64_t interval = kDefaultInterval;
+};
+
+struct Stats {
+  std::atomic<std::uint64_t> connections{0};
+  std::atomic<std::uint64_t> requests{0};
+  std::atomic<std::uint64_t> batches{0};
+  std::atomic<std::uint64_t> logins{0};
+  std::atomic<std::uint64_t> keepalives{0};
+  std::atomic<std::uint64_t> logouts{0};
+  std::atomic<std::uint64_t> failures{0};
+};
+
+class UserService {
+ public:
+  explicit UserService(const Config& config) : config_(config) {}
+
+  // Returns null for a notification.
+  json::value Call(const json::value& call) {
+    auto jo = call.if_object();
+    if (nullptr == jo) {
+      return MakeError(nullptr, kInvalidRequest, "Invalid Request");
+    }
+    json::value id = nullptr;
+    bool notification = true;
+    if (auto id_jv = jo->if_contains("id"); nullptr != id_jv) {
+      id = *id_jv;
+      notification = false;
+    }
+    auto method_jv = jo->if_contains("method");
+    auto params_jv = jo->if_contains("params");
+    if (nullptr == method_jv || !method_jv->is_string() ||
+        nullptr == params_jv || !params_jv->is_object()) {
+      return MakeError(id, kInvalidRequest, "Invalid Request");
+    }
+
+    json::value response;
+    if (Fail()) {
+      ++stats_.failures;
+      response = MakeError(id, kServerError, "Injected failure");
+    } else {
+      const auto& method = method_jv->get_string();
+      const auto& params = params_jv->get_object();
+      if ("login" == method) {
+        ++stats_.logins;
+        response = Login(id, params);
+      } else if ("keepalive" == method) {
+        ++stats_.keepalives;
+        response = KeepAlive(id, params);
+      } else if ("logout" == method) {
+        ++stats_.logouts;
+        response = Logout(id, params);
+      } else {
+        response = MakeError(id, kMethodNotFound, "Method not found");
+      }
+    }
+    if (notification) {
+      return nullptr;
+    }
+    return response;
+  }
+
+  std::chrono::milliseconds GetDelay() {
+    if (0 == config_.jitter.count()) {
+      return config_.latency;
+    }
+    std::lock_guard<std::mutex> lock(random_mutex_);
+    std::uniform_int_distribution<std::int64_t> distribution(
+        -config_.jitter.count(), config_.jitter.count());
+    return std::max(std::chrono::milliseconds(0),
+                    config_.latency +
+                        std::chrono::milliseconds(distribution(random_)));
+  }
+
+  Stats& GetStats() noexcept { return stats_; }
+
+ private:
+  bool Fail() {
+    if (config_.failure_rate <= 0.0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(random_mutex_);
+    return std::bernoulli_distribution(config_.failure_rate)(random_);
+  }
+
+  json::value Login(const json::value& id, const json::object& params) {
+    auto username = params.if_contains("username");
+    if (nullptr == username || !username->is_string() ||
+        username->get_string().empty()) {
+      return MakeError(id, kInvalidParams, "Invalid params");
+    }
+    std::string session_id = std::to_string(next_session_id_.fetch_add(1));
+    {
+      std::lock_guard<std::mutex> lock(session_mutex_);
+      sessions_.emplace(session_id);
+    }
+    return MakeResult(id, session_id);
+  }
+
+  json::value KeepAlive(const json::value& id, const json::object& params) {
+    auto session_id = params.if_contains("session_id");
+    if (nullptr == session_id || !session_id->is_string()) {
+      return MakeError(id, kInvalidParams, "Invalid params");
+    }
+    std::string key(session_id->get_string());
+    {
+      std::lock_guard<std::mutex> lock(session_mutex_);
+      if (!sessions_.contains(key)) {
+        return MakeError(id, kInvalidParams, "Unknown session");
+      }
+    }
+    return MakeResult(id, key);
+  }
+
+  json::value Logout(const json::value& id, const json::object& params) {
+    auto session_id = params.if_contains("session_id");
+    if (nullptr != session_id && session_id->is_string()) {
+      std::lock_guard<std::mutex> lock(session_mutex_);
+      sessions_.erase(std::string(session_id->get_string()));
+    }
+    return json::object{{"jsonrpc", "2.0"}, {"id", id}, {"result", true}};
+  }
+
+  json::value MakeResult(const json::value& id,
+                         const std::string& session_id) {
+    json::object result{{"session_id", session_id},
+                        {"interval", config_.interval}};
+    return json::object{{"jsonrpc", "2.0"}, {"id", id}, {"result", result}};
+  }
+
+  static json::value MakeError(const json::value& id,
+                               std::int64_t code,
+                               std::string_view message) {
+    json::object error{{"code", code}, {"message", message}};
+    return json::object{{"jsonrpc", "2.0"}, {"id", id}, {"error", error}};
+  }
+
+ private:
+  const Config& config_;
+  Stats stats_;
+
+  std::mutex random_mutex_;
+  std::mt19937_64 random_{std::random_device{}()};
+
+  std::atomic<std::uint64_t> next_session_id_{1};
+  std::mutex session_mutex_;
+  std::unordered_set<std::string> sessions_;
+};
+
+// Requests of a connection are answered in order, so pipelining works.
+class Session : public std::enable_shared_from_this<Session> {
+ public:
+  Session(tcp::socket&& socket, UserService& service)
+      : stream_(std::move(socket)),
+        timer_(stream_.get_executor()),
+        service_(service) {}
+
+  void Run() { Read(); }
+
+ private:
+  void Read() {
+    request_ = {};
+    http::async_read(
+        stream_, buffer_, request_,
+        beast::bind_front_handler(&Session::OnRead, shared_from_this()));
+  }
+
+  void OnRead(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+      return;
+    }
+    ++service_.GetStats().requests;
+
+    response_ = {};
+    response_.version(request_.version());
+    response_.keep_alive(request_.keep_alive());
+    response_.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+
+    json::error_code json_ec;
+    auto jv = json::parse(request_.body(), json_ec);
+    json::value result;
+    if (json_ec) {
+      response_.result(http::status::bad_request);
+    } else if (auto batch = jv.if_array(); nullptr != batch) {
+      ++service_.GetStats().batches;
+      json::array results;
+      for (const auto& call : *batch) {
+        if (auto r = service_.Call(call); !r.is_null()) {
+          results.emplace_back(std::move(r));
+        }
+      }
+      if (!results.empty()) {
+        result = std::move(results);
+      }
+    } else {
+      result = service_.Call(jv);
+    }
+
+    if (!json_ec) {
+      if (result.is_null()) {
+        response_.result(http::status::no_content);
+      } else {
+        response_.result(http::status::ok);
+        response_.set(http::field::content_type,
+                      "application/json; charset=utf-8");
+        response_.body() = json::serialize(result);
+      }
+    }
+    response_.prepare_payload();
+
+    timer_.expires_after(service_.GetDelay());
+    timer_.async_wait(
+        beast::bind_front_handler(&Session::OnDelay, shared_from_this()));
+  }
+
+  void OnDelay(beast::error_code ec) {
+    http::async_write(
+        stream_, response_,
+        beast::bind_front_handler(&Session::OnWrite, shared_from_this()));
+  }
+
+  void OnWrite(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+      return;
+    }
+    if (!response_.keep_alive()) {
+      stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+      return;
+    }
+    Read();
+  }
+
+ private:
+  beast::tcp_stream stream_;
+  net::steady_timer timer_;
+  beast::flat_buffer buffer_;
+  http::request<http::string_body> request_;
+  http::response<http::string_body> response_;
+  UserService& service_;
+};
+
+class Listener : public std::enable_shared_from_this<Listener> {
+ public:
+  Listener(net::io_context& ioc,
+           const tcp::endpoint& endpoint,
+           UserService& service)
+      : ioc_(ioc), acceptor_(ioc, endpoint), service_(service) {}
+
+  void Run() { Accept(); }
+
+ private:
+  void Accept() {
+    acceptor_.async_accept(
+        net::make_strand(ioc_),
+        beast::bind_front_handler(&Listener::OnAccept, shared_from_this()));
+  }
+
+  void OnAccept(beast::error_code ec, tcp::socket socket) {
+    if (ec) {
+      std::cerr << "accept: " << ec.message() << '\n';
+    } else {
+      ++service_.GetStats().connections;
+      std::make_shared<Session>(std::move(socket), service_)->Run();
+    }
+    Accept();
+  }
+
+ private:
+  net::io_context& ioc_;
+  tcp::acceptor acceptor_;
+  UserService& service_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string bind_address;
+  std::uint16_t port = 0;
+  std::uint32_t latency = 0;
+  std::uint32_t jitter = 0;
+  std::size_t threads = 0;
+  Config config;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("bind-address",
+        po::value<std::string>(&bind_address)->default_value("::"),
+        "Set bind address for listening. eg: 0.0.0.0")
+      ("failure-rate",
+        po::value<double>(&config.failure_rate)->default_value(0.0),
+        "Set the rate of calls answered with an error. [0, 1]")
+      ("interval",
+        po::value<std::int64_t>(&config.interval)->default_value(kDefaultInterval),
+        "Set keepalive interval in seconds told to cge")
+      ("jitter",
+        po::value<std::uint32_t>(&jitter)->default_value(0),
+        "Set latency jitter in milliseconds, uniformly distributed")
+      ("latency",
+        po::value<std::uint32_t>(&latency)->default_value(0),
+        "Set latency in milliseconds added to every response")
+      ("port,p",
+        po::value<std::uint16_t>(&port)->default_value(kDefaultPort),
+        "Set the service port")
+      ("threads",
+        po::value<std::size_t>(&threads)->default_value(1),
+        "Set number of I/O threads");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    if (config.failure_rate < 0.0 || 1.0 < config.failure_rate) {
+      throw std::out_of_range("failure-rate out of range!");
+    }
+    if (0 == threads) {
+      throw std::out_of_range("threads out of range!");
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  config.latency = std::chrono::milliseconds(latency);
+  config.jitter = std::chrono::milliseconds(jitter);
+
+  net::io_context ioc(static_cast<int>(threads));
+  UserService service(config);
+  try {
+    tcp::endpoint endpoint(net::ip::make_address(bind_address), port);
+    std::make_shared<Listener>(ioc, endpoint, service)->Run();
+    std::cout << "Mock user service on " << endpoint << '\n';
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  net::signal_set signals(ioc, SIGINT, SIGTERM);
+  signals.async_wait([&](const beast::error_code&, int) { ioc.stop(); });
+
+  std::vector<std::thread> io_threads;
+  io_threads.reserve(threads - 1);
+  for (std::size_t i = 1; i < threads; ++i) {
+    io_threads.emplace_back([&ioc] { ioc.run(); });
+  }
+  ioc.run();
+  for (auto& t : io_threads) {
+    t.join();
+  }
+
+  auto& stats = service.GetStats();
+  std::cout << "connections: " << stats.connections << '\n'
+            << "requests: " << stats.requests << '\n'
+            << "batches: " << stats.batches << '\n'
+            << "logins: " << stats.logins << '\n'
+            << "keepalives: " << stats.keepalives << '\n'
+            << "logouts: " << stats.logouts << '\n'
+            << "failures: " << stats.failures << '\n';
+  return EXIT_SUCCESS;
+}
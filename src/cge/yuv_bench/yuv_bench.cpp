@@ -0,0 +1,258 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the ways cge can turn a captured BGRA or RGBA texture into a
+// smaller I420 frame: swscale in one call, yuv conversion at the source size
+// followed by swscale, and the fused scale and conversion of yuv.
+
+// C++, STL
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// C++, Boost
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#pragma warning(push)
+#pragma warning(disable : 4819)
+_CRT_BEGIN_C_HEADER
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+_CRT_END_C_HEADER
+#pragma warning(pop)
+
+#include "yuv/yuv.h"
+
+#pragma comment(lib, "avutil.lib")
+#pragma comment(lib, "swscale.lib")
+#pragma comment(lib, "yuv.lib")
+
+namespace po = boost::program_options;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Size {
+  int width = 0;
+  int height = 0;
+};
+
+struct Config {
+  Size source;
+  Size output;
+  bool rgba = false;
+  int frames = 0;
+};
+
+// WIDTHxHEIGHT, even.
+Size ParseSize(const std::string& text, const char* name) {
+  std::vector<std::string> arr;
+  boost::algorithm::split(arr, text, boost::is_any_of("x"));
+  if (2 != arr.size()) {
+    throw std::invalid_argument(std::string(name) +
+                                " must be WIDTHxHEIGHT!");
+  }
+  Size size{std::stoi(arr[0]), std::stoi(arr[1])};
+  if (size.width < 2 || size.height < 2 || 0 != (size.width & 1) ||
+      0 != (size.height & 1)) {
+    throw std::out_of_range(std::string(name) + " out of range!");
+  }
+  return size;
+}
+
+class Planes {
+ public:
+  Planes(int width, int height)
+      : width_(width),
+        height_(height),
+        buffer_(static_cast<std::size_t>(width) * height * 3 / 2) {}
+
+  std::uint8_t* Y() noexcept { return buffer_.data(); }
+  std::uint8_t* U() noexcept { return Y() + width_ * height_; }
+  std::uint8_t* V() noexcept { return U() + width_ * height_ / 4; }
+  int StrideY() const noexcept { return width_; }
+  int StrideUV() const noexcept { return width_ / 2; }
+
+  std::uint8_t* const* Data() noexcept {
+    data_[0] = Y();
+    data_[1] = U();
+    data_[2] = V();
+    return data_;
+  }
+  const int* Linesize() const noexcept { return linesize_; }
+
+ private:
+  int width_;
+  int height_;
+  std::vector<std::uint8_t> buffer_;
+  std::uint8_t* data_[4]{};
+  int linesize_[4]{width_, width_ / 2, width_ / 2, 0};
+};
+
+// Milliseconds per frame.
+double Run(int frames, const std::function<bool()>& convert) {
+  const auto start = Clock::now();
+  for (int i = 0; i < frames; ++i) {
+    if (!convert()) {
+      return -1.0;
+    }
+  }
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+             .count() /
+         frames;
+}
+
+void Report(const char* name, double milliseconds) {
+  std::cout << name << ": ";
+  if (milliseconds < 0) {
+    std::cout << "failed\n";
+  } else {
+    std::cout << milliseconds << " ms\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string source_size;
+  std::string output_size;
+  std::string format;
+  Config config;
+
+  try {
+    po::options_description desc("Usage");
+    // clang-format off
+    desc.add_options()("help,h", "Produce help message")
+      ("format",
+        po::value<std::string>(&format)->default_value("bgra"),
+        "Set source format, bgra or rgba")
+      ("frames,n",
+        po::value<int>(&config.frames)->default_value(100),
+        "Set number of frames converted by each way")
+      ("output-size",
+        po::value<std::string>(&output_size)->default_value("1920x1080"),
+        "Set output size")
+      ("source-size",
+        po::value<std::string>(&source_size)->default_value("3840x2160"),
+        "Set source size");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      std::cout << desc << '\n';
+      return EXIT_SUCCESS;
+    }
+    if ("rgba" == format) {
+      config.rgba = true;
+    } else if ("bgra" != format) {
+      throw std::invalid_argument("format must be bgra or rgba!");
+    }
+    if (config.frames < 1) {
+      throw std::out_of_range("frames must be positive!");
+    }
+    config.source = ParseSize(source_size, "source-size");
+    config.output = ParseSize(output_size, "output-size");
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  const Size& source = config.source;
+  const Size& output = config.output;
+  const int source_stride = source.width * 4;
+  // Gradients with some noise, like a game rather than a flat test card.
+  std::vector<std::uint8_t> pixels(
+      static_cast<std::size_t>(source_stride) * source.height);
+  std::uint32_t seed = 1;
+  for (int y = 0; y < source.height; ++y) {
+    for (int x = 0; x < source_stride; ++x) {
+      seed = seed * 1664525 + 1013904223;
+      pixels[y * source_stride + x] =
+          static_cast<std::uint8_t>((x / 4 + y) * (1 + x % 4) + (seed >> 28));
+    }
+  }
+  const std::uint8_t* const source_data[4]{pixels.data()};
+  const int source_linesize[4]{source_stride};
+  const AVPixelFormat source_format =
+      config.rgba ? AV_PIX_FMT_RGBA : AV_PIX_FMT_BGRA;
+
+  std::cout << source.width << " * " << source.height << ' ' << format
+            << " to " << output.width << " * " << output.height
+            << " I420, " << config.frames << " frames\n";
+
+  Planes scaled(output.width, output.height);
+  for (auto [name, flags] :
+       {std::pair{"swscale fast bilinear", SWS_FAST_BILINEAR},
+        std::pair{"swscale bilinear", SWS_BILINEAR},
+        std::pair{"swscale area", SWS_AREA}}) {
+    SwsContext* context = sws_getContext(
+        source.width, source.height, source_format, output.width,
+        output.height, AV_PIX_FMT_YUV420P, flags, nullptr, nullptr, nullptr);
+    Report(name, Run(config.frames, [&] {
+             return nullptr != context &&
+                    0 < sws_scale(context, source_data, source_linesize, 0,
+                                  source.height, scaled.Data(),
+                                  scaled.Linesize());
+           }));
+    sws_freeContext(context);
+  }
+
+  // Converts every pixel of the source, then scales.
+  Planes converted(source.width, source.height);
+  SwsContext* context = sws_getContext(
+      source.width, source.height, AV_PIX_FMT_YUV420P, output.width,
+      output.height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, nullptr, nullptr,
+      nullptr);
+  Report("yuv + swscale fast bilinear", Run(config.frames, [&] {
+           if (config.rgba) {
+             ABGRToI420(pixels.data(), source_stride, converted.Y(),
+                        converted.StrideY(), converted.U(),
+                        converted.StrideUV(), converted.V(),
+                        converted.StrideUV(), source.width, source.height);
+           } else {
+             ARGBToI420(pixels.data(), source_stride, converted.Y(),
+                        converted.StrideY(), converted.U(),
+                        converted.StrideUV(), converted.V(),
+                        converted.StrideUV(), source.width, source.height);
+           }
+           return nullptr != context &&
+                  0 < sws_scale(context, converted.Data(),
+                                converted.Linesize(), 0, source.height,
+                                scaled.Data(), scaled.Linesize());
+         }));
+  sws_freeContext(context);
+
+  auto scale_to_i420 = config.rgba ? ABGRScaleToI420 : ARGBScaleToI420;
+  Report("yuv fused box", Run(config.frames, [&] {
+           return 0 == scale_to_i420(pixels.data(), source_stride,
+                                     source.width, source.height, scaled.Y(),
+                                     scaled.StrideY(), scaled.U(),
+                                     scaled.StrideUV(), scaled.V(),
+                                     scaled.StrideUV(), output.width,
+                                     output.height);
+         }));
+  return EXIT_SUCCESS;
+}
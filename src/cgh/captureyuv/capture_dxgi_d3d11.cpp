@@ -193,7 +193,12 @@ void Capture(void* swap, void* backbuffer) {
     return;
   }
 
-  auto frame = g_capture_yuv.GetAvailablePackedVideoYuvFrame();
+  auto frame = g_capture_yuv.AcquirePackedVideoYuvFrame();
+  if (nullptr == frame) {
+    ATLTRACE2(atlTraceUtil, 0, "frame[%zd] dropped, no free shared frame.\n",
+              g_capture_yuv.GetFrameCount());
+    return;
+  }
   const int uv_stride = width_ >> 1;
   uint8_t* y = reinterpret_cast<uint8_t*>(frame->data);
   uint8_t* u = y + pixel_size;
@@ -228,7 +233,7 @@ void Capture(void* swap, void* backbuffer) {
   frame->stats.elapsed.yuv_convert = stats.elapsed.yuv_convert;
   frame->stats.elapsed.total = stats.elapsed.total;
 
-  g_capture_yuv.SetSharedFrameReadyEvent();
+  g_capture_yuv.PublishPackedVideoYuvFrame();
 }
 
 void Free() {
@@ -234,7 +234,7 @@ int CaptureYuv::HookThread() noexcept {
 bool CaptureYuv::CreateSharedVideoYuvFrames(size_t data_size) noexcept {
   bool need_create_file_mapping = false;
   size_t new_size =
-      sizeof(SharedVideoYuvFrames) + data_size * kNumberOfSharedFrames;
+      GetSharedVideoYuvFramesSize(kDefaultNumberOfSharedYuvFrames, data_size);
   if (nullptr == shared_frames_) {
     need_create_file_mapping = true;
   } else if (new_size > shared_frames_.GetMappingSize()) {
@@ -245,7 +245,8 @@ bool CaptureYuv::CreateSharedVideoYuvFrames(size_t data_size) noexcept {
     auto shared_frame =
         static_cast<SharedVideoYuvFrames*>(shared_frames_.GetData());
     if (shared_frame->data_size != static_cast<uint32_t>(data_size)) {
-      shared_frame->data_size = static_cast<uint32_t>(data_size);
+      ResetSharedVideoYuvFrames(shared_frame, kDefaultNumberOfSharedYuvFrames,
+                                static_cast<uint32_t>(data_size));
       ATLTRACE2(atlTraceUtil, 0,
                 "Require mapping %zu, but old %zu is enough.\n", new_size,
                 shared_frames_.GetMappingSize());
@@ -275,11 +276,13 @@ bool CaptureYuv::CreateSharedVideoYuvFrames(size_t data_size) noexcept {
       shared_frame_ready_event_.Attach(ev);
     }
 
-    ATLTRACE2(atlTraceUtil, 0, "MapSharedMem size = %zu + %zu * 2 = %zu\n",
-              sizeof(SharedVideoYuvFrames), data_size, new_size);
+    ATLTRACE2(atlTraceUtil, 0, "MapSharedMem size = %zu + %zu * %u = %zu\n",
+              sizeof(SharedVideoYuvFrames), data_size,
+              kDefaultNumberOfSharedYuvFrames, new_size);
     auto shared_frame =
         static_cast<SharedVideoYuvFrames*>(shared_frames_.GetData());
-    shared_frame->data_size = static_cast<uint32_t>(data_size);
+    ResetSharedVideoYuvFrames(shared_frame, kDefaultNumberOfSharedYuvFrames,
+                              static_cast<uint32_t>(data_size));
   }
   return true;
 }
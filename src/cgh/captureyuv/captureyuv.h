@@ -72,19 +72,22 @@ class CaptureYuv {
   void FreeSharedVideoFrameInfo() noexcept { shared_frame_info_.Unmap(); }
 
   bool CreateSharedVideoYuvFrames(size_t data_size) noexcept;
-  regame::PackedVideoYuvFrame* GetPackedVideoYuvFrame(
-      size_t index) const noexcept {
-    assert(index < regame::kNumberOfSharedFrames);
-
+  // Returns nullptr if every slot is in use, the frame is dropped then.
+  regame::PackedVideoYuvFrame* AcquirePackedVideoYuvFrame() noexcept {
     auto shared_frame =
         static_cast<regame::SharedVideoYuvFrames*>(shared_frames_.GetData());
-    return reinterpret_cast<regame::PackedVideoYuvFrame*>(
-        static_cast<char*>(shared_frames_) +
-        sizeof(regame::SharedVideoYuvFrames) + index * shared_frame->data_size);
+    writing_index_ = regame::AcquireSharedFrameToWrite(
+        shared_frame, regame::kDefaultNumberOfSharedYuvFrames);
+    if (regame::kDefaultNumberOfSharedYuvFrames == writing_index_) {
+      return nullptr;
+    }
+    return regame::GetPackedVideoYuvFrame(shared_frame, writing_index_);
   }
-  regame::PackedVideoYuvFrame* GetAvailablePackedVideoYuvFrame()
-      const noexcept {
-    return GetPackedVideoYuvFrame(frame_count_ % regame::kNumberOfSharedFrames);
+  void PublishPackedVideoYuvFrame() noexcept {
+    regame::PublishSharedFrame(
+        static_cast<regame::SharedVideoYuvFrames*>(shared_frames_.GetData()),
+        writing_index_);
+    SetSharedFrameReadyEvent();
   }
   size_t GetFrameCount() const noexcept { return frame_count_; }
   void SetSharedFrameReadyEvent() noexcept {
@@ -109,6 +112,7 @@ class CaptureYuv {
   CAtlFileMapping<char> shared_frames_;
   CHandle shared_frame_ready_event_;
   size_t frame_count_{0};
+  std::uint32_t writing_index_{0};
 
   CHandle encoder_started_event_;
   bool is_encoder_started_{false};
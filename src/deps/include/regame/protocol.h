@@ -18,7 +18,7 @@
 
 namespace regame {
 
-constexpr std::uint8_t kProtocolVersion = 1;
+constexpr std::uint8_t kProtocolVersion = 6;
 constexpr std::uint8_t kMinUsernameSize = 3;
 constexpr std::uint8_t kMaxUsernameSize = 32;
 constexpr std::uint8_t kMinVerificationSize = 6;
@@ -42,7 +42,11 @@ enum class ServerAction : std::uint8_t {
   kResetVideo,
 };
 
-enum class VerificationType : std::uint8_t { Code = 0, SM3 };
+enum class VerificationType : std::uint8_t {
+  Code = 0,
+  SM3,
+  Token  // since protocol version 3, verification_data is a LoginToken
+};
 
 #pragma pack(push, 2)
 struct PackageHead {
@@ -67,6 +71,16 @@ struct ClientLogin {
 };
 static_assert((sizeof(ClientLogin) & 1) == 0);
 
+// Issued by the user service, which shares the key with cge, so that cge can
+// authorize a login without waiting for the user service.
+// mac = HMAC-SHA256(key, username + expires)[0, kLoginTokenMacSize)
+constexpr std::size_t kLoginTokenMacSize = 28;
+struct LoginToken {
+  std::uint32_t expires;  // seconds since the Unix epoch
+  std::uint8_t mac[kLoginTokenMacSize];
+};
+static_assert(sizeof(LoginToken) == kMaxVerificationSize);
+
 #pragma region ClientControl
 enum class ControlType : std::uint8_t {
   kKeyboard = 0,
@@ -86,6 +100,8 @@ enum class ControlType : std::uint8_t {
   kJoystickBall,
   kJoystickButton,
   kJoystickHat,
+
+  kBatch = 40,  // since protocol version 2
 };
 
 enum class ButtonState : std::uint8_t { Released = 0, Pressed = 1 };
@@ -184,12 +200,122 @@ static_assert((sizeof(ClientJoystickHat) & 1) == 0);
 struct ClientGamepadAxis : public ClientJoystickAxis {};
 
 struct ClientGamepadButton : public ClientJoystickButton {};
+
+// control.timestamp is the timestamp of the first event. Followed by `count`
+// compact events, each one is:
+//   ControlType type (any type except kBatch)
+//   varint timestamp delta to the previous event
+//   payload:
+//     kMouseMove: varint x, varint y
+//     kRelativeMouseMove: zigzag varint x, zigzag varint y
+//     others: the fields after ClientControl of the single-event struct
+struct ClientControlBatch {
+  ClientControl control;
+  std::uint8_t count;
+  std::byte reserved;  // padding
+};
+static_assert((sizeof(ClientControlBatch) & 1) == 0);
+
+constexpr std::size_t kMaxVarintSize = 5;
+
+// LEB128, returns bytes written, buffer should have kMaxVarintSize at least.
+inline std::size_t WriteVarint(std::uint8_t* buffer,
+                               std::uint32_t value) noexcept {
+  std::size_t size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = static_cast<std::uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  buffer[size++] = static_cast<std::uint8_t>(value);
+  return size;
+}
+
+// Returns bytes read, 0 means truncated or overlong.
+inline std::size_t ReadVarint(const std::uint8_t* buffer,
+                              std::size_t size,
+                              std::uint32_t& value) noexcept {
+  value = 0;
+  for (std::size_t i = 0; i < size && i < kMaxVarintSize; ++i) {
+    value |= static_cast<std::uint32_t>(buffer[i] & 0x7F) << (7 * i);
+    if (0 == (buffer[i] & 0x80)) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+constexpr std::uint32_t ZigZagEncode(std::int32_t value) noexcept {
+  return (static_cast<std::uint32_t>(value) << 1) ^
+         static_cast<std::uint32_t>(value >> 31);
+}
+
+constexpr std::int32_t ZigZagDecode(std::uint32_t value) noexcept {
+  return static_cast<std::int32_t>(value >> 1) ^
+         -static_cast<std::int32_t>(value & 1);
+}
 #pragma endregion()
 
 struct ServerPacketHead {
   ServerAction action;
 };
 
+enum VideoFlags : std::uint8_t {
+  kKeyframe = 1,
+};
+
+// Since protocol version 3, every ServerAction::kVideo packet (including the
+// stream header) starts with ServerVideoHead instead of ServerPacketHead.
+// Timestamps and durations are microseconds on the server's clock. Clients
+// map them to their own clock with the offset measured by ClientPing.
+constexpr std::uint8_t kMinVideoHeadVersion = 3;
+
+struct ServerVideoHead {
+  ServerPacketHead head;
+  std::uint8_t extension_size;  // bytes after head, skip the unknown tail
+  VideoFlags flags;
+  // Since protocol version 6, see kMinTemporalIdVersion. Padding before.
+  std::uint8_t temporal_id;
+  std::uint32_t frame_id;  // 0 for stream header
+  std::uint64_t capture_timestamp;
+  std::uint32_t encode_duration;
+  std::uint64_t enqueue_timestamp;
+};
+static_assert((sizeof(ServerVideoHead) & 1) == 0);
+
+// Since protocol version 6, ServerVideoHead::temporal_id is the temporal layer
+// of the frame, 0 is the base layer. Frames above it only reference frames of
+// lower layers, so the upper layers can be dropped. Sessions of older clients
+// get every layer.
+constexpr std::uint8_t kMinTemporalIdVersion = 6;
+
+// Since protocol version 5, a ClientAction::kPing packet may be a ClientPing,
+// answered by a ServerPong on the clock of the video timestamps. With t0 the
+// client_timestamp and t1 the client's time of arrival of the pong, the
+// server clock is ahead by server_timestamp - (t0 + t1) / 2, within
+// (t1 - t0) / 2. The least round trip of a few pings gives the best offset.
+constexpr std::uint8_t kMinClockSyncVersion = 5;
+
+struct ClientPing {
+  ClientPacketHead head;
+  std::byte reserved;  // padding
+  std::uint64_t client_timestamp;  // any unit, echoed in ServerPong
+};
+static_assert((sizeof(ClientPing) & 1) == 0);
+
+struct ServerPong {
+  ServerPacketHead head;
+  std::byte reserved;  // padding
+  std::uint64_t client_timestamp;
+  std::uint64_t server_timestamp;  // microseconds, as capture_timestamp
+};
+static_assert((sizeof(ServerPong) & 1) == 0);
+
+// Since protocol version 4, ServerLoginResult::video_codec may be
+// AV_CODEC_ID_AV1, whose packets are temporal units of low overhead bitstream
+// format OBUs, with the sequence header in every keyframe. Older clients are
+// refused when cge encodes AV1.
+constexpr std::uint8_t kMinAv1Version = 4;
+
 enum WorkMode : std::uint16_t {
   kDesktop = 1,
 };
@@ -200,7 +326,7 @@ struct ServerLoginResult {
   std::uint8_t protocol_version;
   std::int32_t error_code;
   std::uint32_t audio_codec;
-  std::uint32_t video_codec;
+  std::uint32_t video_codec;  // AVCodecID
   // version >= 1
   WorkMode work_modes;
 };
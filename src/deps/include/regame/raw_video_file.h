@@ -0,0 +1,45 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "shared_mem_info.h"
+
+namespace regame {
+
+// Raw video recorded from the shared YUV frames: a RawVideoFileHeader, then
+// every frame as it was in SharedVideoYuvFrames, data_size bytes of
+// PackedVideoYuvFrame each. A replayer copies them back into the ring as
+// they are. Native byte order.
+constexpr char kRawVideoFileMagic[8] = {'R', 'G', 'R', 'A', 'W', 'V', 'I', 'D'};
+constexpr std::uint32_t kRawVideoFileVersion = 1;
+
+struct RawVideoFileHeader {
+  char magic[8];
+  std::uint32_t version;
+  VideoFrameType type;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t data_size;  // of each PackedVideoYuvFrame
+  std::uint32_t reserved;
+  // Of VideoFrameStats::timestamp on the recording machine.
+  std::uint64_t timestamp_frequency;
+};
+static_assert(sizeof(RawVideoFileHeader) == 40);
+
+}  // namespace regame
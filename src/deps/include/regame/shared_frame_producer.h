@@ -0,0 +1,145 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "shared_mem_info.h"
+#include "shared_mem_transport.h"
+
+namespace regame {
+
+// Capturer side of the shared YUV frame protocol, for tools which feed the
+// encoder without a game. The encoder creates the same objects, whichever
+// starts first.
+class SharedFrameProducer {
+ public:
+  SharedFrameProducer() noexcept = default;
+  ~SharedFrameProducer() noexcept = default;
+
+  // name_prefix is the one of ObjectNamer, such as "Global\\Regame0_".
+  std::error_code Open(std::wstring_view name_prefix,
+                       std::uint32_t number_of_frames,
+                       std::uint32_t data_size) noexcept {
+    name_prefix_ = name_prefix;
+    number_of_frames_ = number_of_frames;
+    data_size_ = data_size;
+    std::error_code ec;
+    if ((ec = started_event_.Create(GetName(kVideoStartedEventName), true)) ||
+        (ec = stopped_event_.Create(GetName(kVideoStoppedEventName), true)) ||
+        (ec = ready_event_.Create(GetName(kSharedVideoFrameReadyEventName),
+                                  false)) ||
+        (ec = frame_info_.Create(GetName(kSharedVideoFrameInfoFileMappingName),
+                                 sizeof(SharedVideoFrameInfo))) ||
+        (ec = yuv_frames_.Create(
+             GetName(kSharedVideoYuvFramesFileMappingName),
+             GetSharedVideoYuvFramesSize(number_of_frames, data_size)))) {
+      return ec;
+    }
+    return {};
+  }
+
+  // Leaves the objects of the encoder, it may outlive the producer.
+  void Close() noexcept {
+    yuv_frames_.Unmap();
+    SharedMemory::Unlink(GetName(kSharedVideoYuvFramesFileMappingName));
+  }
+
+  // Returns false on timeout or failure.
+  bool WaitForEncoder(std::chrono::milliseconds timeout) noexcept {
+    return 0 == WaitForAny({&started_event_}, timeout);
+  }
+
+  // The encoder resets the started event before it sets the stopped one.
+  bool IsEncoderStopped() noexcept {
+    return 0 == WaitForAny({&stopped_event_}, std::chrono::milliseconds(0));
+  }
+
+  // Once the encoder is started, before the first frame. The ring starts
+  // empty.
+  void Start(VideoFrameType type,
+             std::uint32_t width,
+             std::uint32_t height) noexcept {
+    ResetSharedVideoYuvFrames(GetYuvFrames(), number_of_frames_, data_size_);
+    auto frame_info = frame_info_.As<SharedVideoFrameInfo>();
+    frame_info->timestamp = GetTimestamp();
+    frame_info->type = type;
+    frame_info->width = width;
+    frame_info->height = height;
+    frame_info->format = 0;
+    frame_info->window = 0;
+  }
+
+  // Returns nullptr if every slot is being written or read, otherwise the
+  // frame to fill and Publish().
+  PackedVideoYuvFrame* Acquire() noexcept {
+    auto yuv_frames = GetYuvFrames();
+    index_ = AcquireSharedFrameToWrite(yuv_frames, number_of_frames_);
+    if (number_of_frames_ == index_) {
+      return nullptr;
+    }
+    return GetPackedVideoYuvFrame(yuv_frames, index_);
+  }
+
+  void Publish() noexcept {
+    auto yuv_frames = GetYuvFrames();
+    frame_info_.As<SharedVideoFrameInfo>()->timestamp =
+        GetPackedVideoYuvFrame(yuv_frames, index_)->stats.timestamp;
+    PublishSharedFrame(yuv_frames, index_);
+    ready_event_.Set();
+  }
+
+  // True if the encoder has taken every published frame, so that the next
+  // one won't overwrite a frame it hasn't seen.
+  bool IsDrained() const noexcept {
+    auto yuv_frames = GetYuvFrames();
+    for (std::uint32_t i = 0; i < number_of_frames_; ++i) {
+      if (SharedFrameState::kReady ==
+          yuv_frames->slots[i].state.load(std::memory_order_acquire)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::wstring GetName(std::wstring_view name) const {
+    return name_prefix_ + std::wstring(name);
+  }
+
+  SharedVideoYuvFrames* GetYuvFrames() const noexcept {
+    return yuv_frames_.As<SharedVideoYuvFrames>();
+  }
+
+ private:
+  std::wstring name_prefix_;
+  std::uint32_t number_of_frames_ = 0;
+  std::uint32_t data_size_ = 0;
+  std::uint32_t index_ = 0;  // being written
+
+  SharedEvent started_event_;
+  SharedEvent stopped_event_;
+  SharedEvent ready_event_;
+  SharedMemory frame_info_;
+  SharedMemory yuv_frames_;
+};
+
+}  // namespace regame
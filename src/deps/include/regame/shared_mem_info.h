@@ -16,11 +16,16 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string_view>
 
 namespace regame {
 
 const std::size_t kNumberOfSharedFrames = 2;
+// Slots of the SharedVideoYuvFrames ring, chosen by the capturer.
+const std::uint32_t kDefaultNumberOfSharedYuvFrames = 4;
+const std::uint32_t kMaxNumberOfSharedYuvFrames = 8;
 const std::size_t kNumberOfDataPointers = 8;
 
 // Prefix_InstanceId_TextureId, InstanceId can be process ID
@@ -91,8 +96,32 @@ struct PackedVideoYuvFrame {
   std::uint8_t data[0];  // YUV
 };
 
+enum class SharedFrameState : std::uint32_t {
+  kFree = 0,
+  kWriting,  // owned by the capturer
+  kReady,
+  kReading,  // owned by the encoder
+};
+
+// Both processes only change state with compare and exchange, so a slot has
+// one owner at a time and is never overwritten while it is being encoded.
+struct SharedFrameSlot {
+  std::atomic<SharedFrameState> state;
+  std::uint32_t reserved;
+  std::atomic<std::uint64_t> sequence;  // 0 if never written
+};
+static_assert(std::atomic<SharedFrameState>::is_always_lock_free);
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+// Ring of number_of_frames PackedVideoYuvFrame. The capturer writes into a
+// free slot, or the oldest ready slot if none is free, and publishes it with
+// the next sequence number. The encoder reads the newest ready slot and frees
+// the older ones.
 struct SharedVideoYuvFrames {
-  std::uint32_t data_size;
+  std::uint32_t data_size;  // of each PackedVideoYuvFrame
+  std::uint32_t number_of_frames;
+  std::atomic<std::uint64_t> sequence;  // of the last published slot
+  SharedFrameSlot slots[kMaxNumberOfSharedYuvFrames];
   std::uint8_t data[0];  // PackedVideoYuvFrame
 };
 
@@ -108,6 +137,133 @@ struct SharedVideoTextureFrames {
 };
 #pragma warning(pop)
 
+constexpr std::size_t GetSharedVideoYuvFramesSize(
+    std::uint32_t number_of_frames,
+    std::size_t data_size) noexcept {
+  return sizeof(SharedVideoYuvFrames) + data_size * number_of_frames;
+}
+
+inline PackedVideoYuvFrame* GetPackedVideoYuvFrame(
+    SharedVideoYuvFrames* frames,
+    std::uint32_t index) noexcept {
+  return reinterpret_cast<PackedVideoYuvFrame*>(
+      frames->data + static_cast<std::size_t>(index) * frames->data_size);
+}
+
+// Called by the capturer after (re)creating the ring.
+inline void ResetSharedVideoYuvFrames(SharedVideoYuvFrames* frames,
+                                      std::uint32_t number_of_frames,
+                                      std::uint32_t data_size) noexcept {
+  frames->data_size = data_size;
+  frames->number_of_frames = number_of_frames;
+  for (auto& slot : frames->slots) {
+    slot.state.store(SharedFrameState::kFree, std::memory_order_relaxed);
+    slot.sequence.store(0, std::memory_order_relaxed);
+  }
+  frames->sequence.store(0, std::memory_order_release);
+}
+
+// The helpers below take number_of_frames as validated by the caller, at most
+// kMaxNumberOfSharedYuvFrames, rather than the shared field, which the other
+// process could change.
+
+// Returns number_of_frames if every slot is being written or read.
+inline std::uint32_t AcquireSharedFrameToWrite(
+    SharedVideoYuvFrames* frames,
+    std::uint32_t number_of_frames) noexcept {
+  for (std::uint32_t i = 0; i < number_of_frames; ++i) {
+    auto expected = SharedFrameState::kFree;
+    if (frames->slots[i].state.compare_exchange_strong(
+            expected, SharedFrameState::kWriting, std::memory_order_acquire)) {
+      return i;
+    }
+  }
+
+  // Overwrite the oldest frame the encoder hasn't taken yet.
+  for (;;) {
+    std::uint32_t oldest = number_of_frames;
+    for (std::uint32_t i = 0; i < number_of_frames; ++i) {
+      if (SharedFrameState::kReady ==
+              frames->slots[i].state.load(std::memory_order_relaxed) &&
+          (number_of_frames == oldest ||
+           frames->slots[i].sequence.load(std::memory_order_relaxed) <
+               frames->slots[oldest].sequence.load(
+                   std::memory_order_relaxed))) {
+        oldest = i;
+      }
+    }
+    if (number_of_frames == oldest) {
+      return number_of_frames;
+    }
+    auto expected = SharedFrameState::kReady;
+    if (frames->slots[oldest].state.compare_exchange_strong(
+            expected, SharedFrameState::kWriting, std::memory_order_acquire)) {
+      return oldest;
+    }
+  }
+}
+
+inline void PublishSharedFrame(SharedVideoYuvFrames* frames,
+                               std::uint32_t index) noexcept {
+  auto& slot = frames->slots[index];
+  slot.sequence.store(frames->sequence.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  slot.state.store(SharedFrameState::kReady, std::memory_order_release);
+  frames->sequence.fetch_add(1, std::memory_order_release);
+}
+
+// Returns number_of_frames if no frame is ready.
+inline std::uint32_t AcquireSharedFrameToRead(
+    SharedVideoYuvFrames* frames,
+    std::uint32_t number_of_frames) noexcept {
+  for (;;) {
+    std::uint32_t newest = number_of_frames;
+    for (std::uint32_t i = 0; i < number_of_frames; ++i) {
+      if (SharedFrameState::kReady ==
+              frames->slots[i].state.load(std::memory_order_acquire) &&
+          (number_of_frames == newest ||
+           frames->slots[newest].sequence.load(std::memory_order_relaxed) <
+               frames->slots[i].sequence.load(std::memory_order_relaxed))) {
+        newest = i;
+      }
+    }
+    if (number_of_frames == newest) {
+      return number_of_frames;
+    }
+    auto expected = SharedFrameState::kReady;
+    if (!frames->slots[newest].state.compare_exchange_strong(
+            expected, SharedFrameState::kReading, std::memory_order_acquire)) {
+      // Taken back by the capturer.
+      continue;
+    }
+
+    // Older frames will never be read. The capturer may publish a newer
+    // frame into a slot between reading its sequence and freeing it, so the
+    // sequence is read again, as published before kReady, and such a slot is
+    // made ready again, unless the capturer has already taken it to write.
+    const std::uint64_t sequence =
+        frames->slots[newest].sequence.load(std::memory_order_relaxed);
+    for (std::uint32_t i = 0; i < number_of_frames; ++i) {
+      auto& slot = frames->slots[i];
+      expected = SharedFrameState::kReady;
+      if (i != newest &&
+          slot.sequence.load(std::memory_order_relaxed) < sequence &&
+          slot.state.compare_exchange_strong(expected, SharedFrameState::kFree,
+                                             std::memory_order_acquire) &&
+          sequence < slot.sequence.load(std::memory_order_relaxed)) {
+        expected = SharedFrameState::kFree;
+        slot.state.compare_exchange_strong(expected, SharedFrameState::kReady,
+                                           std::memory_order_release);
+      }
+    }
+    return newest;
+  }
+}
+
+inline void ReleaseSharedFrame(SharedFrameSlot& slot) noexcept {
+  slot.state.store(SharedFrameState::kFree, std::memory_order_release);
+}
+
 constexpr std::wstring_view kAudioStartedEventName{
     L"{552C62EB-1506-4252-9B4C-D6B06B1E5BE0}"};
 constexpr std::wstring_view kAudioStoppedEventName{
@@ -0,0 +1,476 @@
+/*
+ * Copyright 2020-present Ksyun
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#endif
+
+// Named shared memory and events between the capturer and the encoder.
+//
+// The Windows backend uses file mappings and events, so it talks to the
+// capture hooks, which create them with the same names. The Linux backend
+// uses POSIX shared memory, an event is a futex word in its own shared
+// memory object. POSIX names persist until Unlink(), as the two processes are
+// unrelated and can only find each other by name, memfd doesn't fit.
+//
+// Only the transport is portable. VideoEncoder still opens the shared
+// textures and converts frames with D3D11, so cge runs on Windows only, and
+// on Linux the transport serves synthetic_source, frame_replay and
+// transport_bench.
+
+namespace regame {
+
+#ifdef _WIN32
+using SecurityAttributes = SECURITY_ATTRIBUTES;
+#else
+struct SecurityAttributes {};  // The umask applies.
+#endif
+
+namespace detail {
+
+#ifndef _WIN32
+// "Global\{GUID}" -> "/Global_{GUID}"
+inline std::string ToPosixName(std::wstring_view name) {
+  std::string result("/");
+  for (wchar_t c : name) {
+    result.push_back(c < 0x80 && L'/' != c && L'\\' != c ? static_cast<char>(c)
+                                                         : '_');
+  }
+  return result;
+}
+
+inline std::error_code LastError() noexcept {
+  return std::error_code(errno, std::system_category());
+}
+#else
+inline std::error_code LastError() noexcept {
+  return std::error_code(static_cast<int>(GetLastError()),
+                         std::system_category());
+}
+#endif
+
+}  // namespace detail
+
+class SharedMemory {
+ public:
+  SharedMemory() noexcept = default;
+  SharedMemory(const SharedMemory&) = delete;
+  SharedMemory& operator=(const SharedMemory&) = delete;
+  ~SharedMemory() noexcept { Unmap(); }
+
+  // Creates the mapping, or opens it and sets *already_existed.
+  std::error_code Create(std::wstring_view name,
+                         std::size_t size,
+                         bool* already_existed = nullptr,
+                         [[maybe_unused]] SecurityAttributes* sa =
+                             nullptr) noexcept {
+    Unmap();
+    bool existed = false;
+#ifdef _WIN32
+    const std::wstring object_name(name);
+    mapping_ = CreateFileMappingW(
+        INVALID_HANDLE_VALUE, sa, PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<std::uint64_t>(size) >> 32),
+        static_cast<DWORD>(size), object_name.data());
+    if (nullptr == mapping_) {
+      return detail::LastError();
+    }
+    existed = ERROR_ALREADY_EXISTS == GetLastError();
+    if (auto ec = Map(size)) {
+      return ec;
+    }
+#else
+    const std::string object_name = detail::ToPosixName(name);
+    int fd = shm_open(object_name.data(), O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (-1 == fd && EEXIST == errno) {
+      existed = true;
+      fd = shm_open(object_name.data(), O_RDWR, 0);
+    }
+    if (-1 == fd) {
+      return detail::LastError();
+    }
+    struct stat st;
+    if (-1 == fstat(fd, &st) ||
+        (static_cast<std::size_t>(st.st_size) < size &&
+         -1 == ftruncate(fd, static_cast<off_t>(size)))) {
+      auto ec = detail::LastError();
+      close(fd);
+      return ec;
+    }
+    auto ec = Map(fd, size);
+    close(fd);
+    if (ec) {
+      return ec;
+    }
+#endif
+    if (nullptr != already_existed) {
+      *already_existed = existed;
+    }
+    return {};
+  }
+
+  // Opens an existing mapping, which must be at least size bytes.
+  std::error_code Open(std::wstring_view name, std::size_t size) noexcept {
+    Unmap();
+#ifdef _WIN32
+    const std::wstring object_name(name);
+    mapping_ = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, object_name.data());
+    if (nullptr == mapping_) {
+      return detail::LastError();
+    }
+    return Map(size);
+#else
+    int fd = shm_open(detail::ToPosixName(name).data(), O_RDWR, 0);
+    if (-1 == fd) {
+      return detail::LastError();
+    }
+    struct stat st;
+    if (-1 == fstat(fd, &st)) {
+      auto ec = detail::LastError();
+      close(fd);
+      return ec;
+    }
+    if (static_cast<std::size_t>(st.st_size) < size) {
+      close(fd);
+      return std::make_error_code(std::errc::invalid_argument);
+    }
+    auto ec = Map(fd, size);
+    close(fd);
+    return ec;
+#endif
+  }
+
+  void Unmap() noexcept {
+#ifdef _WIN32
+    if (nullptr != data_) {
+      UnmapViewOfFile(data_);
+    }
+    if (nullptr != mapping_) {
+      CloseHandle(mapping_);
+      mapping_ = nullptr;
+    }
+#else
+    if (nullptr != data_) {
+      munmap(data_, size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  // Removes the name, mappings stay valid. No-op on Windows, where the
+  // mapping goes with its last handle.
+  static void Unlink(std::wstring_view name) noexcept {
+#ifndef _WIN32
+    shm_unlink(detail::ToPosixName(name).data());
+#endif
+  }
+
+  void* GetData() const noexcept { return data_; }
+  template <typename T>
+  T* As() const noexcept {
+    return static_cast<T*>(data_);
+  }
+  std::size_t GetMappingSize() const noexcept { return size_; }
+  explicit operator bool() const noexcept { return nullptr != data_; }
+
+ private:
+#ifdef _WIN32
+  std::error_code Map(std::size_t size) noexcept {
+    data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (nullptr == data_) {
+      auto ec = detail::LastError();
+      Unmap();
+      return ec;
+    }
+    size_ = size;
+    return {};
+  }
+#else
+  std::error_code Map(int fd, std::size_t size) noexcept {
+    void* data =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == data) {
+      return detail::LastError();
+    }
+    data_ = data;
+    size_ = size;
+    return {};
+  }
+#endif
+
+ private:
+  void* data_ = nullptr;
+  std::size_t size_ = 0;
+#ifdef _WIN32
+  HANDLE mapping_ = nullptr;
+#endif
+};
+
+// An auto reset event wakes one waiter and resets, a manual reset event stays
+// signaled until Reset(). Both sides must agree on manual_reset.
+class SharedEvent {
+ public:
+  SharedEvent() noexcept = default;
+  SharedEvent(const SharedEvent&) = delete;
+  SharedEvent& operator=(const SharedEvent&) = delete;
+  ~SharedEvent() noexcept { Close(); }
+
+  // Creates the event not signaled, or opens it.
+  std::error_code Create(std::wstring_view name,
+                         bool manual_reset,
+                         SecurityAttributes* sa = nullptr) noexcept {
+    Close();
+    manual_reset_ = manual_reset;
+#ifdef _WIN32
+    const std::wstring object_name(name);
+    event_ = CreateEventW(sa, manual_reset, FALSE, object_name.data());
+    return nullptr == event_ ? detail::LastError() : std::error_code();
+#else
+    return memory_.Create(name, sizeof(std::atomic<std::uint32_t>), nullptr,
+                          sa);
+#endif
+  }
+
+  void Close() noexcept {
+#ifdef _WIN32
+    if (nullptr != event_) {
+      CloseHandle(event_);
+      event_ = nullptr;
+    }
+#else
+    memory_.Unmap();
+#endif
+  }
+
+  void Set() noexcept {
+#ifdef _WIN32
+    SetEvent(event_);
+#else
+    GetWord().store(1, std::memory_order_release);
+    syscall(SYS_futex, &GetWord(), FUTEX_WAKE, manual_reset_ ? INT_MAX : 1,
+            nullptr, nullptr, 0);
+#endif
+  }
+
+  void Reset() noexcept {
+#ifdef _WIN32
+    ResetEvent(event_);
+#else
+    GetWord().store(0, std::memory_order_release);
+#endif
+  }
+
+  static void Unlink(std::wstring_view name) noexcept {
+    SharedMemory::Unlink(name);
+  }
+
+  explicit operator bool() const noexcept {
+#ifdef _WIN32
+    return nullptr != event_;
+#else
+    return static_cast<bool>(memory_);
+#endif
+  }
+
+#ifdef _WIN32
+  HANDLE GetHandle() const noexcept { return event_; }
+#else
+  std::atomic<std::uint32_t>& GetWord() const noexcept {
+    return *memory_.As<std::atomic<std::uint32_t>>();
+  }
+
+  // Consumes the signal of an auto reset event.
+  bool TryWait() noexcept {
+    if (manual_reset_) {
+      return 0 != GetWord().load(std::memory_order_acquire);
+    }
+    std::uint32_t expected = 1;
+    return GetWord().compare_exchange_strong(expected, 0,
+                                             std::memory_order_acquire);
+  }
+#endif
+
+ private:
+  bool manual_reset_ = false;
+#ifdef _WIN32
+  HANDLE event_ = nullptr;
+#else
+  SharedMemory memory_;
+#endif
+};
+
+// Timestamps of SharedVideoFrameInfo and VideoFrameStats: ticks of
+// QueryPerformanceCounter() on Windows, nanoseconds of CLOCK_MONOTONIC on
+// Linux.
+inline std::uint64_t GetTimestamp() noexcept {
+#ifdef _WIN32
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart;
+#else
+  timespec now{};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<std::uint64_t>(now.tv_sec) * 1'000'000'000 +
+         now.tv_nsec;
+#endif
+}
+
+// Ticks per second of GetTimestamp().
+inline std::uint64_t GetTimestampFrequency() noexcept {
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  return frequency.QuadPart;
+#else
+  return 1'000'000'000;
+#endif
+}
+
+constexpr std::size_t kWaitTimeout = static_cast<std::size_t>(-1);
+constexpr std::size_t kWaitFailed = static_cast<std::size_t>(-2);
+constexpr std::chrono::milliseconds kWaitInfinite =
+    std::chrono::milliseconds::max();
+
+// Returns the index of the first signaled event, kWaitTimeout or kWaitFailed.
+// Like WaitForMultipleObjects(), an auto reset event is reset when it wakes
+// the waiter up.
+inline std::size_t WaitForAny(
+    std::initializer_list<SharedEvent*> events,
+    std::chrono::milliseconds timeout = kWaitInfinite) noexcept {
+#ifdef _WIN32
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  DWORD count = 0;
+  for (auto event : events) {
+    if (MAXIMUM_WAIT_OBJECTS == count) {
+      return kWaitFailed;
+    }
+    handles[count++] = event->GetHandle();
+  }
+  const DWORD milliseconds = kWaitInfinite == timeout
+                                 ? INFINITE
+                                 : static_cast<DWORD>(timeout.count());
+  DWORD wait = WaitForMultipleObjects(count, handles, FALSE, milliseconds);
+  if (WAIT_TIMEOUT == wait) {
+    return kWaitTimeout;
+  }
+  if (WAIT_OBJECT_0 <= wait && wait < WAIT_OBJECT_0 + count) {
+    return wait - WAIT_OBJECT_0;
+  }
+  return kWaitFailed;
+#else
+  // futex_waitv() is Linux 5.16+, older kernels wait on the last event and
+  // poll the others every kPollInterval. Callers put the busy event last.
+  struct FutexWaitv {
+    std::uint64_t val;
+    std::uint64_t uaddr;
+    std::uint32_t flags;
+    std::uint32_t reserved;
+  };
+  constexpr long kSysFutexWaitv = 449;
+  constexpr std::uint32_t kFutex32 = 2;
+  constexpr std::size_t kMaxEvents = 128;
+  constexpr auto kPollInterval = std::chrono::milliseconds(1);
+  static std::atomic<bool> futex_waitv_supported{true};
+
+  if (0 == events.size() || kMaxEvents < events.size()) {
+    return kWaitFailed;
+  }
+  FutexWaitv waiters[kMaxEvents]{};
+  std::size_t count = 0;
+  for (auto event : events) {
+    waiters[count].uaddr = reinterpret_cast<std::uintptr_t>(&event->GetWord());
+    waiters[count].flags = kFutex32;
+    ++count;
+  }
+
+  timespec deadline{};
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if (kWaitInfinite != timeout) {
+    const auto ns = std::chrono::nanoseconds(timeout).count() +
+                    deadline.tv_nsec;
+    deadline.tv_sec += static_cast<time_t>(ns / 1'000'000'000);
+    deadline.tv_nsec = static_cast<long>(ns % 1'000'000'000);
+  }
+
+  for (;;) {
+    std::size_t index = 0;
+    for (auto event : events) {
+      if (event->TryWait()) {
+        return index;
+      }
+      ++index;
+    }
+
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (kWaitInfinite != timeout &&
+        (now.tv_sec > deadline.tv_sec ||
+         (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))) {
+      return kWaitTimeout;
+    }
+
+    if (futex_waitv_supported.load(std::memory_order_relaxed)) {
+      long result =
+          syscall(kSysFutexWaitv, waiters, count, 0,
+                  kWaitInfinite == timeout ? nullptr : &deadline,
+                  CLOCK_MONOTONIC);
+      if (-1 == result && ENOSYS == errno) {
+        futex_waitv_supported.store(false, std::memory_order_relaxed);
+      } else if (-1 == result && EAGAIN != errno && ETIMEDOUT != errno &&
+                 EINTR != errno) {
+        return kWaitFailed;
+      }
+      continue;
+    }
+
+    // Relative timeout for FUTEX_WAIT.
+    const timespec poll{
+        0, static_cast<long>(
+               std::chrono::nanoseconds(kPollInterval).count())};
+    long result = syscall(SYS_futex, &events.end()[-1]->GetWord(), FUTEX_WAIT,
+                          0, &poll, nullptr, 0);
+    if (-1 == result && EAGAIN != errno && ETIMEDOUT != errno &&
+        EINTR != errno) {
+      return kWaitFailed;
+    }
+  }
+#endif
+}
+
+}  // namespace regame
@@ -50,6 +50,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // llvm-ar rc yuv.lib yuv.o
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define SIMD_ALIGNED(var) var __attribute__((aligned(16)))
@@ -65,6 +66,12 @@ typedef int8_t __attribute__((vector_size(32))) lvec8;
 typedef uint16_t __attribute__((vector_size(32))) ulvec16;
 typedef uint32_t __attribute__((vector_size(32))) ulvec32;
 typedef uint8_t __attribute__((vector_size(32))) ulvec8;
+// UMU: unaligned, for the box filter.
+typedef uint8_t __attribute__((vector_size(4), aligned(1))) vec8x4;
+typedef uint8_t __attribute__((vector_size(16), aligned(1))) vec8x16;
+typedef uint16_t __attribute__((vector_size(8), aligned(2))) vec16x4;
+typedef uint16_t __attribute__((vector_size(32), aligned(2))) vec16x16;
+typedef uint32_t __attribute__((vector_size(16))) vec32x4;
 
 #define IS_ALIGNED(p, a) (!((uintptr_t)(p) & ((a)-1)))
 #define LABELALIGN
@@ -645,4 +652,315 @@ int ABGRToI420(const uint8_t* src_abgr,
     ABGRToYRow(src_abgr, dst_y, width);
   }
   return 0;
-}
\ No newline at end of file
+}
+// UMU: Downscale ARGB/ABGR and convert to I420/NV12 in one pass. Two output
+// rows at a time are box filtered into a small buffer, which stays in the
+// cache for the row converters above, instead of a converted full size frame
+// being scaled afterwards.
+
+// Box filters 2x2 pixels into 1, 4 output pixels per loop.
+void ScaleARGBRowDown2Box_SSE2(const uint8_t* src_argb,
+                               int src_stride_argb,
+                               uint8_t* dst_argb,
+                               int dst_width) {
+  asm volatile(
+
+      LABELALIGN
+      "1:                                        \n"
+      "movdqu    (%0),%%xmm0                     \n"
+      "movdqu    0x10(%0),%%xmm1                 \n"
+      "movdqu    0x00(%0,%3,1),%%xmm2            \n"
+      "movdqu    0x10(%0,%3,1),%%xmm3            \n"
+      "lea       0x20(%0),%0                     \n"
+      "pavgb     %%xmm2,%%xmm0                   \n"
+      "pavgb     %%xmm3,%%xmm1                   \n"
+      "movdqa    %%xmm0,%%xmm2                   \n"
+      "shufps    $0x88,%%xmm1,%%xmm0             \n"
+      "shufps    $0xdd,%%xmm1,%%xmm2             \n"
+      "pavgb     %%xmm2,%%xmm0                   \n"
+      "movdqu    %%xmm0,(%1)                     \n"
+      "lea       0x10(%1),%1                     \n"
+      "sub       $0x4,%2                         \n"
+      "jg        1b                              \n"
+      : "+r"(src_argb),                   // %0
+        "+r"(dst_argb),                   // %1
+        "+r"(dst_width)                   // %2
+      : "r"((intptr_t)(src_stride_argb))  // %3
+      : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+static void ScaleARGBRowDown2Box_Any_SSE2(const uint8_t* src_argb,
+                                          int src_stride_argb,
+                                          uint8_t* dst_argb,
+                                          int dst_width) {
+  int n = dst_width & ~3;
+  int x;
+  int i;
+  if (n > 0) {
+    ScaleARGBRowDown2Box_SSE2(src_argb, src_stride_argb, dst_argb, n);
+  }
+  src_argb += n * 8;
+  dst_argb += n * 4;
+  for (x = n; x < dst_width; ++x) {
+    for (i = 0; i < 4; ++i) {
+      dst_argb[i] = (uint8_t)((src_argb[i] + src_argb[i + 4] +
+                               src_argb[src_stride_argb + i] +
+                               src_argb[src_stride_argb + i + 4] + 2) >>
+                              2);
+    }
+    src_argb += 8;
+    dst_argb += 4;
+  }
+}
+
+// Box filters rows * (src_width / dst_width) pixels into 1, rows is at most
+// 257 for the column sums to fit, which are src_width * 4, and a box is at
+// most 65536 pixels for its scale to be nonzero.
+static void ScaleARGBRowBox_C(const uint8_t* src_argb,
+                              int src_stride_argb,
+                              int src_width,
+                              int rows,
+                              uint16_t* sums,
+                              uint8_t* dst_argb,
+                              int dst_width) {
+  const int n = src_width * 4;
+  const int box_width = src_width / dst_width;
+  // 16.16, the sum of a box times scale is at most 255 * 65536.
+  const uint32_t scale[2] = {65536u / (uint32_t)(box_width * rows),
+                             65536u / (uint32_t)((box_width + 1) * rows)};
+  const int64_t dx = ((int64_t)src_width << 16) / dst_width;
+  int64_t x_end = 0;
+  const uint16_t* p = sums;
+  int xs = 0;
+  int x;
+  int i;
+  int r;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const uint8_t* src = src_argb + i;
+    vec16x16 sum = __builtin_convertvector(*(const vec8x16*)src, vec16x16);
+    for (r = 1; r < rows; ++r) {
+      src += src_stride_argb;
+      sum += __builtin_convertvector(*(const vec8x16*)src, vec16x16);
+    }
+    *(vec16x16*)(sums + i) = sum;
+  }
+  for (; i < n; ++i) {
+    const uint8_t* src = src_argb + i;
+    sums[i] = 0;
+    for (r = 0; r < rows; ++r) {
+      sums[i] += *src;
+      src += src_stride_argb;
+    }
+  }
+
+  // Boxes are box_width or box_width + 1 pixels wide, the loop over the
+  // former is the same for every pixel.
+  for (x = 0; x < dst_width; ++x) {
+    vec32x4 sum = {0, 0, 0, 0};
+    int extra;
+    x_end += dx;
+    extra = (int)(x_end >> 16) - xs - box_width;
+    for (i = 0; i < box_width; ++i) {
+      sum += __builtin_convertvector(*(const vec16x4*)p, vec32x4);
+      p += 4;
+    }
+    if (extra) {
+      sum += __builtin_convertvector(*(const vec16x4*)p, vec32x4);
+      p += 4;
+    }
+    xs += box_width + extra;
+    *(vec8x4*)dst_argb = __builtin_convertvector(
+        (sum * scale[extra] + 32768) >> 16, vec8x4);
+    dst_argb += 4;
+  }
+}
+
+static void MergeUVRow_C(const uint8_t* src_u,
+                         const uint8_t* src_v,
+                         uint8_t* dst_uv,
+                         int width) {
+  int x;
+  for (x = 0; x < width; ++x) {
+    dst_uv[0] = src_u[x];
+    dst_uv[1] = src_v[x];
+    dst_uv += 2;
+  }
+}
+
+typedef void (*ToUVRowFunction)(const uint8_t* src,
+                                int src_stride,
+                                uint8_t* dst_u,
+                                uint8_t* dst_v,
+                                int width);
+typedef void (*ToYRowFunction)(const uint8_t* src, uint8_t* dst_y, int width);
+
+// dst_uv is NULL for I420, or dst_u and dst_v are NULL for NV12.
+static int ScaleToYuv(const uint8_t* src,
+                      int src_stride,
+                      int src_width,
+                      int src_height,
+                      uint8_t* dst_y,
+                      int dst_stride_y,
+                      uint8_t* dst_u,
+                      int dst_stride_u,
+                      uint8_t* dst_v,
+                      int dst_stride_v,
+                      uint8_t* dst_uv,
+                      int dst_stride_uv,
+                      int dst_width,
+                      int dst_height,
+                      ToUVRowFunction ToUVRow,
+                      ToYRowFunction ToYRow) {
+  const int half = src_width / 2 == dst_width && src_height / 2 == dst_height;
+  const int row_size = (dst_width * 4 + 63) & ~63;
+  const int uv_size = (SS(dst_width, 1) + 63) & ~63;
+  uint8_t* buffer;
+  uint8_t* rows;
+  uint8_t* temp_u;
+  uint8_t* temp_v;
+  uint16_t* sums;
+  int y;
+  int y0 = 0;
+
+  if (!src || !dst_y || (!dst_uv && (!dst_u || !dst_v)) || src_width <= 0 ||
+      src_height == 0 || dst_width <= 0 || dst_height <= 0 ||
+      src_width < dst_width || abs(src_height) < dst_height ||
+      abs(src_height) / dst_height > 256 ||
+      (int64_t)(src_width / dst_width + 1) *
+              ((abs(src_height) + dst_height - 1) / dst_height) >
+          65536) {
+    return -1;
+  }
+  // Negative height means invert the image.
+  if (src_height < 0) {
+    src_height = -src_height;
+    src = src + (src_height - 1) * src_stride;
+    src_stride = -src_stride;
+  }
+
+  buffer = (uint8_t*)malloc(row_size * 2 + uv_size * 2 +
+                            (half ? 0 : src_width * 4 * sizeof(*sums)));
+  if (!buffer) {
+    return -1;
+  }
+  rows = buffer;
+  temp_u = buffer + row_size * 2;
+  temp_v = temp_u + uv_size;
+  sums = (uint16_t*)(temp_v + uv_size);
+  if (dst_uv) {
+    dst_u = temp_u;
+    dst_v = temp_v;
+    dst_stride_u = 0;
+    dst_stride_v = 0;
+  }
+
+  for (y = 0; y < dst_height; ++y) {
+    uint8_t* row = rows + (y & 1) * row_size;
+    if (half) {
+      ScaleARGBRowDown2Box_Any_SSE2(src + (int64_t)y * 2 * src_stride,
+                                    src_stride, row, dst_width);
+    } else {
+      const int y1 = (int)((int64_t)(y + 1) * src_height / dst_height);
+      ScaleARGBRowBox_C(src + (int64_t)y0 * src_stride, src_stride,
+                        src_width, y1 - y0, sums, row, dst_width);
+      y0 = y1;
+    }
+    if (0 == (y & 1) && y + 1 < dst_height) {
+      continue;
+    }
+
+    // A pair of rows, or the last odd one.
+    ToUVRow(rows, (y & 1) * row_size, dst_u, dst_v, dst_width);
+    if (dst_uv) {
+      MergeUVRow_C(temp_u, temp_v, dst_uv, SS(dst_width, 1));
+      dst_uv += dst_stride_uv;
+    }
+    ToYRow(rows, dst_y, dst_width);
+    if (y & 1) {
+      ToYRow(rows + row_size, dst_y + dst_stride_y, dst_width);
+    }
+    dst_y += dst_stride_y * 2;
+    dst_u += dst_stride_u;
+    dst_v += dst_stride_v;
+  }
+
+  free(buffer);
+  return 0;
+}
+
+int ARGBScaleToI420(const uint8_t* src_argb,
+                    int src_stride_argb,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_u,
+                    int dst_stride_u,
+                    uint8_t* dst_v,
+                    int dst_stride_v,
+                    int dst_width,
+                    int dst_height) {
+  const int aligned = IS_ALIGNED(dst_width, 32);
+  return ScaleToYuv(src_argb, src_stride_argb, src_width, src_height, dst_y,
+                    dst_stride_y, dst_u, dst_stride_u, dst_v, dst_stride_v,
+                    NULL, 0, dst_width, dst_height,
+                    aligned ? ARGBToUVRow_AVX2 : ARGBToUVRow_Any_AVX2,
+                    aligned ? ARGBToYRow_AVX2 : ARGBToYRow_Any_AVX2);
+}
+
+int ARGBScaleToNV12(const uint8_t* src_argb,
+                    int src_stride_argb,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_uv,
+                    int dst_stride_uv,
+                    int dst_width,
+                    int dst_height) {
+  const int aligned = IS_ALIGNED(dst_width, 32);
+  return ScaleToYuv(src_argb, src_stride_argb, src_width, src_height, dst_y,
+                    dst_stride_y, NULL, 0, NULL, 0, dst_uv, dst_stride_uv,
+                    dst_width, dst_height,
+                    aligned ? ARGBToUVRow_AVX2 : ARGBToUVRow_Any_AVX2,
+                    aligned ? ARGBToYRow_AVX2 : ARGBToYRow_Any_AVX2);
+}
+
+int ABGRScaleToI420(const uint8_t* src_abgr,
+                    int src_stride_abgr,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_u,
+                    int dst_stride_u,
+                    uint8_t* dst_v,
+                    int dst_stride_v,
+                    int dst_width,
+                    int dst_height) {
+  const int aligned = IS_ALIGNED(dst_width, 16);
+  return ScaleToYuv(src_abgr, src_stride_abgr, src_width, src_height, dst_y,
+                    dst_stride_y, dst_u, dst_stride_u, dst_v, dst_stride_v,
+                    NULL, 0, dst_width, dst_height,
+                    aligned ? ABGRToUVRow_SSSE3 : ABGRToUVRow_Any_SSSE3,
+                    aligned ? ABGRToYRow_SSSE3 : ABGRToYRow_Any_SSSE3);
+}
+
+int ABGRScaleToNV12(const uint8_t* src_abgr,
+                    int src_stride_abgr,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_uv,
+                    int dst_stride_uv,
+                    int dst_width,
+                    int dst_height) {
+  const int aligned = IS_ALIGNED(dst_width, 16);
+  return ScaleToYuv(src_abgr, src_stride_abgr, src_width, src_height, dst_y,
+                    dst_stride_y, NULL, 0, NULL, 0, dst_uv, dst_stride_uv,
+                    dst_width, dst_height,
+                    aligned ? ABGRToUVRow_SSSE3 : ABGRToUVRow_Any_SSSE3,
+                    aligned ? ABGRToYRow_SSSE3 : ABGRToYRow_Any_SSSE3);
+}
@@ -53,6 +53,54 @@ int ABGRToI420(const uint8_t* src_abgr,
                int width,
                int height);
 
+// UMU: Downscale and convert in one pass, box filtered. Return -1 if the
+// destination is larger than the source, over 256 times shorter, or if a
+// destination pixel covers over 65536 source pixels.
+int ARGBScaleToI420(const uint8_t* src_argb,
+                    int src_stride_argb,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_u,
+                    int dst_stride_u,
+                    uint8_t* dst_v,
+                    int dst_stride_v,
+                    int dst_width,
+                    int dst_height);
+int ARGBScaleToNV12(const uint8_t* src_argb,
+                    int src_stride_argb,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_uv,
+                    int dst_stride_uv,
+                    int dst_width,
+                    int dst_height);
+int ABGRScaleToI420(const uint8_t* src_abgr,
+                    int src_stride_abgr,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_u,
+                    int dst_stride_u,
+                    uint8_t* dst_v,
+                    int dst_stride_v,
+                    int dst_width,
+                    int dst_height);
+int ABGRScaleToNV12(const uint8_t* src_abgr,
+                    int src_stride_abgr,
+                    int src_width,
+                    int src_height,
+                    uint8_t* dst_y,
+                    int dst_stride_y,
+                    uint8_t* dst_uv,
+                    int dst_stride_uv,
+                    int dst_width,
+                    int dst_height);
+
 #ifdef __cplusplus
 }
 #endif